@@ -1,12 +1,29 @@
+// Сборка с окном:  g++ -std=c++17 -O2 gravity.cpp -lsfml-graphics -lsfml-window -lsfml-system
+// Без SFML:        g++ -std=c++17 -O2 -DGRAVITY_HEADLESS gravity.cpp  (только замер)
+#ifndef GRAVITY_HEADLESS
 #include <SFML/Graphics.hpp>
+#endif
 #include <vector>
 #include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+
+#include "profiler.hpp"
 
 const int WIDTH = 1200;
 const int HEIGHT = 700;
 
 const float GRAVITY = 1200.0f;
 const float BOUNCE = 0.6f;
+const float BALL_BOUNCE = 0.8f;
 const float GROUND_AMPLITUDE = 60.0f;
 const float GROUND_FREQUENCY = 0.008f;
 
@@ -17,14 +34,746 @@ float groundHeight(float x)
         + std::sin(x * GROUND_FREQUENCY * 2) * (GROUND_AMPLITUDE * 0.4f);
 }
 
-struct Ball
+// Шары в виде структуры массивов: физика не знает ни о SFML, ни об окне
+struct BallStore
+{
+    std::vector<float> x, y, vx, vy, radius;
+
+    size_t size() const { return x.size(); }
+
+    void reserve(size_t n)
+    {
+        for (auto* v : { &x, &y, &vx, &vy, &radius })
+            v->reserve(n);
+    }
+
+    void add(float px, float py, float r, float velX = 0.f, float velY = 0.f)
+    {
+        x.push_back(px);
+        y.push_back(py);
+        vx.push_back(velX);
+        vy.push_back(velY);
+        radius.push_back(r);
+    }
+};
+
+// Рельеф, заранее выбранный в таблицу с шагом step: в каждом узле высота,
+// наклон dy/dx и единичная нормаль, направленная из земли. Между узлами
+// значения интерполируются линейно, так что шаг физики обходится без sin;
+// нормаль после интерполяции нормируется заново.
+class Terrain
+{
+public:
+    struct Sample
+    {
+        float height, slope, nx, ny;
+    };
+
+    Terrain(float (*surface)(float), float minX, float maxX, float step)
+        : origin(minX), invStep(1.f / step)
+    {
+        size_t count = static_cast<size_t>(std::ceil((maxX - minX) / step)) + 1;
+        samples.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            float x = minX + i * step;
+            float h = step / 2;
+            float k = (surface(x + h) - surface(x - h)) / (2 * h);
+            float inv = 1.f / std::sqrt(1 + k * k);
+            samples[i] = { surface(x), k, k * inv, -inv };
+        }
+    }
+
+    // Значения в точке x; за краями таблицы — значения крайних узлов
+    Sample at(float x) const
+    {
+        float t = (x - origin) * invStep;
+        t = std::max(0.f, std::min(t, float(samples.size() - 1)));
+        size_t i = std::min(static_cast<size_t>(t), samples.size() - 2);
+        float f = t - i;
+        const Sample& a = samples[i];
+        const Sample& b = samples[i + 1];
+        // Хорда между единичными векторами короче единицы: без нормировки
+        // на изломе рельефа земля отталкивала бы слабее
+        float nx = a.nx + (b.nx - a.nx) * f;
+        float ny = a.ny + (b.ny - a.ny) * f;
+        float inv = 1.f / std::sqrt(nx * nx + ny * ny);
+        return { a.height + (b.height - a.height) * f, a.slope + (b.slope - a.slope) * f, nx * inv, ny * inv };
+    }
+
+    float heightAt(float x) const { return at(x).height; }
+
+private:
+    float origin, invStep;
+    std::vector<Sample> samples;
+};
+
+// Счётчики последнего шага
+struct StepStats
+{
+    size_t pairChecks = 0;  // пар с пересёкшимися заметаемыми прямоугольниками, за все проходы
+    size_t contacts = 0;    // пар, перекрывшихся в начале шага
+    size_t sortMoves = 0;   // сдвигов сортировки вставками, за все проходы
+    bool fullSort = false;  // порядок пришлось сортировать заново
+};
+
+// Физический мир без отрисовки: шаг можно вызывать из окна, из теста или из замера.
+// Столкновения решаются последовательными импульсами: контакты шар–шар и
+// шар–земля собираются в начале шага и SOLVER_ITERATIONS раз уточняются
+// с накоплением импульса. Контакт, который ещё не касается, разрешает
+// сближение только на величину зазора — быстрый шар не проскакивает сквозь
+// соседа и не уходит глубоко в кучу. Оставшееся перекрытие выталкивается
+// ограниченной скоростью, поэтому кучи не взрываются.
+// Решатель меняет скорости, и в куче шар, отброшенный соседом, может
+// налететь на шар, с которым в начале шага не сближался и пары с ним нет.
+// Поэтому сбор контактов повторяется CONTACT_PASSES раз с новыми скоростями:
+// уже выполненные контакты второй проход не трогает, он ловит только
+// сближения, созданные первым.
+class World
+{
+public:
+    static constexpr float TERRAIN_STEP = 1.0f;
+    static constexpr int SOLVER_ITERATIONS = 8;
+    static constexpr int CONTACT_PASSES = 2;
+    static constexpr float CONTACT_MARGIN = 0.1f;  // запас к радиусу при поиске контактов
+    static constexpr float ALLOWED_OVERLAP = 0.02f; // доля суммы радиусов, которую не выталкиваем
+    static constexpr float PUSH_RATE = 0.5f;       // доля перекрытия, выталкиваемая за шаг
+    static constexpr float MAX_PUSH_SPEED = 300.0f;
+    static constexpr float REST_SPEED = 30.0f;     // удар медленнее — без отскока
+
+    BallStore balls;
+    Terrain terrain;
+    bool collisions = true;
+
+    World() : terrain(groundHeight, 0, WIDTH, TERRAIN_STEP) {}
+
+    void step(float dt)
+    {
+        PROFILE_SCOPE("step");
+        const size_t n = balls.size();
+        float* vy = balls.vy.data();
+
+        // Гравитация
+        for (size_t i = 0; i < n; i++)
+            vy[i] += GRAVITY * dt;
+
+        stats = StepStats();
+        for (int pass = 0; pass < CONTACT_PASSES; pass++)
+        {
+            contactList.clear();
+            {
+                PROFILE_SCOPE("find_contacts");
+                if (collisions)
+                    findContacts(dt);
+                findGroundContacts(dt);
+            }
+
+            {
+                PROFILE_SCOPE("solve");
+                for (int it = 0; it < SOLVER_ITERATIONS; it++)
+                {
+                    for (Contact& c : contactList)
+                        solve(c);
+                    for (GroundContact& g : groundList)
+                        solve(g);
+                }
+            }
+        }
+
+        integrate(dt);
+
+        if (collisions)
+        {
+            PROFILE_COUNT("pair_checks", stats.pairChecks);
+            PROFILE_COUNT("contacts", stats.contacts);
+            PROFILE_VALUE("sort_moves", stats.sortMoves);
+            if (stats.fullSort)
+                PROFILE_COUNT("full_sorts", 1);
+        }
+    }
+
+    const StepStats& lastStep() const { return stats; }
+
+private:
+    // Прямоугольник, который шар заметает за шаг; sweep отсортирован по левому краю
+    struct Interval
+    {
+        float lo, hi;
+        float top, bottom;
+        uint32_t id;
+    };
+
+    // Нормаль от a к b, нужная нормальная скорость и накопленный импульс
+    struct Contact
+    {
+        uint32_t a, b;
+        float nx, ny;
+        float target;
+        float mass;
+        float impulse;
+    };
+
+    // Нормаль земли направлена из земли к шару
+    struct GroundContact
+    {
+        uint32_t ball;
+        float nx, ny;
+        float target;
+        float impulse;
+    };
+
+    std::vector<Interval> sweep;
+    std::vector<Interval> banded;      // sweep, разложенный по полосам y
+    std::vector<size_t> bandStart;     // начало каждой полосы в banded
+    std::vector<size_t> bandFill;      // позиция записи в каждой полосе
+    std::vector<uint32_t> bandLo, bandHi; // крайние полосы каждого шара
+    std::vector<Contact> contactList;
+    std::vector<GroundContact> groundList;
+    StepStats stats;
+
+    // Нормальная скорость, которой добивается контакт с перекрытием depth
+    // (отрицательное — зазор) при скорости сближения approach
+    static float targetSpeed(float depth, float allowed, float approach, float bounce, float dt)
+    {
+        if (depth < 0)
+            return depth / dt;  // можно сблизиться ровно на зазор
+        float push = std::min(PUSH_RATE * std::max(0.f, depth - allowed) / dt, MAX_PUSH_SPEED);
+        float rebound = approach < -REST_SPEED ? -bounce * approach : 0.f;
+        return std::max(push, rebound);
+    }
+
+    // Прямоугольник шара — круг с запасом, протянутый вдоль пути за dt.
+    // Пересечься за шаг могут только шары с пересёкшимися прямоугольниками;
+    // в отличие от отрезка ±|v|·dt, путь назад в него не входит. За кадр шары
+    // смещаются мало, порядок по x почти не меняется,
+    // и сортировка вставками близка к O(N); если сдвигов оказалось слишком
+    // много (новые шары, плотная куча), порядок досортировывается std::sort.
+    void sortSweep(float dt)
+    {
+        const size_t n = balls.size();
+        const float* x = balls.x.data();
+        const float* y = balls.y.data();
+        const float* vx = balls.vx.data();
+        const float* vy = balls.vy.data();
+        const float* r = balls.radius.data();
+
+        for (size_t i = sweep.size(); i < n; i++)
+            sweep.push_back({ 0, 0, 0, 0, static_cast<uint32_t>(i) });
+        for (Interval& e : sweep)
+        {
+            float reach = r[e.id] * (1 + CONTACT_MARGIN);
+            float moveX = vx[e.id] * dt, moveY = vy[e.id] * dt;
+            e.lo = x[e.id] + std::min(0.f, moveX) - reach;
+            e.hi = x[e.id] + std::max(0.f, moveX) + reach;
+            e.top = y[e.id] + std::min(0.f, moveY) - reach;
+            e.bottom = y[e.id] + std::max(0.f, moveY) + reach;
+        }
+
+        const size_t limit = stats.sortMoves + 4 * sweep.size() + 64;
+        for (size_t k = 1; k < sweep.size(); k++)
+        {
+            Interval e = sweep[k];
+            size_t j = k;
+            while (j > 0 && sweep[j - 1].lo > e.lo)
+            {
+                sweep[j] = sweep[j - 1];
+                j--;
+                stats.sortMoves++;
+            }
+            sweep[j] = e;
+            if (stats.sortMoves > limit)
+            {
+                std::sort(sweep.begin(), sweep.end(),
+                          [](const Interval& a, const Interval& b) { return a.lo < b.lo; });
+                stats.fullSort = true;
+                break;
+            }
+        }
+    }
+
+    // Отсечка только по x не спасает кучу: шары одного столбца делят
+    // отрезки по x по всей высоте кучи. Поэтому прямоугольники раскладываются
+    // по горизонтальным полосам: шар попадает в каждую полосу, которую
+    // задевает. Раскладка идёт в порядке sweep, так что внутри полосы порядок
+    // по левому краю сохраняется без досортировки. Высота полосы — средняя
+    // высота прямоугольника, и шар обычно попадает в одну-две полосы.
+    void fillBands()
+    {
+        const size_t n = sweep.size();
+        float top = std::numeric_limits<float>::max();
+        float bottom = std::numeric_limits<float>::lowest();
+        double sumHeight = 0;
+        for (const Interval& e : sweep)
+        {
+            top = std::min(top, e.top);
+            bottom = std::max(bottom, e.bottom);
+            sumHeight += e.bottom - e.top;
+        }
+        float height = static_cast<float>(sumHeight / std::max<size_t>(n, 1));
+        if (!(height > 0))
+            height = 1;
+        // Полос не больше, чем шаров: улетевший шар не раздувает таблицу
+        size_t bands = n == 0 ? 1 : static_cast<size_t>((bottom - top) / height) + 1;
+        if (bands > n)
+        {
+            bands = std::max<size_t>(n, 1);
+            height = std::max(height, (bottom - top) / bands);
+        }
+        const float invHeight = 1.f / height;
+        auto band = [&](float v) {
+            return static_cast<uint32_t>(std::min<float>((v - top) * invHeight, float(bands - 1)));
+        };
+
+        bandLo.resize(n);
+        bandHi.resize(n);
+        bandStart.assign(bands + 1, 0);
+        for (const Interval& e : sweep)
+        {
+            bandLo[e.id] = band(e.top);
+            bandHi[e.id] = band(e.bottom);
+            for (uint32_t b = bandLo[e.id]; b <= bandHi[e.id]; b++)
+                bandStart[b + 1]++;
+        }
+        for (size_t b = 0; b < bands; b++)
+            bandStart[b + 1] += bandStart[b];
+
+        banded.resize(bandStart[bands]);
+        bandFill.assign(bandStart.begin(), bandStart.end() - 1);
+        for (const Interval& e : sweep)
+            for (uint32_t b = bandLo[e.id]; b <= bandHi[e.id]; b++)
+                banded[bandFill[b]++] = e;
+    }
+
+    // Проход по отрезкам каждой полосы, отсортированным по левому краю, затем
+    // точная проверка: в список попадают касающиеся пары и пары, которые
+    // сближаются достаточно быстро, чтобы столкнуться за шаг. Пара, общая
+    // для нескольких полос, проверяется только в первой из них. Масса шара
+    // пропорциональна r².
+    void findContacts(float dt)
+    {
+        sortSweep(dt);
+        fillBands();
+        const float* x = balls.x.data();
+        const float* y = balls.y.data();
+        const float* vx = balls.vx.data();
+        const float* vy = balls.vy.data();
+        const float* r = balls.radius.data();
+        stats.contacts = 0;
+
+        for (size_t b = 0; b + 1 < bandStart.size(); b++)
+        {
+            const size_t end = bandStart[b + 1];
+            for (size_t k = bandStart[b]; k < end; k++)
+            {
+                const uint32_t i = banded[k].id;
+                const float hi = banded[k].hi;
+                const float top = banded[k].top, bottom = banded[k].bottom;
+                for (size_t m = k + 1; m < end && banded[m].lo <= hi; m++)
+                {
+                    const uint32_t j = banded[m].id;
+                    if (banded[m].top > bottom || banded[m].bottom < top ||
+                        std::max(bandLo[i], bandLo[j]) != b)
+                        continue;
+                    stats.pairChecks++;
+
+                    // Прямоугольники пересекаются; по y пара сравнивается ещё и с
+                    // учётом относительной скорости, без корня
+                    float dx = x[j] - x[i];
+                    float dy = y[j] - y[i];
+                    float minDist = r[i] + r[j];
+                    float near = minDist * (1 + CONTACT_MARGIN);
+                    if (std::abs(dy) >= near + std::abs(vy[j] - vy[i]) * dt)
+                        continue;
+                    float d2 = dx * dx + dy * dy;
+                    if (d2 == 0)
+                        continue;
+                    float dist = std::sqrt(d2);
+                    float nx = dx / dist, ny = dy / dist;
+                    float approach = (vx[j] - vx[i]) * nx + (vy[j] - vy[i]) * ny;
+                    if (dist >= near + std::max(0.f, -approach) * dt)
+                        continue;
+
+                    float mass = 1.f / (1.f / (r[i] * r[i]) + 1.f / (r[j] * r[j]));
+                    float target = targetSpeed(minDist - dist, ALLOWED_OVERLAP * minDist, approach,
+                                               BALL_BOUNCE, dt);
+                    contactList.push_back({ i, j, nx, ny, target, mass, 0.f });
+                    stats.contacts += dist < minDist;
+                }
+            }
+        }
+    }
+
+    // Расстояние до касательной к земле вдоль нормали
+    void findGroundContacts(float dt)
+    {
+        const size_t n = balls.size();
+        const float* x = balls.x.data();
+        const float* y = balls.y.data();
+        const float* vx = balls.vx.data();
+        const float* vy = balls.vy.data();
+        const float* r = balls.radius.data();
+        groundList.clear();
+
+        for (size_t i = 0; i < n; i++)
+        {
+            Terrain::Sample g = terrain.at(x[i]);
+            float dist = (y[i] - g.height) * g.ny;
+            float speed = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+            if (dist - r[i] > speed * dt + r[i] * CONTACT_MARGIN)
+                continue;
+            float approach = vx[i] * g.nx + vy[i] * g.ny;
+            float target = targetSpeed(r[i] - dist, ALLOWED_OVERLAP * r[i], approach, BOUNCE, dt);
+            groundList.push_back({ static_cast<uint32_t>(i), g.nx, g.ny, target, 0.f });
+        }
+    }
+
+    // Импульс вдоль нормали; накопленный импульс не становится
+    // отрицательным — контакт только отталкивает
+    void solve(Contact& c)
+    {
+        float* vx = balls.vx.data();
+        float* vy = balls.vy.data();
+        const float* r = balls.radius.data();
+
+        float vn = (vx[c.b] - vx[c.a]) * c.nx + (vy[c.b] - vy[c.a]) * c.ny;
+        float total = std::max(0.f, c.impulse + (c.target - vn) * c.mass);
+        float delta = total - c.impulse;
+        c.impulse = total;
+
+        float invA = 1.f / (r[c.a] * r[c.a]);
+        float invB = 1.f / (r[c.b] * r[c.b]);
+        vx[c.a] -= c.nx * delta * invA;
+        vy[c.a] -= c.ny * delta * invA;
+        vx[c.b] += c.nx * delta * invB;
+        vy[c.b] += c.ny * delta * invB;
+    }
+
+    // Земля неподвижна, импульс меняет только скорость шара
+    void solve(GroundContact& g)
+    {
+        float& vx = balls.vx[g.ball];
+        float& vy = balls.vy[g.ball];
+        float vn = vx * g.nx + vy * g.ny;
+        float total = std::max(0.f, g.impulse + (g.target - vn));
+        float delta = total - g.impulse;
+        g.impulse = total;
+        vx += g.nx * delta;
+        vy += g.ny * delta;
+    }
+
+    void integrate(float dt)
+    {
+        const size_t n = balls.size();
+        float* x = balls.x.data();
+        float* y = balls.y.data();
+        float* vx = balls.vx.data();
+        const float* vy = balls.vy.data();
+        const float* r = balls.radius.data();
+
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+
+            // Стены по краям окна
+            if (x[i] < r[i])
+            {
+                x[i] = r[i];
+                vx[i] = std::abs(vx[i]) * BOUNCE;
+            }
+            else if (x[i] > WIDTH - r[i])
+            {
+                x[i] = WIDTH - r[i];
+                vx[i] = -std::abs(vx[i]) * BOUNCE;
+            }
+        }
+    }
+};
+
+// Вершина пакета шаров. С окном это sf::Vertex, без SFML — такая же пара
+// координат, чтобы замер строил ровно тот буфер, который рисуется
+#ifdef GRAVITY_HEADLESS
+struct BatchPoint
 {
-    sf::CircleShape shape;
-    sf::Vector2f velocity;
+    float x, y;
 };
 
-int main()
+struct BatchVertex
+{
+    BatchPoint position, texCoords;
+};
+#else
+using BatchVertex = sf::Vertex;
+#endif
+
+// Все шары одним вызовом отрисовки: каждый шар — квадрат из двух
+// треугольников с текстурой круга. Буфер живёт между кадрами и только
+// растёт; текстурные координаты одинаковы для всех кадров и пишутся один
+// раз при росте, каждый кадр обновляются лишь позиции.
+class BallBatch
+{
+public:
+    static constexpr int VERTICES_PER_BALL = 6;
+    static constexpr float TEXTURE_SIZE = 64.0f;
+
+    void update(const BallStore& balls)
+    {
+        PROFILE_SCOPE("build_vertices");
+        const size_t n = balls.size();
+        if (vertices.size() < n * VERTICES_PER_BALL)
+            grow(n * VERTICES_PER_BALL);
+        count = n * VERTICES_PER_BALL;
+
+        const float* x = balls.x.data();
+        const float* y = balls.y.data();
+        const float* r = balls.radius.data();
+        BatchVertex* v = vertices.data();
+        for (size_t i = 0; i < n; i++, v += VERTICES_PER_BALL)
+        {
+            float x0 = x[i] - r[i], x1 = x[i] + r[i];
+            float y0 = y[i] - r[i], y1 = y[i] + r[i];
+            v[0].position = { x0, y0 };
+            v[1].position = { x1, y0 };
+            v[2].position = { x1, y1 };
+            v[3].position = { x0, y0 };
+            v[4].position = { x1, y1 };
+            v[5].position = { x0, y1 };
+        }
+    }
+
+    const BatchVertex* data() const { return vertices.data(); }
+    size_t vertexCount() const { return count; }
+
+private:
+    std::vector<BatchVertex> vertices;
+    size_t count = 0;
+
+    void grow(size_t size)
+    {
+        const float t = TEXTURE_SIZE;
+        const float corners[VERTICES_PER_BALL][2] = {
+            { 0, 0 }, { t, 0 }, { t, t }, { 0, 0 }, { t, t }, { 0, t }
+        };
+        size_t old = vertices.size();
+        vertices.resize(size);
+        for (size_t k = old; k < size; k++)
+        {
+            const float* c = corners[k % VERTICES_PER_BALL];
+            vertices[k].texCoords = { c[0], c[1] };
+        }
+    }
+};
+
+// Шары по сетке со случайным сдвигом в верхней половине окна, без
+// перекрытий; если не помещаются, ряды продолжаются выше окна
+void scatterBalls(World& world, size_t count, float radius, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    float cell = std::max(2.2f * radius, std::sqrt(WIDTH * (HEIGHT / 2.f) / count));
+    size_t cols = std::max<size_t>(1, static_cast<size_t>((WIDTH - 2 * radius) / cell));
+    std::uniform_real_distribution<float> jitter(-(cell / 2 - radius), cell / 2 - radius);
+    world.balls.reserve(world.balls.size() + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float x = radius + (i % cols + 0.5f) * cell;
+        float y = HEIGHT / 2.f - (i / cols + 0.5f) * cell;
+        world.balls.add(x + jitter(rng), y + jitter(rng), radius);
+    }
+}
+
+// Радиус шаров в замере: шары занимают около половины площади, где их
+// расставляет scatterBalls, но не больше 4 px
+float benchRadius(size_t count)
+{
+    return std::min(4.f, 0.4f * std::sqrt(WIDTH * (HEIGHT / 2.f) / count));
+}
+
+// Прогон заданных размеров с шагом 1/60 с без окна; в конце печатаются
+// счётчики последнего шага на один шар
+int runBenchmark(const std::vector<size_t>& sizes, int steps, bool collisions)
+{
+    const float dt = 1.f / 60;
+    std::cout << "        N   шагов   нс/шар·шаг     шаров·шагов/с   пар/шар  контактов/шар"
+                 "   нс/шар вершины\n";
+    for (size_t n : sizes)
+    {
+        World world;
+        world.collisions = collisions;
+        scatterBalls(world, n, benchRadius(n), 1);
+        BallBatch batch;
+
+        // Физика и построение вершин замеряются отдельно, как в окне:
+        // шаг, затем заполнение буфера для отрисовки
+        double sec = 0, meshSec = 0;
+        for (int s = 0; s < steps; s++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            world.step(dt);
+            auto t1 = std::chrono::steady_clock::now();
+            batch.update(world.balls);
+            auto t2 = std::chrono::steady_clock::now();
+            sec += std::chrono::duration<double>(t1 - t0).count();
+            meshSec += std::chrono::duration<double>(t2 - t1).count();
+        }
+
+        // Контрольная сумма не даёт компилятору выбросить расчёт
+        double sum = 0;
+        for (float y : world.balls.y)
+            sum += y;
+        if (batch.vertexCount() > 0)
+            sum += batch.data()[batch.vertexCount() - 1].position.y;
+
+        double ballSteps = double(n) * steps;
+        std::cout << std::setw(9) << n << std::setw(8) << steps << std::fixed
+                  << std::setw(13) << std::setprecision(2) << sec * 1e9 / ballSteps
+                  << std::setw(18) << std::scientific << std::setprecision(3) << ballSteps / sec
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << double(world.lastStep().pairChecks) / n
+                  << std::setw(15) << double(world.lastStep().contacts) / n
+                  << std::setw(17) << meshSec * 1e9 / ballSteps
+                  << "   (Σy = " << std::setprecision(0) << sum << ")\n";
+    }
+    return 0;
+}
+
+// Параметры: gravity --bench [--steps N] [--no-collisions] [--profile F] [N ...];
+// без SFML замер запускается всегда
+int benchmarkMain(int argc, char** argv)
+{
+    std::vector<size_t> sizes;
+    int steps = 100;
+    bool collisions = true;
+    std::string profilePath;
+    auto value = [&](int& i, const std::string& arg) -> std::string
+    {
+        if (i + 1 >= argc)
+            throw std::invalid_argument("нет значения для " + arg);
+        return argv[++i];
+    };
+    // stoll принял бы « 12», «+12» и «12abc», а «--help» отверг бы с
+    // невнятным «stoll»; здесь допускаются только цифры со знаком минус
+    auto number = [](const std::string& s)
+    {
+        size_t first = !s.empty() && s[0] == '-' ? 1 : 0;
+        if (first == s.size() ||
+            !std::all_of(s.begin() + first, s.end(), [](unsigned char c) { return std::isdigit(c); }))
+            throw std::invalid_argument("ожидалось число: " + s);
+        try
+        {
+            return std::stoll(s);
+        }
+        catch (const std::out_of_range&)
+        {
+            throw std::invalid_argument("слишком большое число: " + s);
+        }
+    };
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--bench")
+            continue;
+        if (arg == "--steps")
+        {
+            // Пустой прогон дал бы inf и nan в таблице
+            long long n = number(value(i, arg));
+            if (n < 1 || n > std::numeric_limits<int>::max())
+                throw std::invalid_argument("число шагов должно быть от 1 до " +
+                                            std::to_string(std::numeric_limits<int>::max()));
+            steps = static_cast<int>(n);
+        }
+        else if (arg == "--no-collisions")
+            collisions = false;
+        else if (arg == "--profile")
+            profilePath = value(i, arg);
+        else if (arg.size() > 1 && arg[0] == '-' && !std::isdigit(static_cast<unsigned char>(arg[1])))
+            throw std::invalid_argument("неизвестный параметр: " + arg);
+        else
+        {
+            long long n = number(arg);
+            if (n < 1)
+                throw std::invalid_argument("число шаров должно быть положительным: " + arg);
+            sizes.push_back(static_cast<size_t>(n));
+        }
+    }
+    // Миллион сталкивающихся шаров в окне 1200×700 — куча глубиной в сотни
+    // шаров по 0.26 px. Восемь итераций решателя такую кучу не держат: шары
+    // разлетаются со скоростями в тысячи px/с, и упреждающие контакты в
+    // пределах скорость·dt исчисляются тысячами на шар, пока не кончится
+    // память. Широкая фаза тут ни при чём; по умолчанию миллион идёт только
+    // без столкновений
+    if (sizes.empty())
+        sizes = collisions ? std::vector<size_t>{ 10000, 100000 }
+                           : std::vector<size_t>{ 10000, 100000, 1000000 };
+    profiler::Session profile(profilePath);
+    return runBenchmark(sizes, steps, collisions);
+}
+
+#ifdef GRAVITY_HEADLESS
+
+int main(int argc, char** argv)
 {
+    try
+    {
+        return benchmarkMain(argc, argv);
+    }
+    catch (const std::invalid_argument& e)
+    {
+        std::cerr << e.what() << "\n";
+        std::cerr << "Использование: gravity [--steps N] [--no-collisions] [--profile F] [N ...]\n";
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
+
+#else
+
+// Белый круг на прозрачном фоне со сглаженным краем в один пиксель
+sf::Texture makeBallTexture()
+{
+    const unsigned size = static_cast<unsigned>(BallBatch::TEXTURE_SIZE);
+    const float c = size / 2.f;
+    sf::Image image;
+    image.create(size, size, sf::Color::Transparent);
+    for (unsigned py = 0; py < size; py++)
+        for (unsigned px = 0; px < size; px++)
+        {
+            float d = std::hypot(px + 0.5f - c, py + 0.5f - c);
+            float alpha = std::clamp(c - d, 0.f, 1.f);
+            image.setPixel(px, py, sf::Color(255, 255, 255, static_cast<sf::Uint8>(alpha * 255)));
+        }
+
+    sf::Texture texture;
+    if (!texture.loadFromImage(image))
+        throw std::runtime_error("Не удалось создать текстуру шара");
+    texture.setSmooth(true);
+    return texture;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+    {
+        try
+        {
+            return benchmarkMain(argc, argv);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            std::cerr << e.what() << "\n";
+            std::cerr << "Использование: gravity --bench [--steps N] [--no-collisions] [--profile F] [N ...]\n";
+            return 1;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Gravity Simulation");
     window.setFramerateLimit(60);
 
@@ -37,20 +786,18 @@ int main()
     }
 
     // Шары
-    std::vector<Ball> balls;
+    World world;
     for (int i = 0; i < 6; i++)
-    {
-        Ball b;
-        b.shape = sf::CircleShape(18);
-        b.shape.setOrigin(18, 18);
-        b.shape.setPosition(200 + i * 80, 100);
-        b.shape.setFillColor(sf::Color::White);
-        b.velocity = { 0.f, 0.f };
-        balls.push_back(b);
-    }
+        world.balls.add(200 + i * 80, 100, 18);
+
+    sf::Texture ballTexture = makeBallTexture();
+    BallBatch batch;
 
     sf::Clock clock;
 
+    // Профиль окна пишется, если задана переменная PROFILE
+    profiler::Session profile;
+
     while (window.isOpen())
     {
         sf::Event event;
@@ -60,34 +807,19 @@ int main()
                 window.close();
         }
 
-        float dt = clock.restart().asSeconds();
-
-        for (auto& ball : balls)
-        {
-            // Гравитация
-            ball.velocity.y += GRAVITY * dt;
-
-            sf::Vector2f pos = ball.shape.getPosition();
-            pos += ball.velocity * dt;
-
-            float groundY = groundHeight(pos.x);
-
-            // Столкновение с землёй
-            if (pos.y + ball.shape.getRadius() > groundY)
-            {
-                pos.y = groundY - ball.shape.getRadius();
-                ball.velocity.y *= -BOUNCE;
-            }
-
-            ball.shape.setPosition(pos);
-        }
+        float frameTime = clock.restart().asSeconds();
+        PROFILE_VALUE("frame_us", frameTime * 1e6f);
+        world.step(frameTime);
 
+        PROFILE_SCOPE("render");
         window.clear(sf::Color(20, 20, 20));
         window.draw(ground);
-        for (auto& ball : balls)
-            window.draw(ball.shape);
+        batch.update(world.balls);
+        window.draw(batch.data(), batch.vertexCount(), sf::Triangles, &ballTexture);
         window.display();
     }
 
     return 0;
 }
+
+#endif
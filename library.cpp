@@ -5,9 +5,39 @@
 #include <memory>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <stdexcept>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <cmath>
+#include <charconv>
+#include <functional>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "profiler.hpp"
+
+enum class BookKind : uint8_t {
+    Science = 0,
+    Fiction = 1
+};
 
 // --------------------- БАЗОВЫЙ КЛАСС КНИГИ ---------------------
+// Фасад книги для ввода в Library и печати вне каталога; в каталоге
+// книга хранится записью BookRecord (см. BookStore)
 class Book {
 protected:
     std::string title;
@@ -25,10 +55,13 @@ public:
         std::cout << "Название: " << title
                   << ", Автор: " << author
                   << ", Год: " << year
-                  << ", Взята: " << (isBorrowed ? "Да" : "Нет") << std::endl;
+                  << ", Взята: " << (isBorrowed ? "Да" : "Нет") << '\n';
     }
 
     virtual std::string serialize() const = 0;
+    virtual BookKind kind() const = 0;
+    // Область науки или жанр
+    virtual const std::string& getDetail() const = 0;
 
     const std::string& getTitle() const { return title; }
     const std::string& getAuthor() const { return author; }
@@ -39,6 +72,284 @@ public:
     bool borrowed() const { return isBorrowed; }
 };
 
+// --------------------- ДВОИЧНЫЙ ФОРМАТ КАТАЛОГА ---------------------
+// Столбцовый формат: заголовок, затем столбцы фиксированной ширины
+// (ссылки на строки title/author/detail, год, тип, признак выдачи)
+// и общая куча строк UTF-8. Строки в куче не экранируются и не
+// завершаются нулём, одинаковые авторы и жанры хранятся один раз.
+// Версия 2 добавляет в заголовок LSN — номер последней операции журнала,
+// вошедшей в снимок; файлы версии 1 читаются с LSN = 0.
+// Версия 3 добавляет постоянные id книг и пользователей с их выдачами:
+// выдачи хранятся как id книг, поэтому загрузка идёт за один проход
+// без поиска по названиям.
+// Книги записываются по возрастанию id; порядок вывода в файле не хранится.
+//
+// Порядок столбцов версии 3 (сначала 4- и 8-байтовые, затем байтовые):
+//   refs[3][count], years[count], ids[count],
+//   userIds[users], userNames[users], loanStart[users + 1], loans[loans],
+//   kinds[count], flags[count], heap
+namespace catalog_format {
+
+constexpr char MAGIC[4] = { 'L', 'B', 'C', 'T' };
+constexpr uint32_t VERSION = 3;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    uint64_t heapSize;
+    uint64_t lsn;
+    uint64_t userCount;
+    uint64_t loanCount;
+};
+
+constexpr size_t HEADER_V1_BYTES = 24;
+constexpr size_t HEADER_V2_BYTES = 32;
+
+inline size_t headerBytes(uint32_t version) {
+    return version == 1 ? HEADER_V1_BYTES : version == 2 ? HEADER_V2_BYTES : sizeof(Header);
+}
+
+// Ссылка на строку в куче
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Размер столбцов в байтах на одну книгу
+inline size_t recordBytes(uint32_t version) {
+    return 3 * sizeof(StringRef) + sizeof(int32_t) + 2 * sizeof(uint8_t) + (version >= 3 ? sizeof(uint32_t) : 0);
+}
+
+constexpr size_t USER_BYTES = sizeof(int32_t) + sizeof(StringRef) + sizeof(uint32_t);
+
+} // namespace catalog_format
+
+// Запись каталога поверх отображённого файла — без копирования строк
+struct BookRecordView {
+    uint32_t id;
+    BookKind kind;
+    bool borrowed;
+    int year;
+    std::string_view title;
+    std::string_view author;
+    std::string_view detail; // область науки или жанр
+};
+
+// Пользователь каталога: его выдачи — loans[loanBegin, loanEnd) в CatalogView::loan
+struct UserRecordView {
+    int id;
+    std::string_view name;
+    uint32_t loanBegin;
+    uint32_t loanEnd;
+};
+
+// Каталог, отображённый в память через mmap. Записи читаются по индексу
+// прямо из файла; файл остаётся отображённым, пока жив объект.
+class CatalogView {
+    const char* data = nullptr;
+    size_t length = 0;
+    uint32_t formatVersion = 0;
+    size_t count = 0;
+    size_t users = 0;
+    size_t loans = 0;
+    const char* refs = nullptr;    // 3 столбца StringRef
+    const char* years = nullptr;
+    const char* ids = nullptr;
+    const char* userIds = nullptr;
+    const char* userNames = nullptr;
+    const char* loanStart = nullptr;
+    const char* loanBooks = nullptr;
+    const uint8_t* kinds = nullptr;
+    const uint8_t* flags = nullptr;
+    const char* heap = nullptr;
+    size_t heapSize = 0;
+    uint64_t snapshotLsn = 0;
+
+    template <typename T>
+    static T load(const char* column, size_t i) {
+        T v;
+        std::memcpy(&v, column + i * sizeof(T), sizeof(T));
+        return v;
+    }
+
+    std::string_view string(const char* column, size_t i) const {
+        auto ref = load<catalog_format::StringRef>(column, i);
+        return std::string_view(heap + ref.offset, ref.length);
+    }
+
+    void fail() {
+        ::munmap(const_cast<char*>(data), length);
+        data = nullptr;
+        throw std::runtime_error("Файл каталога повреждён");
+    }
+
+    bool validRef(const char* column, size_t i) const {
+        auto ref = load<catalog_format::StringRef>(column, i);
+        return static_cast<uint64_t>(ref.offset) + ref.length <= heapSize;
+    }
+
+public:
+    explicit CatalogView(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии файла для чтения");
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < catalog_format::HEADER_V1_BYTES) {
+            ::close(fd);
+            throw std::runtime_error("Файл каталога повреждён");
+        }
+        length = static_cast<size_t>(st.st_size);
+        PROFILE_COUNT("bytes_mapped", length);
+        void* m = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) throw std::runtime_error("Ошибка отображения файла в память");
+        data = static_cast<const char*>(m);
+
+        catalog_format::Header h{};
+        std::memcpy(&h, data, catalog_format::HEADER_V1_BYTES);
+        if (std::memcmp(h.magic, catalog_format::MAGIC, 4) != 0 || h.version < 1 ||
+            h.version > catalog_format::VERSION) {
+            fail();
+        }
+        formatVersion = h.version;
+        const size_t headerSize = catalog_format::headerBytes(h.version);
+        if (length < headerSize) fail();
+        std::memcpy(&h, data, headerSize);
+
+        // Размеры проверяются по отдельности, чтобы сумма не переполнилась
+        const uint64_t avail = length - headerSize;
+        const size_t bookBytes = catalog_format::recordBytes(h.version);
+        if (h.count > avail / bookBytes || h.userCount > avail / catalog_format::USER_BYTES ||
+            h.loanCount > avail / sizeof(uint32_t) || h.heapSize > avail) {
+            fail();
+        }
+        const uint64_t userBytes = h.version >= 3 ? h.userCount * catalog_format::USER_BYTES + sizeof(uint32_t) : 0;
+        if (headerSize + h.count * bookBytes + userBytes + h.loanCount * sizeof(uint32_t) + h.heapSize != length) {
+            fail();
+        }
+
+        count = static_cast<size_t>(h.count);
+        users = static_cast<size_t>(h.userCount);
+        loans = static_cast<size_t>(h.loanCount);
+        heapSize = static_cast<size_t>(h.heapSize);
+        snapshotLsn = h.lsn;
+
+        refs = data + headerSize;
+        years = refs + 3 * count * sizeof(catalog_format::StringRef);
+        const char* next = years + count * sizeof(int32_t);
+        if (formatVersion >= 3) {
+            ids = next;
+            userIds = ids + count * sizeof(uint32_t);
+            userNames = userIds + users * sizeof(int32_t);
+            loanStart = userNames + users * sizeof(catalog_format::StringRef);
+            loanBooks = loanStart + (users + 1) * sizeof(uint32_t);
+            next = loanBooks + loans * sizeof(uint32_t);
+        }
+        kinds = reinterpret_cast<const uint8_t*>(next);
+        flags = kinds + count;
+        heap = reinterpret_cast<const char*>(flags + count);
+
+        // Всё проверяется один раз, дальше доступ без проверок
+        for (size_t k = 0; k < 3 * count; ++k) {
+            if (!validRef(refs, k)) fail();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (kinds[i] > static_cast<uint8_t>(BookKind::Fiction)) fail();
+        }
+        if (formatVersion >= 3) {
+            // id книг — перестановка 0..count-1
+            std::vector<uint8_t> seen(count, 0);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t id = load<uint32_t>(ids, i);
+                if (id >= count || seen[id]) fail();
+                seen[id] = 1;
+            }
+            // Каждая книга выдана не более одного раза и помечена выданной
+            std::fill(seen.begin(), seen.end(), 0);
+            std::vector<uint8_t> flagById(count);
+            for (size_t i = 0; i < count; ++i) flagById[load<uint32_t>(ids, i)] = flags[i];
+            for (size_t k = 0; k < loans; ++k) {
+                uint32_t id = load<uint32_t>(loanBooks, k);
+                if (id >= count || seen[id] || !flagById[id]) fail();
+                seen[id] = 1;
+            }
+            uint32_t prev = 0;
+            for (size_t u = 0; u <= users; ++u) {
+                uint32_t start = load<uint32_t>(loanStart, u);
+                if (start < prev || start > loans) fail();
+                prev = start;
+            }
+            if (prev != loans) fail();
+            for (size_t u = 0; u < users; ++u) {
+                if (!validRef(userNames, u)) fail();
+            }
+        }
+    }
+
+    ~CatalogView() {
+        if (data) ::munmap(const_cast<char*>(data), length);
+    }
+
+    CatalogView(const CatalogView&) = delete;
+    CatalogView& operator=(const CatalogView&) = delete;
+
+    // Проверка сигнатуры без отображения всего файла
+    static bool isCatalogFile(const std::string& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        char magic[4] = {};
+        in.read(magic, sizeof(magic));
+        return in && std::memcmp(magic, catalog_format::MAGIC, 4) == 0;
+    }
+
+    size_t size() const { return count; }
+    uint64_t lsn() const { return snapshotLsn; }
+    uint32_t version() const { return formatVersion; }
+
+    // Файлы до версии 3 не содержат пользователей и выдач
+    bool hasUsers() const { return formatVersion >= 3; }
+    size_t userCount() const { return users; }
+
+    BookRecordView operator[](size_t i) const {
+        uint32_t id = ids ? load<uint32_t>(ids, i) : static_cast<uint32_t>(i);
+        return { id, static_cast<BookKind>(kinds[i]), flags[i] != 0, load<int32_t>(years, i),
+                 string(refs, i), string(refs, count + i), string(refs, 2 * count + i) };
+    }
+
+    UserRecordView user(size_t u) const {
+        return { load<int32_t>(userIds, u), string(userNames, u),
+                 load<uint32_t>(loanStart, u), load<uint32_t>(loanStart, u + 1) };
+    }
+
+    // id книги k-й выдачи
+    uint32_t loan(size_t k) const { return load<uint32_t>(loanBooks, k); }
+};
+
+// Экранирование для старого текстового формата: ';' и '\' предваряются '\'
+inline std::string escapeField(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s) {
+        if (c == ';' || c == '\\') out.push_back('\\');
+        out.push_back(c);
+    }
+    return out;
+}
+
+// Разбор строки старого формата за один проход с учётом экранирования
+inline std::vector<std::string> splitEscaped(const std::string& s) {
+    std::vector<std::string> parts(1);
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 1 < s.size()) {
+            parts.back().push_back(s[++i]);
+        } else if (s[i] == ';') {
+            parts.emplace_back();
+        } else {
+            parts.back().push_back(s[i]);
+        }
+    }
+    return parts;
+}
+
 // --------------------- НАУЧНАЯ КНИГА ---------------------
 class ScienceBook : public Book {
     std::string field;
@@ -49,12 +360,16 @@ public:
 
     void print() const override {
         Book::print();
-        std::cout << "Область науки: " << field << std::endl;
+        std::cout << "Область науки: " << field << '\n';
     }
 
     std::string serialize() const override {
-        return "ScienceBook;" + title + ";" + author + ";" + std::to_string(year) + ";" + field + ";" + (borrowed() ? "1" : "0");
+        return "ScienceBook;" + escapeField(title) + ";" + escapeField(author) + ";" + std::to_string(year) + ";" +
+               escapeField(field) + ";" + (borrowed() ? "1" : "0");
     }
+
+    BookKind kind() const override { return BookKind::Science; }
+    const std::string& getDetail() const override { return field; }
 };
 
 // --------------------- ХУДОЖЕСТВЕННАЯ КНИГА ---------------------
@@ -67,206 +382,2598 @@ public:
 
     void print() const override {
         Book::print();
-        std::cout << "Жанр: " << genre << std::endl;
+        std::cout << "Жанр: " << genre << '\n';
     }
 
     std::string serialize() const override {
-        return "FictionBook;" + title + ";" + author + ";" + std::to_string(year) + ";" + genre + ";" + (borrowed() ? "1" : "0");
+        return "FictionBook;" + escapeField(title) + ";" + escapeField(author) + ";" + std::to_string(year) + ";" +
+               escapeField(genre) + ";" + (borrowed() ? "1" : "0");
     }
+
+    BookKind kind() const override { return BookKind::Fiction; }
+    const std::string& getDetail() const override { return genre; }
 };
 
-// --------------------- ПОЛЬЗОВАТЕЛЬ ---------------------
-class User {
-    std::string name;
-    int id;
-    std::vector<std::shared_ptr<Book>> borrowedBooks;
+// --------------------- ХРАНИЛИЩЕ КНИГ ---------------------
+// Книги каталога хранятся не отдельными объектами Book, а компактными
+// записями BookRecord в пуле кусков; автор и область/жанр интернируются,
+// названия лежат в общей арене строк. Книга адресуется 32-битным id,
+// классы Book/ScienceBook/FictionBook остаются фасадами для ввода.
+
+// Массив кусками по 2^CHUNK_BITS элементов: элементы не перемещаются при
+// росте, поэтому читатели могут обращаться к уже опубликованным элементам,
+// пока единственный писатель добавляет новые.
+template <typename T, size_t CHUNK_BITS = 12, size_t MAX_CHUNKS = 1 << 13>
+class ChunkedArray {
+    static constexpr size_t CHUNK = size_t(1) << CHUNK_BITS;
+
+    std::unique_ptr<std::unique_ptr<T[]>[]> chunks{ new std::unique_ptr<T[]>[MAX_CHUNKS] };
+    size_t count = 0;
 
 public:
-    User(std::string n, int i) : name(n), id(i) {}
+    size_t size() const { return count; }
 
-    void borrowBook(const std::shared_ptr<Book>& book) {
-        if (book->borrowed()) {
-            throw std::runtime_error("Книга уже взята!");
-        }
-        book->borrow();
-        borrowedBooks.push_back(book);
+    T& operator[](size_t i) { return chunks[i >> CHUNK_BITS][i & (CHUNK - 1)]; }
+    const T& operator[](size_t i) const { return chunks[i >> CHUNK_BITS][i & (CHUNK - 1)]; }
+
+    // Новый элемент в состоянии по умолчанию
+    T& grow() {
+        size_t chunk = count >> CHUNK_BITS;
+        if (chunk >= MAX_CHUNKS) throw std::runtime_error("Каталог слишком велик");
+        if (!chunks[chunk]) chunks[chunk].reset(new T[CHUNK]());
+        return (*this)[count++];
     }
 
-    void returnBook(const std::string& title) {
-        auto it = std::find_if(borrowedBooks.begin(), borrowedBooks.end(), [&](const std::shared_ptr<Book>& b) {
-            return b->getTitle() == title;
-        });
-        if (it != borrowedBooks.end()) {
-            (*it)->returnBook();
-            borrowedBooks.erase(it);
-        } else {
-            throw std::runtime_error("Пользователь не брал эту книгу!");
-        }
+    void clear() {
+        for (size_t c = 0; c < MAX_CHUNKS && chunks[c]; ++c) chunks[c].reset();
+        count = 0;
     }
+};
 
-    void printBorrowed() const {
-        std::cout << "Пользователь: " << name << ", ID: " << id << "\nВзятые книги:\n";
-        for (const auto& book : borrowedBooks) {
-            std::cout << "  - " << book->getTitle() << std::endl;
+// Арена символов: строки копируются в блоки по 64 КБ и не перемещаются
+class StringArena {
+    static constexpr size_t BLOCK = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = BLOCK;
+
+public:
+    std::string_view store(std::string_view s) {
+        if (s.size() > BLOCK / 4) {
+            // Длинная строка получает свой блок, текущий блок остаётся последним
+            std::unique_ptr<char[]> own(new char[s.size()]);
+            std::memcpy(own.get(), s.data(), s.size());
+            std::string_view view(own.get(), s.size());
+            blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1, std::move(own));
+            return view;
+        }
+        if (blocks.empty() || used + s.size() > BLOCK) {
+            blocks.emplace_back(new char[BLOCK]);
+            used = 0;
         }
+        char* dst = blocks.back().get() + used;
+        std::memcpy(dst, s.data(), s.size());
+        used += s.size();
+        return std::string_view(dst, s.size());
     }
 
-    const std::string& getName() const { return name; }
-    int getId() const { return id; }
+    void clear() {
+        blocks.clear();
+        used = BLOCK;
+    }
 };
 
-// --------------------- БИБЛИОТЕКА ---------------------
-class Library {
-    std::vector<std::shared_ptr<Book>> books;
-    std::map<int, std::shared_ptr<User>> users;
+// Таблица строк с 32-битными номерами; intern() возвращает один номер
+// для одинаковых строк, add() всегда добавляет новую
+class StringTable {
+    StringArena arena;
+    ChunkedArray<std::string_view> views;
+    std::unordered_map<std::string_view, uint32_t> interned;
 
 public:
-    void addBook(const std::shared_ptr<Book>& book) {
-        books.push_back(book);
+    uint32_t add(std::string_view s) {
+        views.grow() = arena.store(s);
+        return static_cast<uint32_t>(views.size() - 1);
     }
 
-    void addUser(const std::shared_ptr<User>& user) {
-        users[user->getId()] = user;
+    uint32_t intern(std::string_view s) {
+        auto it = interned.find(s);
+        if (it != interned.end()) return it->second;
+        uint32_t id = add(s);
+        interned.emplace(views[id], id);
+        return id;
     }
 
-    void showAllBooks() const {
-        for (const auto& book : books) {
-            book->print();
-            std::cout << "---------------------\n";
-        }
+    // Номер интернированной строки без добавления
+    bool find(std::string_view s, uint32_t& id) const {
+        auto it = interned.find(s);
+        if (it == interned.end()) return false;
+        id = it->second;
+        return true;
     }
 
-    void showAllUsers() const {
-        for (const auto& [id, user] : users) {
-            user->printBorrowed();
-            std::cout << "---------------------\n";
+    std::string_view operator[](uint32_t id) const { return views[id]; }
+    size_t size() const { return views.size(); }
+
+    void clear() {
+        interned.clear();
+        views.clear();
+        arena.clear();
+    }
+};
+
+// Запись книги: 24 байта вместо отдельного объекта с тремя строками,
+// vtable и блоком управления shared_ptr
+struct BookRecord {
+    uint32_t title;   // номер в BookStore::titles
+    uint32_t author;  // интернированный номер в BookStore::authors
+    uint32_t detail;  // интернированный номер в BookStore::details
+    int32_t year;
+    std::atomic<int32_t> holder; // id взявшего пользователя или BookStore::NO_HOLDER
+    BookKind kind;
+};
+
+// Пул записей книг; id книги — индекс её записи
+class BookStore {
+public:
+    // Книга свободна
+    static constexpr int32_t NO_HOLDER = INT32_MIN;
+    // Книга выдана, но кому — неизвестно: каталоги без пользователей (до версии 3)
+    static constexpr int32_t UNKNOWN_HOLDER = INT32_MIN + 1;
+
+private:
+    ChunkedArray<BookRecord> records;
+    StringTable titles;
+    StringTable authors;
+    StringTable details;
+
+public:
+    // Вызывается единственным писателем
+    uint32_t add(BookKind kind, std::string_view title, std::string_view author, int year, std::string_view detail) {
+        BookRecord& r = records.grow();
+        r.title = titles.add(title);
+        r.author = authors.intern(author);
+        r.detail = details.intern(detail);
+        r.year = year;
+        r.kind = kind;
+        r.holder.store(NO_HOLDER, std::memory_order_relaxed);
+        return static_cast<uint32_t>(records.size() - 1);
+    }
+
+    size_t size() const { return records.size(); }
+
+    BookRecord& operator[](uint32_t id) { return records[id]; }
+    const BookRecord& operator[](uint32_t id) const { return records[id]; }
+
+    std::string_view title(uint32_t id) const { return titles[records[id].title]; }
+    std::string_view author(uint32_t id) const { return authors[records[id].author]; }
+    std::string_view detail(uint32_t id) const { return details[records[id].detail]; }
+
+    // Номер автора для индекса по автору; false, если такого автора нет
+    bool findAuthor(std::string_view author, uint32_t& key) const { return authors.find(author, key); }
+    size_t authorCount() const { return authors.size(); }
+    std::string_view authorName(uint32_t key) const { return authors[key]; }
+
+    // Выдача без блокировок: из конкурирующих потоков успешен ровно один,
+    // его id пользователя становится держателем книги
+    bool tryBorrow(uint32_t id, int32_t holder) {
+        int32_t expected = NO_HOLDER;
+        return records[id].holder.compare_exchange_strong(expected, holder, std::memory_order_acq_rel);
+    }
+
+    void release(uint32_t id) { records[id].holder.store(NO_HOLDER, std::memory_order_release); }
+    bool borrowed(uint32_t id) const { return holder(id) != NO_HOLDER; }
+    int32_t holder(uint32_t id) const { return records[id].holder.load(std::memory_order_acquire); }
+
+    // Держатель выданной книги стал известен при загрузке выдач пользователей
+    void assignHolder(uint32_t id, int32_t holder) { records[id].holder.store(holder, std::memory_order_release); }
+
+    void clear() {
+        records.clear();
+        titles.clear();
+        authors.clear();
+        details.clear();
+    }
+};
+
+// Лёгкая ссылка на книгу в BookStore, возвращается запросами Library.
+// Действительна, пока каталог не перезагружен из файла.
+class BookView {
+    const BookStore* store = nullptr;
+    uint32_t id = 0;
+
+public:
+    BookView() = default;
+    BookView(const BookStore& s, uint32_t i) : store(&s), id(i) {}
+
+    explicit operator bool() const { return store != nullptr; }
+
+    uint32_t getId() const { return id; }
+    std::string_view getTitle() const { return store->title(id); }
+    std::string_view getAuthor() const { return store->author(id); }
+    std::string_view getDetail() const { return store->detail(id); }
+    int getYear() const { return (*store)[id].year; }
+    BookKind kind() const { return (*store)[id].kind; }
+    bool borrowed() const { return store->borrowed(id); }
+
+    // Тот же вывод, что у Book::print и его наследников, без виртуального вызова
+    void print() const {
+        std::cout << "Название: " << getTitle()
+                  << ", Автор: " << getAuthor()
+                  << ", Год: " << getYear()
+                  << ", Взята: " << (borrowed() ? "Да" : "Нет") << '\n'
+                  << (kind() == BookKind::Science ? "Область науки: " : "Жанр: ") << getDetail() << '\n';
+    }
+};
+
+// --------------------- ПОЛНОТЕКСТОВЫЙ ПОИСК ---------------------
+// Разбор UTF-8 на слова с приведением к нижнему регистру. Каталог на
+// русском, поэтому кроме ASCII сворачиваются кириллица и Latin-1;
+// ё приравнивается к е, знаки ударения пропускаются.
+namespace text {
+
+// Следующий код символа; некорректная последовательность даёт U+FFFD
+inline char32_t decodeUtf8(std::string_view s, size_t& pos) {
+    unsigned char c = static_cast<unsigned char>(s[pos++]);
+    if (c < 0x80) return c;
+    size_t extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (extra == 0 || c >= 0xF8 || pos + extra > s.size()) return 0xFFFD;
+    char32_t cp = c & (0x3F >> extra);
+    for (size_t k = 0; k < extra; ++k) {
+        unsigned char cc = static_cast<unsigned char>(s[pos]);
+        if ((cc & 0xC0) != 0x80) return 0xFFFD;
+        cp = (cp << 6) | (cc & 0x3F);
+        ++pos;
+    }
+    return cp;
+}
+
+inline void appendUtf8(std::string& out, char32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+inline char32_t foldCase(char32_t c) {
+    if (c >= 'A' && c <= 'Z') return c + 32;
+    if (c >= 0x0410 && c <= 0x042F) return c + 32;                    // А-Я
+    if (c == 0x0401 || c == 0x0451) return 0x0435;                     // Ё, ё -> е
+    if (c >= 0x0400 && c <= 0x040F) return c + 80;                     // Ѐ-Џ
+    if (c >= 0x00C0 && c <= 0x00DE && c != 0x00D7) return c + 32;      // À-Þ
+    return c;
+}
+
+// Диакритика внутри слова (в том числе ударение U+0301) не разрывает его
+inline bool isCombining(char32_t c) {
+    return c >= 0x0300 && c <= 0x036F;
+}
+
+// Буквы и цифры; всё выше Latin-1, кроме знаков пунктуации, считается буквой
+inline bool isWordChar(char32_t c) {
+    if (c < 0x80) return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    if (c < 0xC0 || c == 0x00D7 || c == 0x00F7 || c == 0xFFFD) return false;
+    if (c >= 0x2000 && c <= 0x206F) return false; // тире, кавычки, многоточие
+    if (c >= 0x3000 && c <= 0x303F) return false;
+    return true;
+}
+
+// Вызывает emit(const std::string&) для каждого слова строки в нижнем регистре
+template <typename Emit>
+void tokenize(std::string_view s, Emit&& emit) {
+    std::string token;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        char32_t c = decodeUtf8(s, pos);
+        if (isCombining(c)) continue;
+        if (isWordChar(c)) {
+            appendUtf8(token, foldCase(c));
+        } else if (!token.empty()) {
+            emit(token);
+            token.clear();
         }
     }
+    if (!token.empty()) emit(token);
+}
+
+// Сравнение строк без учёта регистра (и различия е/ё): <0, 0 или >0
+inline int collate(std::string_view a, std::string_view b) {
+    // Общее побайтовое начало сворачивается одинаково; сравнение начинается
+    // с символа, в котором строки расходятся
+    size_t i = 0, n = std::min(a.size(), b.size());
+    while (i < n && a[i] == b[i]) ++i;
+    auto continuation = [](std::string_view s, size_t k) {
+        return k < s.size() && (static_cast<unsigned char>(s[k]) & 0xC0) == 0x80;
+    };
+    while (i > 0 && (continuation(a, i) || continuation(b, i))) --i;
+    size_t j = i;
+    while (i < a.size() && j < b.size()) {
+        char32_t ca = foldCase(decodeUtf8(a, i));
+        char32_t cb = foldCase(decodeUtf8(b, j));
+        if (ca != cb) return ca < cb ? -1 : 1;
+    }
+    return (i < a.size()) - (j < b.size());
+}
 
-    std::shared_ptr<Book> findBook(const std::string& title) const {
-        for (const auto& book : books) {
-            if (book->getTitle() == title) return book;
+// Начало свёрнутой строки как 8-байтное число, порядок ключей согласован
+// с collate; равные ключи требуют полного сравнения. Символы кодируются с
+// сохранением порядка так, чтобы строчная кириллица занимала один байт:
+// ASCII как есть, U+0080..U+042F — 0x80 и два байта кода, U+0430..U+045F —
+// 0xC0 + смещение, остальные — 0xF0 и три байта кода.
+inline uint64_t collationPrefix(std::string_view s) {
+    uint64_t key = 0;
+    int bytes = 0;
+    auto put = [&](unsigned b) {
+        if (bytes < 8) {
+            key = (key << 8) | (b & 0xFF);
+            ++bytes;
+        }
+    };
+    size_t pos = 0;
+    while (pos < s.size() && bytes < 8) {
+        char32_t c = foldCase(decodeUtf8(s, pos));
+        if (c < 0x80) {
+            put(c);
+        } else if (c < 0x0430) {
+            put(0x80);
+            put(c >> 8);
+            put(c);
+        } else if (c < 0x0460) {
+            put(0xC0 + (c - 0x0430));
+        } else {
+            put(0xF0);
+            put(c >> 16);
+            put(c >> 8);
+            put(c);
         }
-        return nullptr;
     }
+    return key << (8 * (8 - bytes));
+}
+
+} // namespace text
+
+// Инвертированный индекс по словам названия, автора и жанра/области книги
+// и префиксное дерево словаря для автодополнения. Книги добавляются по
+// возрастанию id, поэтому списки вхождений упорядочены без сортировки.
+// Не синхронизирован: Library обращается к нему под catalogMutex.
+class SearchIndex {
+public:
+    enum Field : uint8_t { Title = 1, Author = 2, Detail = 4 };
+
+    struct Hit {
+        uint32_t book;
+        double score;
+    };
 
-    void borrowBook(int userId, const std::string& title) {
-        auto userIt = users.find(userId);
-        if (userIt == users.end()) throw std::runtime_error("Пользователь не найден!");
-        auto book = findBook(title);
-        if (!book) throw std::runtime_error("Книга не найдена!");
-        userIt->second->borrowBook(book);
+private:
+    static constexpr uint32_t NO_TERM = UINT32_MAX;
+    // Сколько самых частых слов подставляется вместо префикса в запросе
+    static constexpr size_t MAX_EXPANSIONS = 256;
+    // Вклад слова, найденного только по префиксу, относительно точного совпадения
+    static constexpr double PREFIX_WEIGHT = 0.8;
+
+    struct Posting {
+        uint32_t book;
+        uint8_t fields; // маска Field
+    };
+
+    // Узел дерева по байтам UTF-8; переходы отсортированы по байту
+    struct TrieNode {
+        std::vector<std::pair<char, uint32_t>> next;
+        uint32_t term = NO_TERM;
+    };
+
+    StringTable terms;
+    std::vector<std::vector<Posting>> postings; // по номеру слова
+    std::vector<TrieNode> trie{ TrieNode() };
+    uint32_t documents = 0;
+
+    static double fieldWeight(uint8_t fields) {
+        return ((fields & Title) ? 3.0 : 0.0) + ((fields & Author) ? 2.0 : 0.0) + ((fields & Detail) ? 1.0 : 0.0);
     }
 
-    void returnBook(int userId, const std::string& title) {
-        auto userIt = users.find(userId);
-        if (userIt == users.end()) throw std::runtime_error("Пользователь не найден!");
-        userIt->second->returnBook(title);
+    double idf(uint32_t term) const {
+        double df = static_cast<double>(postings[term].size());
+        return std::log(1.0 + (documents - df + 0.5) / (df + 0.5));
     }
 
-    void sortBooksByTitle() {
-        std::sort(books.begin(), books.end(), [](const std::shared_ptr<Book>& a, const std::shared_ptr<Book>& b) {
-            return a->getTitle() < b->getTitle();
-        });
+    uint32_t node(std::string_view word) const {
+        uint32_t n = 0;
+        for (char c : word) {
+            const auto& next = trie[n].next;
+            auto it = std::lower_bound(next.begin(), next.end(), c,
+                                       [](const std::pair<char, uint32_t>& e, char b) { return e.first < b; });
+            if (it == next.end() || it->first != c) return NO_TERM;
+            n = it->second;
+        }
+        return n;
     }
 
-    void saveToBinaryFile(const std::string& filename) {
-        std::ofstream out(filename, std::ios::binary);
-        if (!out) throw std::runtime_error("Ошибка при открытии файла для записи");
+    uint32_t termFor(std::string_view word) {
+        uint32_t id;
+        if (terms.find(word, id)) return id;
+        id = terms.intern(word);
+        postings.emplace_back();
 
-        size_t count = books.size();
-        out.write(reinterpret_cast<char*>(&count), sizeof(count));
+        uint32_t n = 0;
+        for (char c : word) {
+            auto& next = trie[n].next;
+            auto it = std::lower_bound(next.begin(), next.end(), c,
+                                       [](const std::pair<char, uint32_t>& e, char b) { return e.first < b; });
+            if (it == next.end() || it->first != c) {
+                uint32_t child = static_cast<uint32_t>(trie.size());
+                next.insert(it, { c, child });
+                trie.emplace_back(); // после вставки: emplace_back может перенести next
+                n = child;
+            } else {
+                n = it->second;
+            }
+        }
+        trie[n].term = id;
+        return id;
+    }
 
-        for (auto& book : books) {
-            std::string serialized = book->serialize();
-            size_t len = serialized.size();
-            out.write(reinterpret_cast<char*>(&len), sizeof(len));
-            out.write(serialized.c_str(), len);
+    // Слова словаря с данным префиксом, самые частые первыми
+    std::vector<uint32_t> expand(std::string_view prefix, size_t limit) const {
+        std::vector<uint32_t> found;
+        uint32_t root = node(prefix);
+        if (root == NO_TERM) return found;
+        std::vector<uint32_t> stack{ root };
+        while (!stack.empty()) {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            if (trie[n].term != NO_TERM) found.push_back(trie[n].term);
+            for (auto it = trie[n].next.rbegin(); it != trie[n].next.rend(); ++it) stack.push_back(it->second);
         }
+        // Обход в лексикографическом порядке, stable_sort сохраняет его среди равных
+        limit = std::min(limit, found.size());
+        std::stable_sort(found.begin(), found.end(), [&](uint32_t a, uint32_t b) {
+            return postings[a].size() > postings[b].size();
+        });
+        found.resize(limit);
+        return found;
+    }
 
-        out.close();
+    // Вклад одного слова запроса в оценку каждой книги, по возрастанию id
+    std::vector<Hit> termHits(const std::string& word, bool prefix) const {
+        std::vector<Hit> hits;
+        std::vector<uint32_t> ids;
+        if (prefix) {
+            ids = expand(word, MAX_EXPANSIONS);
+        } else {
+            uint32_t id;
+            if (terms.find(word, id)) ids.push_back(id);
+        }
+        for (uint32_t id : ids) {
+            double weight = idf(id) * (terms[id].size() == word.size() ? 1.0 : PREFIX_WEIGHT);
+            for (const Posting& p : postings[id]) hits.push_back({ p.book, weight * fieldWeight(p.fields) });
+        }
+        if (ids.size() > 1) {
+            // Несколько слов с одним префиксом в книге считаются одним лучшим
+            std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+                return a.book < b.book || (a.book == b.book && a.score > b.score);
+            });
+            hits.erase(std::unique(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) { return a.book == b.book; }),
+                       hits.end());
+        }
+        return hits;
     }
 
-    void loadFromBinaryFile(const std::string& filename) {
-        std::ifstream in(filename, std::ios::binary);
-        if (!in) throw std::runtime_error("Ошибка при открытии файла для чтения");
+public:
+    // Индексация книги; id должны поступать по возрастанию
+    void add(const BookStore& store, uint32_t id) {
+        if (id < documents) throw std::runtime_error("Книга уже проиндексирована");
+        std::vector<std::pair<uint32_t, uint8_t>> words;
+        auto collect = [&](std::string_view field, uint8_t mask) {
+            text::tokenize(field, [&](const std::string& token) {
+                uint32_t term = termFor(token);
+                auto it = std::find_if(words.begin(), words.end(),
+                                       [&](const std::pair<uint32_t, uint8_t>& w) { return w.first == term; });
+                if (it == words.end()) {
+                    words.emplace_back(term, mask);
+                } else {
+                    it->second |= mask;
+                }
+            });
+        };
+        collect(store.title(id), Title);
+        collect(store.author(id), Author);
+        collect(store.detail(id), Detail);
+        for (const auto& [term, mask] : words) postings[term].push_back({ id, mask });
+        documents = id + 1;
+    }
 
-        books.clear();
+    // Книги, содержащие все слова запроса, по убыванию оценки: сумма по словам
+    // idf слова, умноженного на вес поля (название 3, автор 2, жанр 1).
+    // Если prefixLast, последнее слово может быть началом слова.
+    std::vector<Hit> search(std::string_view query, size_t limit, bool prefixLast) const {
+        std::vector<std::string> words;
+        text::tokenize(query, [&](const std::string& token) { words.push_back(token); });
+        if (words.empty() || limit == 0) return {};
 
-        size_t count;
-        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        std::vector<std::vector<Hit>> lists;
+        for (size_t i = 0; i < words.size(); ++i) {
+            lists.push_back(termHits(words[i], prefixLast && i + 1 == words.size()));
+            if (lists.back().empty()) return {};
+        }
 
-        for (size_t i = 0; i < count; ++i) {
-            size_t len;
-            in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            std::string serialized(len, '\0');
-            in.read(&serialized[0], len);
-
-            std::vector<std::string> parts;
-            size_t pos = 0;
-            std::string temp = serialized;
-            while ((pos = temp.find(';')) != std::string::npos) {
-                parts.push_back(temp.substr(0, pos));
-                temp.erase(0, pos + 1);
-            }
-            parts.push_back(temp);
-
-            if (parts[0] == "ScienceBook" && parts.size() == 6) {
-                auto b = std::make_shared<ScienceBook>(parts[1], parts[2], std::stoi(parts[3]), parts[4]);
-                if (parts[5] == "1") b->borrow();
-                books.push_back(b);
-            } else if (parts[0] == "FictionBook" && parts.size() == 6) {
-                auto b = std::make_shared<FictionBook>(parts[1], parts[2], std::stoi(parts[3]), parts[4]);
-                if (parts[5] == "1") b->borrow();
-                books.push_back(b);
+        // Пересечение от самого короткого списка: остальные ищутся двоичным поиском
+        std::sort(lists.begin(), lists.end(),
+                  [](const std::vector<Hit>& a, const std::vector<Hit>& b) { return a.size() < b.size(); });
+        std::vector<Hit> result = std::move(lists[0]);
+        for (size_t l = 1; l < lists.size() && !result.empty(); ++l) {
+            auto from = lists[l].cbegin();
+            size_t kept = 0;
+            for (const Hit& h : result) {
+                from = std::lower_bound(from, lists[l].cend(), h.book,
+                                        [](const Hit& e, uint32_t b) { return e.book < b; });
+                if (from == lists[l].cend()) break;
+                if (from->book == h.book) result[kept++] = { h.book, h.score + from->score };
             }
+            result.resize(kept);
         }
 
-        in.close();
+        auto better = [](const Hit& a, const Hit& b) {
+            return a.score > b.score || (a.score == b.score && a.book < b.book);
+        };
+        limit = std::min(limit, result.size());
+        std::partial_sort(result.begin(), result.begin() + limit, result.end(), better);
+        result.resize(limit);
+        return result;
+    }
+
+    // Слова словаря, начинающиеся с последнего слова prefix, самые частые первыми
+    std::vector<std::string> complete(std::string_view prefix, size_t limit) const {
+        std::string last;
+        text::tokenize(prefix, [&](const std::string& token) { last = token; });
+        std::vector<std::string> result;
+        if (last.empty()) return result;
+        for (uint32_t id : expand(last, limit)) result.emplace_back(terms[id]);
+        return result;
+    }
+
+    size_t termCount() const { return terms.size(); }
+
+    void clear() {
+        terms.clear();
+        postings.clear();
+        trie.assign(1, TrieNode());
+        documents = 0;
     }
 };
 
-// --------------------- ГЛАВНАЯ ФУНКЦИЯ ---------------------
-int main() {
-    Library lib;
+// --------------------- УПОРЯДОЧЕННЫЕ ПРЕДСТАВЛЕНИЯ ---------------------
+// Каталог поддерживается отсортированным по названию, автору и году сразу
+// при добавлении книг; полная пересортировка нужна только после загрузки.
 
-    // Добавляем книги
-    lib.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
-    lib.addBook(std::make_shared<FictionBook>("Приключения в лесу", "Петров", 2015, "Приключения"));
-    lib.addBook(std::make_shared<ScienceBook>("Химия и жизнь", "Сидоров", 2012, "Химия"));
-    lib.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+enum class BookOrder {
+    Insertion, // порядок добавления или файла каталога
+    Title,     // название, затем id
+    Author,    // автор, название, id
+    Year       // год, название, id
+};
 
-    // Добавляем пользователей
-    lib.addUser(std::make_shared<User>("Алексей", 1));
-    lib.addUser(std::make_shared<User>("Мария", 2));
+// Сортировка кусками в нескольких потоках с попарным слиянием кусков
+template <typename T, typename Less>
+void parallelSort(std::vector<T>& items, Less less, unsigned threads) {
+    constexpr size_t MIN_CHUNK = 1 << 14;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, items.size() / MIN_CHUNK));
+    if (threads <= 1) {
+        std::sort(items.begin(), items.end(), less);
+        return;
+    }
 
-    std::cout << "Все книги:\n";
-    lib.showAllBooks();
+    std::vector<size_t> bounds(threads + 1);
+    for (unsigned t = 0; t <= threads; ++t) bounds[t] = items.size() * t / threads;
+    auto at = [&](size_t i) { return items.begin() + static_cast<std::ptrdiff_t>(i); };
 
-    // Пользователи берут книги
-    try {
-        lib.borrowBook(1, "Физика для всех");
-        lib.borrowBook(2, "Мир фантазий");
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t) {
+        workers.emplace_back([&, t] { std::sort(at(bounds[t]), at(bounds[t + 1]), less); });
     }
+    std::sort(at(bounds[0]), at(bounds[1]), less);
+    for (auto& w : workers) w.join();
 
-    std::cout << "\nСостояние пользователей после выдачи книг:\n";
-    lib.showAllUsers();
+    for (unsigned width = 1; width < threads; width *= 2) {
+        workers.clear();
+        for (unsigned t = 0; t + width < threads; t += 2 * width) {
+            size_t first = bounds[t], mid = bounds[t + width], last = bounds[std::min(t + 2 * width, threads)];
+            workers.emplace_back([&, first, mid, last] { std::inplace_merge(at(first), at(mid), at(last), less); });
+        }
+        for (auto& w : workers) w.join();
+    }
+}
 
-    // Сохраняем библиотеку в бинарный файл
-    try {
-        lib.saveToBinaryFile("library.dat");
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
+// Порядок книг для одного представления и его 8-байтный ключ сравнения:
+// различные ключи упорядочены так же, как книги, поэтому полное сравнение
+// строк нужно только при равных ключах. Равные без учёта регистра названия
+// упорядочиваются побайтно, затем по id.
+struct BookLess {
+    const BookStore* store;
+    const std::vector<uint64_t>* authorKeys; // по номеру интернированного автора
+    BookOrder order;
+
+    bool byTitle(uint32_t a, uint32_t b) const {
+        std::string_view ta = store->title(a), tb = store->title(b);
+        if (ta == tb) return a < b;
+        int c = text::collate(ta, tb);
+        return c != 0 ? c < 0 : ta < tb;
     }
 
-    // Загружаем из бинарного файла в новую библиотеку
-    Library lib2;
-    try {
-        lib2.loadFromBinaryFile("library.dat");
-        std::cout << "\nЗагруженная библиотека:\n";
-        lib2.showAllBooks();
+    bool operator()(uint32_t a, uint32_t b) const {
+        if (order == BookOrder::Title) return byTitle(a, b);
+        const BookRecord& ra = (*store)[a];
+        const BookRecord& rb = (*store)[b];
+        if (order == BookOrder::Author && ra.author != rb.author) {
+            uint64_t ka = (*authorKeys)[ra.author], kb = (*authorKeys)[rb.author];
+            if (ka != kb) return ka < kb;
+            std::string_view aa = store->author(a), ab = store->author(b);
+            int c = text::collate(aa, ab);
+            return c != 0 ? c < 0 : aa < ab;
+        }
+        if (order == BookOrder::Year && ra.year != rb.year) return ra.year < rb.year;
+        return byTitle(a, b);
+    }
+
+    uint64_t key(uint32_t id) const {
+        switch (order) {
+        case BookOrder::Author:
+            return (*authorKeys)[(*store)[id].author];
+        case BookOrder::Year: {
+            // 16 бит года и 6 байт названия; годы вне диапазона сравниваются полностью
+            int year = (*store)[id].year;
+            if (year < -32767) return 0;
+            if (year > 32766) return ~uint64_t(0);
+            return (uint64_t(year + 32768) << 48) | (text::collationPrefix(store->title(id)) >> 16);
+        }
+        default:
+            return text::collationPrefix(store->title(id));
+        }
+    }
+};
+
+// Упорядоченный список id блоками не длиннее BLOCK; рядом с id в блоке
+// лежат их ключи, так что сравнения почти не обращаются к записям книг.
+// Вставка находит блок по ключам последних элементов блоков и сдвигает
+// не больше BLOCK элементов, переполненный блок делится пополам:
+// O(log N) сравнений без пересортировки. Большая пачка сортируется
+// отдельно и сливается с представлением за один проход.
+class OrderedView {
+    static constexpr size_t BLOCK = 256;
+    static constexpr size_t FILL = BLOCK * 3 / 4; // заполнение блоков после сборки
+
+    struct Keyed {
+        uint64_t key;
+        uint32_t id;
+    };
+
+    struct Block {
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> ids;
+    };
+
+    BookLess less;
+    std::vector<Block> blocks;
+    std::vector<uint64_t> fences; // ключ последнего элемента каждого блока
+    size_t count = 0;
+
+    bool before(const Keyed& a, const Keyed& b) const {
+        return a.key != b.key ? a.key < b.key : less(a.id, b.id);
+    }
+
+    std::vector<Keyed> sortedByKey(const std::vector<uint32_t>& ids, unsigned threads) const {
+        std::vector<Keyed> keyed(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) keyed[i] = { less.key(ids[i]), ids[i] };
+        parallelSort(keyed, [this](const Keyed& a, const Keyed& b) { return before(a, b); }, threads);
+        return keyed;
+    }
+
+    void fill(const std::vector<Keyed>& sorted) {
+        blocks.clear();
+        fences.clear();
+        for (size_t i = 0; i < sorted.size(); i += FILL) {
+            size_t end = std::min(sorted.size(), i + FILL);
+            Block block;
+            block.keys.reserve(BLOCK + 1);
+            block.ids.reserve(BLOCK + 1);
+            for (size_t k = i; k < end; ++k) {
+                block.keys.push_back(sorted[k].key);
+                block.ids.push_back(sorted[k].id);
+            }
+            fences.push_back(block.keys.back());
+            blocks.push_back(std::move(block));
+        }
+        count = sorted.size();
+    }
+
+    // Позиция вставки в отсортированные keys/ids: после всех элементов меньше item
+    size_t position(const std::vector<uint64_t>& keys, const std::vector<uint32_t>& ids, const Keyed& item) const {
+        size_t lo = std::lower_bound(keys.begin(), keys.end(), item.key) - keys.begin();
+        size_t hi = std::upper_bound(keys.begin(), keys.end(), item.key) - keys.begin();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (less(item.id, ids[mid])) hi = mid; else lo = mid + 1;
+        }
+        return lo;
+    }
+
+public:
+    explicit OrderedView(BookLess l) : less(l) {}
+
+    size_t size() const { return count; }
+
+    void insert(uint32_t id) {
+        const Keyed item{ less.key(id), id };
+        ++count;
+        if (blocks.empty()) {
+            blocks.push_back({ { item.key }, { id } });
+            fences.push_back(item.key);
+            return;
+        }
+        // Первый блок, последний элемент которого больше id; иначе последний блок
+        size_t lo = std::lower_bound(fences.begin(), fences.end(), item.key) - fences.begin();
+        size_t hi = std::upper_bound(fences.begin(), fences.end(), item.key) - fences.begin();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (less(id, blocks[mid].ids.back())) hi = mid; else lo = mid + 1;
+        }
+        const size_t b = std::min(lo, blocks.size() - 1);
+
+        Block& block = blocks[b];
+        const auto at = static_cast<std::ptrdiff_t>(position(block.keys, block.ids, item));
+        block.keys.insert(block.keys.begin() + at, item.key);
+        block.ids.insert(block.ids.begin() + at, id);
+        fences[b] = block.keys.back();
+        if (block.ids.size() > BLOCK) {
+            const auto half = static_cast<std::ptrdiff_t>(BLOCK / 2);
+            Block upper{ { block.keys.begin() + half, block.keys.end() }, { block.ids.begin() + half, block.ids.end() } };
+            block.keys.resize(BLOCK / 2);
+            block.ids.resize(BLOCK / 2);
+            fences[b] = block.keys.back();
+            fences.insert(fences.begin() + static_cast<std::ptrdiff_t>(b) + 1, upper.keys.back());
+            blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(b) + 1, std::move(upper));
+        }
+    }
+
+    // Пачка новых книг: небольшая вставляется по одной, большая
+    // сортируется по ключам и сливается с представлением за O(N + k log k)
+    void insertBatch(const std::vector<uint32_t>& ids, unsigned threads) {
+        if (ids.size() * 16 < count) {
+            for (uint32_t id : ids) insert(id);
+            return;
+        }
+        std::vector<Keyed> added = sortedByKey(ids, threads);
+        std::vector<Keyed> merged;
+        merged.reserve(count + added.size());
+        auto next = added.begin();
+        for (const Block& block : blocks) {
+            for (size_t i = 0; i < block.ids.size(); ++i) {
+                const Keyed current{ block.keys[i], block.ids[i] };
+                while (next != added.end() && before(*next, current)) merged.push_back(*next++);
+                merged.push_back(current);
+            }
+        }
+        merged.insert(merged.end(), next, added.end());
+        fill(merged);
+    }
+
+    // Полная сортировка по ключам
+    void assign(const std::vector<uint32_t>& ids, unsigned threads) {
+        fill(sortedByKey(ids, threads));
+    }
+
+    // f(id) для книг с позициями [offset, offset + limit) в порядке представления
+    template <typename F>
+    void forEach(size_t offset, size_t limit, F&& f) const {
+        size_t b = 0;
+        while (b < blocks.size() && offset >= blocks[b].ids.size()) offset -= blocks[b++].ids.size();
+        for (; b < blocks.size() && limit > 0; ++b, offset = 0) {
+            const auto& ids = blocks[b].ids;
+            for (size_t i = offset; i < ids.size() && limit > 0; ++i, --limit) f(ids[i]);
+        }
+    }
+
+    void clear() {
+        blocks.clear();
+        fences.clear();
+        count = 0;
+    }
+};
+
+// Три поддерживаемых представления каталога и ключи авторов.
+// Не синхронизированы: Library обращается к ним под catalogMutex.
+class CatalogOrder {
+    const BookStore& store;
+    std::vector<uint64_t> authorKeys;
+    OrderedView byTitle;
+    OrderedView byAuthor;
+    OrderedView byYear;
+
+    BookLess lessFor(BookOrder order) const { return BookLess{ &store, &authorKeys, order }; }
+
+    void cacheAuthorKeys() {
+        while (authorKeys.size() < store.authorCount()) {
+            authorKeys.push_back(text::collationPrefix(store.authorName(static_cast<uint32_t>(authorKeys.size()))));
+        }
+    }
+
+public:
+    explicit CatalogOrder(const BookStore& s)
+        : store(s), byTitle(lessFor(BookOrder::Title)), byAuthor(lessFor(BookOrder::Author)),
+          byYear(lessFor(BookOrder::Year)) {}
+
+    CatalogOrder(const CatalogOrder&) = delete;
+    CatalogOrder& operator=(const CatalogOrder&) = delete;
+
+    void add(uint32_t id) {
+        cacheAuthorKeys();
+        byTitle.insert(id);
+        byAuthor.insert(id);
+        byYear.insert(id);
+    }
+
+    void addBatch(const std::vector<uint32_t>& ids, unsigned threads) {
+        cacheAuthorKeys();
+        byTitle.insertBatch(ids, threads);
+        byAuthor.insertBatch(ids, threads);
+        byYear.insertBatch(ids, threads);
+    }
+
+    // Все книги хранилища заново, сортировка в threads потоков
+    void rebuild(unsigned threads) {
+        authorKeys.clear();
+        cacheAuthorKeys();
+        std::vector<uint32_t> ids(store.size());
+        for (uint32_t id = 0; id < ids.size(); ++id) ids[id] = id;
+        byTitle.assign(ids, threads);
+        byAuthor.assign(ids, threads);
+        byYear.assign(ids, threads);
+    }
+
+    // Для BookOrder::Insertion представления нет
+    const OrderedView& view(BookOrder order) const {
+        switch (order) {
+        case BookOrder::Title: return byTitle;
+        case BookOrder::Author: return byAuthor;
+        case BookOrder::Year: return byYear;
+        default: throw std::runtime_error("Нет упорядоченного представления");
+        }
+    }
+};
+
+// --------------------- ПОЛЬЗОВАТЕЛЬ ---------------------
+// Пользователь хранит id взятых книг; держателя книги в BookStore меняет
+// Library. Список не синхронизирован: Library обращается к нему под
+// блокировкой полосы, в которую попадает id пользователя.
+// Выдачи лежат в плотном массиве с индексом по id книги: возврат
+// переносит последнюю выдачу на место удалённой, поэтому порядок
+// выдач после возврата не сохраняется.
+class User {
+    std::string name;
+    int id;
+    std::vector<uint32_t> borrowedBooks;
+    std::unordered_map<uint32_t, uint32_t> loanSlots; // id книги -> позиция в borrowedBooks
+
+public:
+    User(std::string n, int i) : name(n), id(i) {}
+
+    // Книга уже захвачена через BookStore::tryBorrow
+    void borrowBook(uint32_t bookId) {
+        if (!loanSlots.emplace(bookId, static_cast<uint32_t>(borrowedBooks.size())).second) {
+            throw std::runtime_error("Книга уже взята!");
+        }
+        borrowedBooks.push_back(bookId);
+    }
+
+    bool holds(uint32_t bookId) const {
+        return loanSlots.count(bookId) != 0;
+    }
+
+    void returnBook(uint32_t bookId) {
+        auto it = loanSlots.find(bookId);
+        if (it == loanSlots.end()) throw std::runtime_error("Пользователь не брал эту книгу!");
+        uint32_t slot = it->second;
+        loanSlots.erase(it);
+        if (slot + 1 != borrowedBooks.size()) {
+            borrowedBooks[slot] = borrowedBooks.back();
+            loanSlots[borrowedBooks[slot]] = slot;
+        }
+        borrowedBooks.pop_back();
+    }
+
+    void printBorrowed(const BookStore& store) const {
+        std::cout << "Пользователь: " << name << ", ID: " << id << "\nВзятые книги:\n";
+        for (uint32_t book : borrowedBooks) {
+            std::cout << "  - " << store.title(book) << '\n';
+        }
+    }
+
+    void clearLoans() {
+        borrowedBooks.clear();
+        loanSlots.clear();
+    }
+
+    const std::string& getName() const { return name; }
+    int getId() const { return id; }
+    const std::vector<uint32_t>& getBorrowed() const { return borrowedBooks; }
+};
+
+// --------------------- ЖУРНАЛ ОПЕРАЦИЙ ---------------------
+// Журнал упреждающей записи: каждая изменяющая операция Library дописывается
+// в конец файла короткой двоичной записью. Фоновый поток собирает записи
+// в группы и сбрасывает каждую группу одним write + fdatasync.
+namespace journal {
+
+constexpr char MAGIC[4] = { 'L', 'B', 'W', 'L' };
+// Версия 2: выдача и возврат ссылаются на id книги, в версии 1 — на название
+constexpr uint32_t VERSION = 2;
+
+// Заголовок файла: записи следуют за снимком каталога с LSN = baseLsn
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t baseLsn;
+};
+
+enum class Op : uint8_t {
+    AddBook = 1,
+    AddUser = 2,
+    Borrow = 3,
+    Return = 4
+};
+
+// Запись: [u32 длина данных][u32 контрольная сумма][u64 LSN][u8 операция][данные]
+constexpr size_t ENTRY_HEADER_BYTES = 17;
+constexpr uint32_t MAX_PAYLOAD = 1u << 24;
+
+// FNV-1a по LSN, операции и данным — отсекает оборванную при сбое запись
+inline uint32_t checksum(const char* data, size_t size, uint32_t h = 2166136261u) {
+    for (size_t i = 0; i < size; ++i) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+class Encoder {
+    std::string buf;
+
+public:
+    Encoder& u8(uint8_t v) {
+        buf.push_back(static_cast<char>(v));
+        return *this;
+    }
+    Encoder& i32(int32_t v) {
+        buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        return *this;
+    }
+    Encoder& u32(uint32_t v) {
+        buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        return *this;
+    }
+    Encoder& str(std::string_view s) {
+        uint32_t n = static_cast<uint32_t>(s.size());
+        buf.append(reinterpret_cast<const char*>(&n), sizeof(n));
+        buf.append(s);
+        return *this;
+    }
+    const std::string& bytes() const { return buf; }
+};
+
+class Decoder {
+    const char* p;
+    const char* end;
+
+    void need(size_t n) const {
+        if (static_cast<size_t>(end - p) < n) throw std::runtime_error("Запись журнала повреждена");
+    }
+
+public:
+    Decoder(const char* data, size_t size) : p(data), end(data + size) {}
+
+    uint8_t u8() {
+        need(1);
+        return static_cast<uint8_t>(*p++);
+    }
+    int32_t i32() {
+        need(sizeof(int32_t));
+        int32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+    uint32_t u32() {
+        need(sizeof(uint32_t));
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+    std::string str() {
+        need(sizeof(uint32_t));
+        uint32_t n;
+        std::memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        need(n);
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+};
+
+inline void appendEntry(std::string& out, uint64_t lsn, Op op, const std::string& payload) {
+    if (payload.size() > MAX_PAYLOAD) throw std::runtime_error("Запись журнала слишком велика");
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    char head[ENTRY_HEADER_BYTES];
+    std::memcpy(head, &size, 4);
+    std::memcpy(head + 8, &lsn, 8);
+    head[16] = static_cast<char>(op);
+    uint32_t sum = checksum(payload.data(), payload.size(), checksum(head + 8, 9));
+    std::memcpy(head + 4, &sum, 4);
+    out.append(head, sizeof(head));
+    out.append(payload);
+}
+
+// Разбор записей data[from..]; fn(lsn, op, decoder) вызывается для каждой целой записи.
+// Возвращает смещение конца последней целой записи.
+template <typename Fn>
+size_t scan(const std::string& data, size_t from, Fn fn) {
+    size_t pos = from;
+    while (data.size() - pos >= ENTRY_HEADER_BYTES) {
+        const char* head = data.data() + pos;
+        uint32_t size, sum;
+        uint64_t lsn;
+        std::memcpy(&size, head, 4);
+        std::memcpy(&sum, head + 4, 4);
+        std::memcpy(&lsn, head + 8, 8);
+        if (size > MAX_PAYLOAD || data.size() - pos - ENTRY_HEADER_BYTES < size) break;
+        const char* payload = head + ENTRY_HEADER_BYTES;
+        if (checksum(payload, size, checksum(head + 8, 9)) != sum) break;
+
+        Decoder in(payload, size);
+        fn(lsn, static_cast<Op>(head[16]), in);
+        pos += ENTRY_HEADER_BYTES + size;
+    }
+    return pos;
+}
+
+} // namespace journal
+
+// Запись целиком с повтором после EINTR и частичной записи
+inline void writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка записи файла");
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        PROFILE_COUNT("bytes_written", n);
+    }
+}
+
+// fsync каталога, чтобы переименование файла пережило сбой питания
+inline void syncParentDirectory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+struct JournalOptions {
+    // true — операция возвращается только после fsync своей группы;
+    // false — группа сбрасывается не позже чем через groupWindow
+    bool syncCommit = true;
+    std::chrono::microseconds groupWindow{ 2000 };
+    size_t maxBatchBytes = 1 << 20;
+};
+
+// Групповая запись журнала. append() только кладёт запись в буфер;
+// фоновый поток пишет накопившееся одним вызовом и делает один fdatasync
+// на всю группу, ожидающие waitDurable() просыпаются вместе.
+class JournalWriter {
+    std::string path;
+    JournalOptions options;
+    int fd = -1;
+    uint64_t fileSize = 0; // под ioMutex
+
+    std::mutex mutex;                 // буфер и счётчики
+    std::mutex ioMutex;               // дескриптор файла; берётся после mutex
+    std::condition_variable wake;     // писателю: есть работа
+    std::condition_variable durable;  // ожидающим: группа на диске
+    std::string pending;
+    uint64_t lastLsn;
+    uint64_t durableLsn;
+    size_t waiters = 0;
+    bool stopping = false;
+    bool failed = false;
+    std::thread worker;
+
+    static int openForAppend(const std::string& path, uint64_t baseLsn, uint64_t& size) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии журнала");
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Ошибка при открытии журнала");
+        }
+        size = static_cast<uint64_t>(st.st_size);
+        if (size == 0) {
+            journal::FileHeader h{};
+            std::memcpy(h.magic, journal::MAGIC, 4);
+            h.version = journal::VERSION;
+            h.baseLsn = baseLsn;
+            writeAll(fd, reinterpret_cast<const char*>(&h), sizeof(h));
+            ::fdatasync(fd);
+            size = sizeof(h);
+        }
+        return fd;
+    }
+
+    // Запись группы; вызывается под ioMutex
+    bool writeBatch(const std::string& batch) {
+        try {
+            writeAll(fd, batch.data(), batch.size());
+        } catch (const std::exception&) {
+            return false;
+        }
+        return ::fdatasync(fd) == 0;
+    }
+
+    // Синхронный сброс буфера; вызывается под mutex и ioMutex
+    void flushLocked() {
+        if (failed) throw std::runtime_error("Журнал недоступен после ошибки записи");
+        if (pending.empty()) return;
+        if (!writeBatch(pending)) {
+            failed = true;
+            durable.notify_all();
+            throw std::runtime_error("Ошибка записи журнала");
+        }
+        fileSize += pending.size();
+        pending.clear();
+        durableLsn = lastLsn;
+        durable.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty()) break;
+
+            // Окно группировки: пока никто не ждёт fsync, даём набежать записям
+            if (waiters == 0 && !stopping && pending.size() < options.maxBatchBytes) {
+                wake.wait_for(lock, options.groupWindow, [&] {
+                    return stopping || waiters > 0 || pending.size() >= options.maxBatchBytes;
+                });
+            }
+            if (pending.empty()) continue;
+
+            std::string batch;
+            batch.swap(pending);
+            uint64_t batchLsn = lastLsn;
+            std::unique_lock<std::mutex> io(ioMutex);
+            lock.unlock();
+            bool ok = writeBatch(batch);
+            if (ok) fileSize += batch.size();
+            io.unlock();
+            lock.lock();
+
+            if (ok) {
+                durableLsn = std::max(durableLsn, batchLsn);
+            } else {
+                failed = true;
+            }
+            durable.notify_all();
+        }
+    }
+
+public:
+    // lastLsn — номер последней записи, уже находящейся в файле
+    JournalWriter(const std::string& p, uint64_t baseLsn, uint64_t last, const JournalOptions& opt = {})
+        : path(p), options(opt), lastLsn(last), durableLsn(last) {
+        fd = openForAppend(path, baseLsn, fileSize);
+        worker = std::thread(&JournalWriter::run, this);
+    }
+
+    ~JournalWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        ::close(fd);
+    }
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    const JournalOptions& getOptions() const { return options; }
+
+    uint64_t append(journal::Op op, const std::string& payload) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) throw std::runtime_error("Журнал недоступен после ошибки записи");
+        bool first = pending.empty();
+        journal::appendEntry(pending, ++lastLsn, op, payload);
+        if (first || pending.size() >= options.maxBatchBytes) wake.notify_one();
+        return lastLsn;
+    }
+
+    // Ожидание, пока запись lsn и все предыдущие не окажутся на диске
+    void waitDurable(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++waiters;
+        wake.notify_one();
+        durable.wait(lock, [&] { return failed || durableLsn >= lsn; });
+        --waiters;
+        if (durableLsn < lsn) throw std::runtime_error("Ошибка записи журнала");
+    }
+
+    void flush() {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            lsn = lastLsn;
+        }
+        waitDurable(lsn);
+    }
+
+    // Точка отсечения для уплотнения: последний LSN и размер файла после него
+    struct Mark {
+        uint64_t lsn;
+        uint64_t offset;
+    };
+
+    Mark mark() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::lock_guard<std::mutex> io(ioMutex);
+        flushLocked();
+        return { lastLsn, fileSize };
+    }
+
+    // Замена файла журнала: заголовок с baseLsn и хвост старого файла после
+    // отметки. Запись и fsync нового файла идут до переименования, так что
+    // при сбое остаётся один из двух целых журналов. Новые append() ждут
+    // только копирования хвоста.
+    void rewrite(uint64_t baseLsn, uint64_t tailOffset) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::lock_guard<std::mutex> io(ioMutex);
+        flushLocked();
+
+        std::string tail(fileSize - tailOffset, '\0');
+        for (size_t done = 0; done < tail.size();) {
+            ssize_t n = ::pread(fd, &tail[done], tail.size() - done, static_cast<off_t>(tailOffset + done));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                throw std::runtime_error("Ошибка чтения журнала");
+            }
+            done += static_cast<size_t>(n);
+        }
+
+        const std::string tmp = path + ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) throw std::runtime_error("Ошибка при открытии журнала");
+        journal::FileHeader h{};
+        std::memcpy(h.magic, journal::MAGIC, 4);
+        h.version = journal::VERSION;
+        h.baseLsn = baseLsn;
+        try {
+            writeAll(out, reinterpret_cast<const char*>(&h), sizeof(h));
+            writeAll(out, tail.data(), tail.size());
+        } catch (...) {
+            ::close(out);
+            ::unlink(tmp.c_str());
+            throw;
+        }
+        if (::fdatasync(out) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0) {
+            ::close(out);
+            ::unlink(tmp.c_str());
+            throw std::runtime_error("Ошибка замены журнала");
+        }
+        ::close(out);
+        syncParentDirectory(path);
+
+        ::close(fd);
+        fd = openForAppend(path, baseLsn, fileSize);
+    }
+};
+
+// --------------------- ОТЧЁТЫ ---------------------
+// Выгрузка каталога и пользователей: строки форматируются в повторно
+// используемый буфер и отдаются приёмнику кусками, без сброса потока
+// на каждой строке.
+
+enum class ReportFormat {
+    Text,     // как showAllBooks/showAllUsers
+    Csv,      // RFC 4180, первая строка — заголовок
+    JsonLines // один объект JSON на строку
+};
+
+// Приёмник готовых кусков отчёта
+using ReportSink = std::function<void(std::string_view)>;
+
+inline ReportSink streamSink(std::ostream& out) {
+    return [&out](std::string_view chunk) {
+        out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        if (!out) throw std::runtime_error("Ошибка записи отчёта");
+    };
+}
+
+inline ReportSink fileSink(int fd) {
+    return [fd](std::string_view chunk) { writeAll(fd, chunk.data(), chunk.size()); };
+}
+
+// Буфер отчёта: копит текст и отдаёт его приёмнику кусками по CHUNK байт.
+// Память буфера переиспользуется, числа форматируются без аллокаций.
+class ReportWriter {
+public:
+    static constexpr size_t CHUNK = 256 * 1024;
+
+private:
+    const ReportSink* sink;
+    std::string buffer;
+
+public:
+    explicit ReportWriter(const ReportSink* s = nullptr) : sink(s) {
+        buffer.reserve(CHUNK + CHUNK / 4);
+    }
+
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    ~ReportWriter() {
+        // Ошибка приёмника при разрушении теряется: вызывайте flush() явно
+        try { flush(); } catch (...) {}
+    }
+
+    ReportWriter& text(std::string_view s) {
+        buffer.append(s.data(), s.size());
+        return *this;
+    }
+
+    ReportWriter& ch(char c) {
+        buffer += c;
+        return *this;
+    }
+
+    ReportWriter& num(long long v) {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), v);
+        buffer.append(digits, res.ptr);
+        return *this;
+    }
+
+    // Поле CSV: в кавычках, только если содержит разделитель, кавычку или перевод строки
+    ReportWriter& csv(std::string_view s) {
+        if (s.find_first_of(",\"\r\n") == std::string_view::npos) return text(s);
+        buffer += '"';
+        for (char c : s) {
+            if (c == '"') buffer += '"';
+            buffer += c;
+        }
+        buffer += '"';
+        return *this;
+    }
+
+    // Строка JSON в кавычках; UTF-8 передаётся как есть
+    ReportWriter& json(std::string_view s) {
+        static const char HEX[] = "0123456789abcdef";
+        buffer += '"';
+        size_t plain = 0; // начало ещё не скопированного участка без экранирования
+        for (size_t i = 0; i < s.size(); ++i) {
+            char c = s[i];
+            unsigned char u = static_cast<unsigned char>(c);
+            if (u >= 0x20 && c != '"' && c != '\\') continue;
+            buffer.append(s.data() + plain, i - plain);
+            plain = i + 1;
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += c;
+            } else if (c == '\n') {
+                buffer.append("\\n");
+            } else if (c == '\t') {
+                buffer.append("\\t");
+            } else {
+                buffer.append("\\u00");
+                buffer += HEX[u >> 4];
+                buffer += HEX[u & 0xF];
+            }
+        }
+        buffer.append(s.data() + plain, s.size() - plain);
+        buffer += '"';
+        return *this;
+    }
+
+    // Конец записи: накопленный кусок уходит приёмнику, если он достаточно велик
+    void endRecord() {
+        if (sink && buffer.size() >= CHUNK) flush();
+    }
+
+    void flush() {
+        if (sink && !buffer.empty()) (*sink)(buffer);
+        buffer.clear();
+    }
+
+    std::string_view view() const { return buffer; }
+    void clear() { buffer.clear(); }
+};
+
+namespace report {
+
+inline const char* kindName(BookKind kind) {
+    return kind == BookKind::Science ? "science" : "fiction";
+}
+
+inline void booksHeader(ReportWriter& out, ReportFormat format) {
+    if (format == ReportFormat::Csv) out.text("id,kind,title,author,year,detail,borrowed,holder\n");
+}
+
+inline void usersHeader(ReportWriter& out, ReportFormat format) {
+    if (format == ReportFormat::Csv) out.text("id,name,loans,books\n");
+}
+
+inline void book(ReportWriter& out, const BookStore& store, uint32_t id, ReportFormat format) {
+    const BookRecord& r = store[id];
+    const int32_t holder = store.holder(id);
+    const bool borrowed = holder != BookStore::NO_HOLDER;
+    const bool knownHolder = borrowed && holder != BookStore::UNKNOWN_HOLDER;
+
+    switch (format) {
+    case ReportFormat::Text:
+        out.text("Название: ").text(store.title(id))
+           .text(", Автор: ").text(store.author(id))
+           .text(", Год: ").num(r.year)
+           .text(", Взята: ").text(borrowed ? "Да" : "Нет")
+           .text(r.kind == BookKind::Science ? "\nОбласть науки: " : "\nЖанр: ").text(store.detail(id))
+           .text("\n---------------------\n");
+        break;
+    case ReportFormat::Csv:
+        out.num(id).ch(',').text(kindName(r.kind)).ch(',')
+           .csv(store.title(id)).ch(',').csv(store.author(id)).ch(',')
+           .num(r.year).ch(',').csv(store.detail(id)).ch(',')
+           .ch(borrowed ? '1' : '0').ch(',');
+        if (knownHolder) out.num(holder);
+        out.ch('\n');
+        break;
+    case ReportFormat::JsonLines:
+        out.text("{\"id\":").num(id)
+           .text(",\"kind\":\"").text(kindName(r.kind))
+           .text("\",\"title\":").json(store.title(id))
+           .text(",\"author\":").json(store.author(id))
+           .text(",\"year\":").num(r.year)
+           .text(",\"detail\":").json(store.detail(id))
+           .text(",\"borrowed\":").text(borrowed ? "true" : "false")
+           .text(",\"holder\":");
+        if (knownHolder) {
+            out.num(holder);
+        } else {
+            out.text("null");
+        }
+        out.text("}\n");
+        break;
+    }
+    out.endRecord();
+}
+
+inline void user(ReportWriter& out, const BookStore& store, int id, std::string_view name,
+                 const std::vector<uint32_t>& loans, ReportFormat format) {
+    switch (format) {
+    case ReportFormat::Text:
+        out.text("Пользователь: ").text(name).text(", ID: ").num(id).text("\nВзятые книги:\n");
+        for (uint32_t loan : loans) out.text("  - ").text(store.title(loan)).ch('\n');
+        out.text("---------------------\n");
+        break;
+    case ReportFormat::Csv:
+        // id книг через ';' в одном поле
+        out.num(id).ch(',').csv(name).ch(',').num(static_cast<long long>(loans.size())).ch(',');
+        for (size_t i = 0; i < loans.size(); ++i) {
+            if (i) out.ch(';');
+            out.num(loans[i]);
+        }
+        out.ch('\n');
+        break;
+    case ReportFormat::JsonLines:
+        out.text("{\"id\":").num(id).text(",\"name\":").json(name).text(",\"books\":[");
+        for (size_t i = 0; i < loans.size(); ++i) {
+            if (i) out.ch(',');
+            out.num(loans[i]);
+        }
+        out.text("]}\n");
+        break;
+    }
+    out.endRecord();
+}
+
+} // namespace report
+
+// --------------------- БИБЛИОТЕКА ---------------------
+class Library {
+    static constexpr size_t TITLE_SHARDS = 64;
+    static constexpr size_t USER_STRIPES = 64;
+    static constexpr size_t EXPORT_BLOCK = 16384; // книг в блоке параллельной выгрузки
+
+    // Шард индекса по названию: читатели разных шардов не мешают друг другу.
+    // Ключи указывают на названия в арене BookStore.
+    struct alignas(64) TitleShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string_view, uint32_t> books;
+    };
+
+    // Полоса таблицы пользователей: операции одного пользователя
+    // сериализуются её мьютексом, разные полосы работают параллельно
+    struct alignas(64) UserStripe {
+        mutable std::mutex mutex;
+        std::unordered_map<int, std::shared_ptr<User>> users;
+    };
+
+    // Порядок захвата блокировок: catalogMutex -> шард названий -> полоса пользователей.
+    // Держатель книги меняется атомарно (BookStore::tryBorrow) без блокировок каталога
+    // и служит обратным индексом "книга -> пользователь".
+    // Записи и строки BookStore не перемещаются, поэтому BookView читает их без блокировок.
+    mutable std::shared_mutex catalogMutex; // store, books, индексы, orderedViews, displayOrder
+    BookStore store;
+    std::vector<uint32_t> books; // порядок добавления или загруженного файла
+    CatalogOrder orderedViews{ store };
+    BookOrder displayOrder = BookOrder::Insertion; // порядок showAllBooks и exportBooks
+    bool deferOrder = false; // воспроизведение журнала: представления дополняются в конце
+
+    // Индексы каталога. По названию хранится первая добавленная книга,
+    // как и при линейном поиске; по автору и году — все книги в порядке добавления.
+    TitleShard titleShards[TITLE_SHARDS];
+    std::vector<std::vector<uint32_t>> authorIndex; // по номеру интернированного автора
+    std::map<int, std::vector<uint32_t>> yearIndex;
+    SearchIndex search; // слова названия, автора и жанра/области
+
+    UserStripe userStripes[USER_STRIPES];
+
+    // Журнал операций и фоновое уплотнение (см. openJournal)
+    std::unique_ptr<JournalWriter> journalWriter;
+    std::string snapshotPath;
+    std::mutex compactionMutex;
+    std::thread compaction;
+    std::exception_ptr compactionError;
+
+    TitleShard& titleShard(std::string_view title) {
+        return titleShards[std::hash<std::string_view>{}(title) % TITLE_SHARDS];
+    }
+    const TitleShard& titleShard(std::string_view title) const {
+        return titleShards[std::hash<std::string_view>{}(title) % TITLE_SHARDS];
+    }
+
+    UserStripe& userStripe(int id) {
+        return userStripes[static_cast<unsigned>(id) % USER_STRIPES];
+    }
+    const UserStripe& userStripe(int id) const {
+        return userStripes[static_cast<unsigned>(id) % USER_STRIPES];
+    }
+
+    // Вызывается под исключительной блокировкой catalogMutex
+    void indexBook(uint32_t id) {
+        {
+            std::string_view title = store.title(id);
+            TitleShard& shard = titleShard(title);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.books.emplace(title, id);
+        }
+        uint32_t author = store[id].author;
+        if (author >= authorIndex.size()) authorIndex.resize(author + 1);
+        authorIndex[author].push_back(id);
+        yearIndex[store[id].year].push_back(id);
+    }
+
+    static unsigned sortThreads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Книга в журнал, хранилище и индексы, кроме упорядоченных представлений.
+    // Вызывается под исключительной блокировкой catalogMutex.
+    uint32_t addLocked(BookKind kind, std::string_view title, std::string_view author, int year,
+                       std::string_view detail, uint64_t& lsn) {
+        lsn = logOp(journal::Op::AddBook, journal::Encoder()
+                                              .u8(static_cast<uint8_t>(kind))
+                                              .i32(year)
+                                              .str(title)
+                                              .str(author)
+                                              .str(detail));
+        uint32_t id = store.add(kind, title, author, year, detail);
+        books.push_back(id);
+        indexBook(id);
+        search.add(store, id);
+        return id;
+    }
+
+    // Вызывается под исключительной блокировкой catalogMutex
+    void rebuildIndexes() {
+        for (auto& shard : titleShards) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.books.clear();
+        }
+        authorIndex.clear();
+        yearIndex.clear();
+        search.clear();
+        for (uint32_t id : books) indexBook(id);
+        for (uint32_t id = 0; id < store.size(); ++id) search.add(store, id);
+        orderedViews.rebuild(sortThreads());
+    }
+
+    // id книг в порядке вывода; вызывается под блокировкой catalogMutex
+    std::vector<uint32_t> displayed() const {
+        if (displayOrder == BookOrder::Insertion) return books;
+        std::vector<uint32_t> ids;
+        ids.reserve(books.size());
+        orderedViews.view(displayOrder).forEach(0, books.size(), [&](uint32_t id) { ids.push_back(id); });
+        return ids;
+    }
+
+    std::vector<BookView> views(const std::vector<uint32_t>& ids) const {
+        std::vector<BookView> result;
+        result.reserve(ids.size());
+        for (uint32_t id : ids) result.emplace_back(store, id);
+        return result;
+    }
+
+    // Состояние пользователя для записи снимка
+    struct UserSnapshot {
+        int id;
+        std::string name;
+        std::vector<uint32_t> loans;
+    };
+
+    // Пользователи по возрастанию id; вызывается под блокировками всех полос
+    std::vector<UserSnapshot> captureUsers() const {
+        std::vector<UserSnapshot> result;
+        for (const auto& stripe : userStripes) {
+            for (const auto& [id, user] : stripe.users) {
+                result.push_back({ id, user->getName(), user->getBorrowed() });
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const UserSnapshot& a, const UserSnapshot& b) {
+            return a.id < b.id;
+        });
+        return result;
+    }
+
+    std::vector<std::unique_lock<std::mutex>> lockAllStripes() const {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(USER_STRIPES);
+        for (const auto& stripe : userStripes) locks.emplace_back(stripe.mutex);
+        return locks;
+    }
+
+    std::vector<uint8_t> captureFlags(const std::vector<uint32_t>& order) const {
+        std::vector<uint8_t> flags(order.size());
+        for (size_t i = 0; i < order.size(); ++i) flags[i] = store.borrowed(order[i]) ? 1 : 0;
+        return flags;
+    }
+
+    // Пользователь по id; вызывается под блокировкой его полосы
+    static User& userIn(UserStripe& stripe, int id) {
+        auto it = stripe.users.find(id);
+        if (it == stripe.users.end()) throw std::runtime_error("Пользователь не найден!");
+        return *it->second;
+    }
+
+    // Запись операции в журнал. Вызывается до того, как результат операции
+    // станет виден конкурирующим потокам, поэтому порядок LSN совпадает
+    // с порядком применения конфликтующих операций. Возвращает 0 без журнала.
+    uint64_t logOp(journal::Op op, const journal::Encoder& payload) {
+        return journalWriter ? journalWriter->append(op, payload.bytes()) : 0;
+    }
+
+    // Ожидание fsync вне блокировок: параллельные потоки попадают в одну группу
+    void commitOp(uint64_t lsn) {
+        if (lsn != 0 && journalWriter->getOptions().syncCommit) journalWriter->waitDurable(lsn);
+    }
+
+public:
+    Library() = default;
+    Library(const Library&) = delete;
+    Library& operator=(const Library&) = delete;
+
+    ~Library() {
+        if (compaction.joinable()) compaction.join();
+    }
+
+    // Книга копируется в каталог; возвращается её постоянный id
+    uint32_t addBook(const Book& book) {
+        return addBook(book.kind(), book.getTitle(), book.getAuthor(), book.getYear(), book.getDetail());
+    }
+
+    uint32_t addBook(const std::shared_ptr<Book>& book) {
+        return addBook(*book);
+    }
+
+    uint32_t addBook(BookKind kind, std::string_view title, std::string_view author, int year,
+                     std::string_view detail) {
+        uint64_t lsn;
+        uint32_t id;
+        {
+            std::unique_lock<std::shared_mutex> lock(catalogMutex);
+            id = addLocked(kind, title, author, year, detail, lsn);
+            if (!deferOrder) orderedViews.add(id);
+        }
+        commitOp(lsn);
+        return id;
+    }
+
+    // Пакетное добавление: одна блокировка каталога и одно ожидание fsync,
+    // большая пачка сливается с упорядоченными представлениями за один проход
+    std::vector<uint32_t> addBooks(const std::vector<std::shared_ptr<Book>>& batch) {
+        uint64_t lsn = 0;
+        std::vector<uint32_t> ids;
+        ids.reserve(batch.size());
+        {
+            std::unique_lock<std::shared_mutex> lock(catalogMutex);
+            try {
+                for (const auto& book : batch) {
+                    ids.push_back(addLocked(book->kind(), book->getTitle(), book->getAuthor(), book->getYear(),
+                                            book->getDetail(), lsn));
+                }
+            } catch (...) {
+                orderedViews.addBatch(ids, sortThreads());
+                throw;
+            }
+            orderedViews.addBatch(ids, sortThreads());
+        }
+        commitOp(lsn);
+        return ids;
+    }
+
+    void addUser(const std::shared_ptr<User>& user) {
+        if (user->getId() == BookStore::NO_HOLDER || user->getId() == BookStore::UNKNOWN_HOLDER) {
+            throw std::runtime_error("Недопустимый id пользователя");
+        }
+        uint64_t lsn;
+        {
+            UserStripe& stripe = userStripe(user->getId());
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            lsn = logOp(journal::Op::AddUser, journal::Encoder().i32(user->getId()).str(user->getName()));
+            stripe.users[user->getId()] = user;
+        }
+        commitOp(lsn);
+    }
+
+    size_t bookCount() const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        return books.size();
+    }
+
+    void showAllBooks() const {
+        exportBooks(streamSink(std::cout));
+    }
+
+    void showAllUsers() const {
+        exportUsers(streamSink(std::cout));
+    }
+
+    // Выгрузка каталога в порядке вывода. При threads > 1 большие каталоги
+    // форматируются параллельно блоками, приёмник получает их по порядку.
+    // Приёмник вызывается под разделяемой блокировкой каталога и не должен
+    // изменять библиотеку.
+    void exportBooks(const ReportSink& sink, ReportFormat format = ReportFormat::Text,
+                     unsigned threads = 1) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        const std::vector<uint32_t> order = displayed();
+        ReportWriter out(&sink);
+        report::booksHeader(out, format);
+        if (threads <= 1 || order.size() < 2 * EXPORT_BLOCK) {
+            for (uint32_t id : order) report::book(out, store, id, format);
+            out.flush();
+            return;
+        }
+
+        // Каждый раунд: threads блоков по EXPORT_BLOCK книг в свои буферы
+        out.flush();
+        std::vector<std::unique_ptr<ReportWriter>> parts;
+        for (unsigned t = 0; t < threads; ++t) parts.emplace_back(new ReportWriter());
+        for (size_t begin = 0; begin < order.size(); begin += threads * EXPORT_BLOCK) {
+            auto formatBlock = [&](unsigned t) {
+                size_t from = std::min(order.size(), begin + t * EXPORT_BLOCK);
+                size_t to = std::min(order.size(), from + EXPORT_BLOCK);
+                for (size_t i = from; i < to; ++i) report::book(*parts[t], store, order[i], format);
+            };
+            std::vector<std::thread> workers;
+            for (unsigned t = 1; t < threads; ++t) workers.emplace_back(formatBlock, t);
+            formatBlock(0);
+            for (auto& w : workers) w.join();
+            for (auto& part : parts) {
+                if (!part->view().empty()) sink(part->view());
+                part->clear();
+            }
+        }
+    }
+
+    // Выгрузка пользователей по возрастанию id; выдачи снимаются под
+    // блокировками полос, форматирование идёт без них
+    void exportUsers(const ReportSink& sink, ReportFormat format = ReportFormat::Text) const {
+        std::vector<UserSnapshot> users;
+        {
+            auto stripeLocks = lockAllStripes();
+            users = captureUsers();
+        }
+        ReportWriter out(&sink);
+        report::usersHeader(out, format);
+        for (const auto& u : users) report::user(out, store, u.id, u.name, u.loans, format);
+        out.flush();
+    }
+
+    // Книга по постоянному id; пустой BookView, если такой нет
+    BookView getBook(uint32_t id) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        return id < store.size() ? BookView(store, id) : BookView();
+    }
+
+    BookView findBook(std::string_view title) const {
+        const TitleShard& shard = titleShard(title);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.books.find(title);
+        if (it == shard.books.end()) {
+            PROFILE_COUNT("title_index_misses", 1);
+            return BookView();
+        }
+        PROFILE_COUNT("title_index_hits", 1);
+        return BookView(store, it->second);
+    }
+
+    std::vector<BookView> findBooksByAuthor(std::string_view author) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        uint32_t key;
+        if (!store.findAuthor(author, key) || key >= authorIndex.size()) {
+            PROFILE_COUNT("author_index_misses", 1);
+            return {};
+        }
+        PROFILE_COUNT("author_index_hits", 1);
+        return views(authorIndex[key]);
+    }
+
+    // Книги с годом в диапазоне [from, to], по возрастанию года
+    std::vector<BookView> findBooksByYear(int from, int to) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        std::vector<BookView> result;
+        for (auto it = yearIndex.lower_bound(from); it != yearIndex.end() && it->first <= to; ++it) {
+            for (uint32_t id : it->second) result.emplace_back(store, id);
+        }
+        return result;
+    }
+
+    std::vector<BookView> findBooksByYear(int year) const {
+        return findBooksByYear(year, year);
+    }
+
+    // Полнотекстовый поиск по словам названия, автора и жанра/области без
+    // учёта регистра. Нужны все слова запроса; последнее может быть началом
+    // слова, как при наборе в строке поиска. Лучшие совпадения первыми.
+    std::vector<BookView> searchBooks(std::string_view query, size_t limit = 20) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        std::vector<BookView> result;
+        for (const auto& hit : search.search(query, limit, true)) result.emplace_back(store, hit.book);
+        return result;
+    }
+
+    // Автодополнение последнего слова запроса по словарю каталога
+    std::vector<std::string> completeWord(std::string_view prefix, size_t limit = 10) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        return search.complete(prefix, limit);
+    }
+
+    // Выдача: книгу захватывает CAS по её признаку, так что разные книги
+    // выдаются параллельно, а гонка за одну книгу имеет ровно одного победителя
+    void borrowBook(int userId, std::string_view title) {
+        PROFILE_SCOPE("borrow_book");
+        borrow(userId, findBook(title));
+    }
+
+    void borrowBookById(int userId, uint32_t bookId) {
+        PROFILE_SCOPE("borrow_book");
+        borrow(userId, getBook(bookId));
+    }
+
+    // Возврат: запись в журнал идёт до освобождения книги, чтобы следующая
+    // выдача этой книги получила больший LSN
+    void returnBook(int userId, std::string_view title) {
+        const BookView book = findBook(title);
+        uint64_t lsn;
+        {
+            UserStripe& stripe = userStripe(userId);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            User& user = userIn(stripe, userId);
+            uint32_t bookId = loanByTitle(user, book, title);
+            if (bookId == NO_BOOK) throw std::runtime_error("Пользователь не брал эту книгу!");
+            lsn = logOp(journal::Op::Return, journal::Encoder().i32(userId).u32(bookId));
+            user.returnBook(bookId);
+            store.release(bookId);
+        }
+        commitOp(lsn);
+    }
+
+    void returnBookById(int userId, uint32_t bookId) {
+        uint64_t lsn;
+        {
+            UserStripe& stripe = userStripe(userId);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            User& user = userIn(stripe, userId);
+            if (!user.holds(bookId)) throw std::runtime_error("Пользователь не брал эту книгу!");
+            lsn = logOp(journal::Op::Return, journal::Encoder().i32(userId).u32(bookId));
+            user.returnBook(bookId);
+            store.release(bookId);
+        }
+        commitOp(lsn);
+    }
+
+    // Пользователь, взявший книгу; false, если книга свободна, нет такой книги
+    // или держатель неизвестен (каталог старого формата без пользователей)
+    bool findHolder(uint32_t bookId, int& userId) const {
+        if (!getBook(bookId)) return false;
+        int32_t holder = store.holder(bookId);
+        if (holder == BookStore::NO_HOLDER || holder == BookStore::UNKNOWN_HOLDER) return false;
+        userId = holder;
+        return true;
+    }
+
+    // Пакетная выдача одному пользователю: одна блокировка полосы и одно
+    // ожидание fsync на всю пачку. Результат — признак выдачи каждой книги
+    // пачки; ненайденные и уже взятые книги пропускаются.
+    std::vector<bool> borrowBooks(int userId, const std::vector<std::string_view>& titles) {
+        return borrowBatch(userId, resolveTitles(titles));
+    }
+
+    std::vector<bool> borrowBooksById(int userId, const std::vector<uint32_t>& bookIds) {
+        return borrowBatch(userId, bookIds);
+    }
+
+    // Пакетный возврат; книги, которых у пользователя нет, пропускаются
+    std::vector<bool> returnBooks(int userId, const std::vector<std::string_view>& titles) {
+        std::vector<BookView> found;
+        found.reserve(titles.size());
+        for (std::string_view title : titles) found.push_back(findBook(title));
+        return returnBatch(userId, titles.size(), [&](const User& user, size_t i) {
+            return loanByTitle(user, found[i], titles[i]);
+        });
+    }
+
+    std::vector<bool> returnBooksById(int userId, const std::vector<uint32_t>& bookIds) {
+        return returnBatch(userId, bookIds.size(), [&](const User& user, size_t i) {
+            return user.holds(bookIds[i]) ? bookIds[i] : NO_BOOK;
+        });
+    }
+
+    // Включение журнала: загрузка снимка basePath.snap, воспроизведение
+    // basePath.wal, после чего каждое изменение дописывается в журнал.
+    // Вызывается до того, как библиотека станет доступна другим потокам.
+    void openJournal(const std::string& basePath, const JournalOptions& options = {}) {
+        if (journalWriter) throw std::runtime_error("Журнал уже открыт");
+        bool hasUsers = std::any_of(std::begin(userStripes), std::end(userStripes),
+                                    [](const UserStripe& s) { return !s.users.empty(); });
+        if (!books.empty() || hasUsers) {
+            throw std::runtime_error("Журнал открывается только для пустой библиотеки");
+        }
+
+        snapshotPath = basePath + ".snap";
+        const std::string journalPath = basePath + ".wal";
+
+        uint64_t snapshotLsn = 0;
+        bool snapshotHasUsers = true;
+        if (std::ifstream(snapshotPath).good()) {
+            CatalogView view(snapshotPath);
+            loadSnapshot(view);
+            snapshotLsn = view.lsn();
+            // Снимки до версии 3 не хранят выдачи — они целиком в журнале
+            snapshotHasUsers = view.hasUsers();
+            if (!snapshotHasUsers) {
+                for (uint32_t id : books) store.release(id);
+            }
+        }
+        uint64_t baseLsn = snapshotLsn, lastLsn = snapshotLsn;
+
+        // Книги из журнала попадают в упорядоченные представления одной пачкой
+        const uint32_t firstReplayed = static_cast<uint32_t>(store.size());
+        deferOrder = true;
+        uint32_t journalVersion;
+        try {
+            journalVersion = replayJournal(journalPath, snapshotLsn, snapshotHasUsers, baseLsn, lastLsn);
+        } catch (...) {
+            deferOrder = false;
+            throw;
+        }
+        deferOrder = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(catalogMutex);
+            std::vector<uint32_t> replayed;
+            for (uint32_t id = firstReplayed; id < store.size(); ++id) replayed.push_back(id);
+            orderedViews.addBatch(replayed, sortThreads());
+        }
+
+        // Журнал старой версии не дописывается: состояние сразу уходит в снимок,
+        // и журнал начинается заново после него
+        if (journalVersion != journal::VERSION || !snapshotHasUsers) {
+            writeCatalog(snapshotPath, store, books, captureFlags(books), captureUsers(), lastLsn, true);
+            if (::unlink(journalPath.c_str()) != 0 && errno != ENOENT) {
+                throw std::runtime_error("Ошибка обновления журнала");
+            }
+            baseLsn = lastLsn;
+        }
+        journalWriter = std::make_unique<JournalWriter>(journalPath, baseLsn, lastLsn, options);
+    }
+
+    // Принудительный сброс журнала на диск (нужен при syncCommit = false)
+    void flushJournal() {
+        if (journalWriter) journalWriter->flush();
+    }
+
+    // Фоновое уплотнение: снимок каталога с пользователями и выдачами на текущий
+    // LSN, затем в журнале остаются только записи, добавленные, пока писался
+    // снимок. Изменения приостанавливаются лишь на время отметки в журнале
+    // и копирования состояния.
+    void compact() {
+        if (!journalWriter) throw std::runtime_error("Журнал не открыт");
+        std::lock_guard<std::mutex> guard(compactionMutex);
+        waitCompactionLocked();
+
+        std::unique_lock<std::shared_mutex> catalogLock(catalogMutex);
+        auto stripeLocks = lockAllStripes();
+
+        JournalWriter::Mark mark = journalWriter->mark();
+        std::vector<uint32_t> order = books;
+        std::vector<uint8_t> flags = captureFlags(order);
+        std::vector<UserSnapshot> userState = captureUsers();
+
+        stripeLocks.clear();
+        catalogLock.unlock();
+
+        // Записи и строки BookStore неизменны и не перемещаются, поэтому
+        // фоновый поток читает их без блокировок параллельно с addBook
+        compaction = std::thread([this, order = std::move(order), flags = std::move(flags),
+                                  userState = std::move(userState), mark] {
+            try {
+                writeCatalog(snapshotPath, store, order, flags, userState, mark.lsn, true);
+                journalWriter->rewrite(mark.lsn, mark.offset);
+            } catch (...) {
+                compactionError = std::current_exception();
+            }
+        });
+    }
+
+    // Ожидание фонового уплотнения; его ошибка пробрасывается отсюда
+    void waitCompaction() {
+        std::lock_guard<std::mutex> guard(compactionMutex);
+        waitCompactionLocked();
+    }
+
+    // Вывод по названию без учёта регистра; книги, добавленные позже, тоже
+    // попадают на своё место. Среди одинаковых названий первой остаётся
+    // добавленная раньше — та, на которую указывает индекс по названию.
+    void sortBooksByTitle() {
+        setDisplayOrder(BookOrder::Title);
+    }
+
+    // Порядок showAllBooks и exportBooks. Само хранилище и порядок добавления
+    // не меняются, файлы каталога пишутся по id, и порядок вывода в них не
+    // сохраняется.
+    void setDisplayOrder(BookOrder order) {
+        std::unique_lock<std::shared_mutex> lock(catalogMutex);
+        displayOrder = order;
+    }
+
+    BookOrder getDisplayOrder() const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        return displayOrder;
+    }
+
+    // Страница каталога в заданном порядке: книги с позициями [offset, offset + limit)
+    std::vector<BookView> booksInOrder(BookOrder order, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        std::vector<BookView> result;
+        if (order == BookOrder::Insertion) {
+            for (size_t i = offset; i < books.size() && result.size() < limit; ++i) result.emplace_back(store, books[i]);
+        } else {
+            orderedViews.view(order).forEach(offset, limit, [&](uint32_t id) { result.emplace_back(store, id); });
+        }
+        return result;
+    }
+
+    // Запись в столбцовом формате catalog_format вместе с пользователями и
+    // выдачами. Книги идут по id: файлы без столбца id (до версии 3) нумеруют
+    // книги по позиции, и запись в порядке вывода перенумеровала бы их
+    void saveToBinaryFile(const std::string& filename) {
+        PROFILE_SCOPE("save");
+        std::shared_lock<std::shared_mutex> lock(catalogMutex);
+        auto stripeLocks = lockAllStripes();
+        writeCatalog(filename, store, books, captureFlags(books), captureUsers(), 0, false);
+    }
+
+    // Загрузка: столбцовый формат через mmap, старый текстовый — для совместимости.
+    // Пользователи заменяются, только если файл их содержит (версия 3 и новее);
+    // иначе они остаются без выдач (см. dropLoans).
+    void loadFromBinaryFile(const std::string& filename) {
+        PROFILE_SCOPE("load");
+        if (journalWriter) throw std::runtime_error("Загрузка каталога недоступна при открытом журнале");
+        if (!CatalogView::isCatalogFile(filename)) {
+            std::unique_lock<std::shared_mutex> lock(catalogMutex);
+            auto stripeLocks = lockAllStripes();
+            loadLegacyFile(filename);
+            dropLoans();
+            return;
+        }
+        CatalogView view(filename);
+        loadSnapshot(view);
+    }
+
+private:
+    void borrow(int userId, const BookView& book) {
+        uint64_t lsn;
+        {
+            UserStripe& stripe = userStripe(userId);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            User& user = userIn(stripe, userId);
+            if (!book) throw std::runtime_error("Книга не найдена!");
+            const uint32_t bookId = book.getId();
+            if (!store.tryBorrow(bookId, userId)) throw std::runtime_error("Книга уже взята!");
+            try {
+                lsn = logOp(journal::Op::Borrow, journal::Encoder().i32(userId).u32(bookId));
+            } catch (...) {
+                store.release(bookId);
+                throw;
+            }
+            user.borrowBook(bookId);
+        }
+        commitOp(lsn);
+    }
+
+    static constexpr uint32_t NO_BOOK = UINT32_MAX;
+
+    std::vector<uint32_t> resolveTitles(const std::vector<std::string_view>& titles) const {
+        std::vector<uint32_t> ids;
+        ids.reserve(titles.size());
+        for (std::string_view title : titles) {
+            BookView book = findBook(title);
+            ids.push_back(book ? book.getId() : NO_BOOK);
+        }
+        return ids;
+    }
+
+    // Выдача пользователя с данным названием. Индекс по названию указывает на
+    // первую такую книгу; если у пользователя другой экземпляр, он ищется в
+    // списке выдач. Вызывается под блокировкой полосы пользователя.
+    uint32_t loanByTitle(const User& user, const BookView& book, std::string_view title) const {
+        if (!book) return NO_BOOK;
+        if (store.holder(book.getId()) == user.getId()) return book.getId();
+        for (uint32_t id : user.getBorrowed()) {
+            if (store.title(id) == title) return id;
+        }
+        return NO_BOOK;
+    }
+
+    std::vector<bool> borrowBatch(int userId, const std::vector<uint32_t>& bookIds) {
+        PROFILE_SCOPE("borrow_batch");
+        const size_t known = bookCount();
+        std::vector<bool> done(bookIds.size(), false);
+        uint64_t lsn = 0;
+        {
+            UserStripe& stripe = userStripe(userId);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            User& user = userIn(stripe, userId);
+            for (size_t i = 0; i < bookIds.size(); ++i) {
+                const uint32_t bookId = bookIds[i];
+                if (bookId >= known || !store.tryBorrow(bookId, userId)) continue;
+                try {
+                    lsn = logOp(journal::Op::Borrow, journal::Encoder().i32(userId).u32(bookId));
+                } catch (...) {
+                    store.release(bookId);
+                    throw;
+                }
+                user.borrowBook(bookId);
+                done[i] = true;
+            }
+        }
+        commitOp(lsn);
+        return done;
+    }
+
+    // loanOf(user, i) — id книги i-го элемента пачки у пользователя или NO_BOOK
+    template <typename LoanOf>
+    std::vector<bool> returnBatch(int userId, size_t count, LoanOf&& loanOf) {
+        std::vector<bool> done(count, false);
+        uint64_t lsn = 0;
+        {
+            UserStripe& stripe = userStripe(userId);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            User& user = userIn(stripe, userId);
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t bookId = loanOf(user, i);
+                if (bookId == NO_BOOK) continue;
+                lsn = logOp(journal::Op::Return, journal::Encoder().i32(userId).u32(bookId));
+                user.returnBook(bookId);
+                store.release(bookId);
+                done[i] = true;
+            }
+        }
+        commitOp(lsn);
+        return done;
+    }
+
+    void waitCompactionLocked() {
+        if (compaction.joinable()) compaction.join();
+        if (compactionError) {
+            std::exception_ptr error = compactionError;
+            compactionError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    // durable: запись во временный файл, fsync и атомарное переименование
+    static void writeCatalog(const std::string& filename, const BookStore& src, const std::vector<uint32_t>& order,
+                             const std::vector<uint8_t>& flags, const std::vector<UserSnapshot>& userState,
+                             uint64_t lsn, bool durable) {
+        using catalog_format::StringRef;
+        const size_t count = order.size();
+
+        std::vector<StringRef> refs(3 * count);
+        std::vector<int32_t> years(count);
+        std::vector<uint32_t> ids(count);
+        std::vector<uint8_t> kinds(count);
+        std::string heap;
+        std::unordered_map<std::string_view, StringRef> shared; // повторяющиеся авторы и жанры
+
+        auto put = [&](std::string_view str) {
+            if (heap.size() + str.size() > UINT32_MAX) throw std::runtime_error("Каталог слишком велик");
+            StringRef ref{ static_cast<uint32_t>(heap.size()), static_cast<uint32_t>(str.size()) };
+            heap.append(str);
+            return ref;
+        };
+        auto putShared = [&](std::string_view str) {
+            auto it = shared.find(str);
+            if (it != shared.end()) return it->second;
+            StringRef ref = put(str);
+            shared.emplace(str, ref);
+            return ref;
+        };
+
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t id = order[i];
+            refs[i] = put(src.title(id));
+            refs[count + i] = putShared(src.author(id));
+            refs[2 * count + i] = putShared(src.detail(id));
+            years[i] = src[id].year;
+            ids[i] = id;
+            kinds[i] = static_cast<uint8_t>(src[id].kind);
+        }
+
+        std::vector<int32_t> userIds;
+        std::vector<StringRef> userNames;
+        std::vector<uint32_t> loanStart, loans;
+        userIds.reserve(userState.size());
+        userNames.reserve(userState.size());
+        loanStart.reserve(userState.size() + 1);
+        for (const auto& user : userState) {
+            userIds.push_back(user.id);
+            userNames.push_back(put(user.name));
+            loanStart.push_back(static_cast<uint32_t>(loans.size()));
+            loans.insert(loans.end(), user.loans.begin(), user.loans.end());
+        }
+        loanStart.push_back(static_cast<uint32_t>(loans.size()));
+
+        catalog_format::Header h{};
+        std::memcpy(h.magic, catalog_format::MAGIC, 4);
+        h.version = catalog_format::VERSION;
+        h.count = count;
+        h.heapSize = heap.size();
+        h.lsn = lsn;
+        h.userCount = userIds.size();
+        h.loanCount = loans.size();
+
+        auto bytes = [](const auto& column) {
+            return std::make_pair(reinterpret_cast<const char*>(column.data()),
+                                  column.size() * sizeof(column[0]));
+        };
+        const std::pair<const char*, size_t> parts[] = {
+            { reinterpret_cast<const char*>(&h), sizeof(h) },
+            bytes(refs), bytes(years), bytes(ids),
+            bytes(userIds), bytes(userNames), bytes(loanStart), bytes(loans),
+            bytes(kinds), bytes(flags), { heap.data(), heap.size() },
+        };
+
+        const std::string target = durable ? filename + ".tmp" : filename;
+        int fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии файла для записи");
+        try {
+            for (const auto& [ptr, size] : parts) writeAll(fd, ptr, size);
+            if (durable && ::fdatasync(fd) != 0) throw std::runtime_error("Ошибка записи файла");
+        } catch (...) {
+            ::close(fd);
+            if (durable) ::unlink(target.c_str());
+            throw;
+        }
+        ::close(fd);
+
+        if (durable) {
+            if (::rename(target.c_str(), filename.c_str()) != 0) {
+                ::unlink(target.c_str());
+                throw std::runtime_error("Ошибка записи файла");
+            }
+            syncParentDirectory(filename);
+        }
+    }
+
+    // Загрузка столбцового каталога за один проход: книги раскладываются
+    // по id, выдачи пользователей подключаются по id без поиска по названию
+    void loadSnapshot(const CatalogView& view) {
+        std::unique_lock<std::shared_mutex> lock(catalogMutex);
+        auto stripeLocks = lockAllStripes();
+
+        // Записи добавляются в порядке id. Файлы, записанные раньше в порядке
+        // вывода, читаются так же: порядок добавления — это порядок id
+        std::vector<uint32_t> order(view.size());
+        std::vector<uint32_t> position(view.size());
+        for (size_t i = 0; i < view.size(); ++i) {
+            order[i] = static_cast<uint32_t>(i);
+            position[view[i].id] = static_cast<uint32_t>(i);
+        }
+        store.clear();
+        for (size_t id = 0; id < view.size(); ++id) {
+            BookRecordView r = view[position[id]];
+            store.add(r.kind, r.title, r.author, r.year, r.detail);
+            if (r.borrowed) store.tryBorrow(static_cast<uint32_t>(id), BookStore::UNKNOWN_HOLDER);
+        }
+        books.swap(order);
+        rebuildIndexes();
+
+        if (view.hasUsers()) {
+            for (auto& stripe : userStripes) stripe.users.clear();
+            for (size_t u = 0; u < view.userCount(); ++u) {
+                UserRecordView r = view.user(u);
+                auto user = std::make_shared<User>(std::string(r.name), r.id);
+                for (uint32_t k = r.loanBegin; k < r.loanEnd; ++k) {
+                    user->borrowBook(view.loan(k));
+                    store.assignHolder(view.loan(k), r.id);
+                }
+                userStripe(r.id).users[r.id] = std::move(user);
+            }
+        } else {
+            dropLoans();
+        }
+    }
+
+    // Каталог заменён файлом без пользователей: выдачи хранят id книг старого
+    // каталога, которые в новом означают другие книги, поэтому сбрасываются.
+    // Вызывается под catalogMutex и блокировками всех полос.
+    void dropLoans() {
+        for (auto& stripe : userStripes) {
+            for (auto& entry : stripe.users) entry.second->clearLoans();
+        }
+    }
+
+    // Воспроизведение журнала поверх снимка. Записи с LSN <= snapshotLsn уже
+    // учтены в снимке; если снимок не хранит пользователей (до версии 3),
+    // из них пропускаются только книги. Возвращает версию журнала.
+    uint32_t replayJournal(const std::string& path, uint64_t snapshotLsn, bool snapshotHasUsers,
+                           uint64_t& baseLsn, uint64_t& lastLsn) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return journal::VERSION;
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        if (data.empty()) return journal::VERSION;
+
+        journal::FileHeader h;
+        if (data.size() < sizeof(h)) throw std::runtime_error("Журнал повреждён");
+        std::memcpy(&h, data.data(), sizeof(h));
+        if (std::memcmp(h.magic, journal::MAGIC, 4) != 0 || h.version < 1 || h.version > journal::VERSION) {
+            throw std::runtime_error("Журнал повреждён");
+        }
+        if (h.baseLsn > snapshotLsn) throw std::runtime_error("Журнал не соответствует снимку каталога");
+        baseLsn = h.baseLsn;
+
+        size_t end = journal::scan(data, sizeof(h), [&](uint64_t lsn, journal::Op op, journal::Decoder& entry) {
+            lastLsn = std::max(lastLsn, lsn);
+            bool inSnapshot = lsn <= snapshotLsn && (snapshotHasUsers || op == journal::Op::AddBook);
+            if (!inSnapshot) applyEntry(op, entry, h.version);
+        });
+
+        // Оборванная при сбое запись отрезается, новые пишутся за последней целой
+        if (end < data.size() && ::truncate(path.c_str(), static_cast<off_t>(end)) != 0) {
+            throw std::runtime_error("Ошибка восстановления журнала");
+        }
+        return h.version;
+    }
+
+    void applyEntry(journal::Op op, journal::Decoder& in, uint32_t version) {
+        switch (op) {
+        case journal::Op::AddBook: {
+            auto kind = static_cast<BookKind>(in.u8());
+            int year = in.i32();
+            std::string title = in.str();
+            std::string author = in.str();
+            std::string detail = in.str();
+            addBook(kind, title, author, year, detail);
+            break;
+        }
+        case journal::Op::AddUser: {
+            int id = in.i32();
+            addUser(std::make_shared<User>(in.str(), id));
+            break;
+        }
+        case journal::Op::Borrow: {
+            int id = in.i32();
+            if (version >= 2) borrowBookById(id, in.u32());
+            else borrowBook(id, in.str());
+            break;
+        }
+        case journal::Op::Return: {
+            int id = in.i32();
+            if (version >= 2) returnBookById(id, in.u32());
+            else returnBook(id, in.str());
+            break;
+        }
+        default:
+            throw std::runtime_error("Неизвестная операция в журнале");
+        }
+    }
+
+    // Старый формат: длина + строка с полями через ';'. Файл сначала целиком
+    // разбирается, и только потом заменяет каталог: ошибка в середине файла
+    // оставляет прежний каталог и индексы нетронутыми
+    void loadLegacyFile(const std::string& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) throw std::runtime_error("Ошибка при открытии файла для чтения");
+
+        struct LegacyRecord {
+            BookKind kind;
+            std::string title, author, detail;
+            int year;
+            bool borrowed;
+        };
+        std::vector<LegacyRecord> records;
+
+        size_t count;
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+        std::string serialized;
+        for (size_t i = 0; i < count && in; ++i) {
+            size_t len;
+            if (!in.read(reinterpret_cast<char*>(&len), sizeof(len))) break;
+            serialized.resize(len);
+            if (!in.read(&serialized[0], len)) break;
+
+            std::vector<std::string> parts = splitEscaped(serialized);
+
+            if (parts.size() != 6) continue;
+            BookKind kind;
+            if (parts[0] == "ScienceBook") {
+                kind = BookKind::Science;
+            } else if (parts[0] == "FictionBook") {
+                kind = BookKind::Fiction;
+            } else {
+                continue;
+            }
+            int year;
+            try {
+                year = std::stoi(parts[3]);
+            } catch (const std::logic_error&) {
+                throw std::runtime_error("Каталог повреждён: неверный год \"" + parts[3] + "\"");
+            }
+            records.push_back({ kind, std::move(parts[1]), std::move(parts[2]), std::move(parts[4]), year,
+                                parts[5] == "1" });
+        }
+        in.close();
+
+        store.clear();
+        books.clear();
+        for (const LegacyRecord& r : records) {
+            uint32_t id = store.add(r.kind, r.title, r.author, r.year, r.detail);
+            if (r.borrowed) store.tryBorrow(id, BookStore::UNKNOWN_HOLDER);
+            books.push_back(id);
+        }
+        rebuildIndexes();
+    }
+};
+
+// --------------------- ГЛАВНАЯ ФУНКЦИЯ ---------------------
+int main() {
+    // Профиль пишется в файл из переменной PROFILE, если она задана
+    profiler::Session profile;
+
+    Library lib;
+
+    // Добавляем книги
+    lib.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
+    lib.addBook(std::make_shared<FictionBook>("Приключения в лесу", "Петров", 2015, "Приключения"));
+    lib.addBook(std::make_shared<ScienceBook>("Химия и жизнь", "Сидоров", 2012, "Химия"));
+    lib.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+
+    // Добавляем пользователей
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.addUser(std::make_shared<User>("Мария", 2));
+
+    std::cout << "Все книги:\n";
+    lib.showAllBooks();
+
+    // Пользователи берут книги
+    try {
+        lib.borrowBook(1, "Физика для всех");
+        lib.borrowBook(2, "Мир фантазий");
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    std::cout << "\nСостояние пользователей после выдачи книг:\n";
+    lib.showAllUsers();
+
+    // Поиск по индексам
+    std::cout << "\nКниги автора Иванов:\n";
+    for (const auto& book : lib.findBooksByAuthor("Иванов")) {
+        std::cout << "  - " << book.getTitle() << " (" << book.getYear() << ")\n";
+    }
+    std::cout << "Книги 2010-2015 годов:\n";
+    for (const auto& book : lib.findBooksByYear(2010, 2015)) {
+        std::cout << "  - " << book.getTitle() << " (" << book.getYear() << ")\n";
+    }
+
+    std::cout << "Поиск \"иванов физ\":\n";
+    for (const auto& book : lib.searchBooks("иванов физ")) {
+        std::cout << "  - " << book.getTitle() << ", " << book.getAuthor() << "\n";
+    }
+    std::cout << "Дополнение \"ми\":";
+    for (const auto& word : lib.completeWord("ми")) std::cout << ' ' << word;
+    std::cout << "\n";
+
+    std::cout << "\nКаталог в CSV:\n";
+    lib.exportBooks(streamSink(std::cout), ReportFormat::Csv);
+    std::cout << "Пользователи в JSON Lines:\n";
+    lib.exportUsers(streamSink(std::cout), ReportFormat::JsonLines);
+
+    // Сохраняем библиотеку в бинарный файл
+    try {
+        lib.saveToBinaryFile("library.dat");
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    // Загружаем из бинарного файла в новую библиотеку
+    Library lib2;
+    try {
+        lib2.loadFromBinaryFile("library.dat");
+        std::cout << "\nЗагруженная библиотека:\n";
+        lib2.showAllBooks();
+        std::cout << "\nПользователи загруженной библиотеки:\n";
+        lib2.showAllUsers();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    // Журнал операций: выдачи переживают перезапуск без перезаписи каталога
+    std::remove("library_journal.snap");
+    std::remove("library_journal.wal");
+    try {
+        {
+            Library journaled;
+            journaled.openJournal("library_journal");
+            journaled.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
+            journaled.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+            journaled.addUser(std::make_shared<User>("Алексей", 1));
+            journaled.borrowBook(1, "Физика для всех");
+            journaled.compact();
+            journaled.borrowBook(1, "Мир фантазий");
+        }
+
+        Library restored;
+        restored.openJournal("library_journal");
+        std::cout << "\nВосстановлено из журнала:\n";
+        restored.showAllUsers();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
     }
@@ -0,0 +1,342 @@
+// Лёгкий профилировщик для gravity.cpp, simulator.cpp и library.cpp:
+// таймеры областей видимости, счётчики и гистограммы значений.
+//
+//   PROFILE_SCOPE("update");               // время до конца блока
+//   PROFILE_COUNT("pair_checks", pairs);   // сумма за прогон
+//   PROFILE_VALUE("contacts", n);          // распределение значений
+//
+// По умолчанию выключен: макрос стоит одной проверки флага. Включается
+// объектом profiler::Session с путём к файлу или переменной окружения
+// PROFILE=путь; при завершении сессии в файл пишется JSON в формате
+// Chrome trace (открывается в chrome://tracing и Perfetto) с итогами
+// по каждой метрике рядом с событиями. С -DPROFILER_DISABLED макросы
+// не порождают кода.
+//
+// Каждый поток пишет только в свои ячейки (атомарные, без RMW), поэтому
+// замеры из разных потоков не спорят за кэш-линии; итоги складываются
+// при записи файла.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+enum class Kind : uint8_t { Timer, Counter, Histogram };
+
+constexpr size_t MAX_METRICS = 64;
+constexpr int BUCKETS = 64;                       // корзина k: значения в [2^(k-1), 2^k)
+constexpr size_t MAX_TRACE_EVENTS = 1u << 20;     // на поток; лишние события только считаются
+
+namespace detail {
+
+using Clock = std::chrono::steady_clock;
+
+struct Slot {
+    std::atomic<uint64_t> count{0}, sum{0}, min{UINT64_MAX}, max{0};
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+
+    // Пишет только поток-владелец, поэтому хватает load/store
+    void add(uint64_t value) {
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value < min.load(std::memory_order_relaxed)) min.store(value, std::memory_order_relaxed);
+        if (value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
+        int k = value == 0 ? 0 : std::min(BUCKETS - 1, 64 - __builtin_clzll(value));
+        buckets[k].store(buckets[k].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+struct TraceEvent {
+    uint32_t metric;
+    uint64_t startNs, durNs;
+};
+
+// Ячейки одного потока; после выхода потока достаются следующему новому
+struct ThreadData {
+    uint32_t tid = 0;
+    bool inUse = false;
+    Slot slots[MAX_METRICS];
+    std::mutex traceMutex;
+    std::vector<TraceEvent> trace;
+    uint64_t droppedEvents = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::vector<Kind> kinds;
+    std::vector<std::unique_ptr<ThreadData>> threads;
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> tracing{false};
+    Clock::time_point origin = Clock::now();
+};
+
+inline Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+// Занимает свободные ячейки при первом замере в потоке и освобождает при выходе
+class ThreadHandle {
+    ThreadData* data = nullptr;
+
+public:
+    ThreadData& get() {
+        if (data) return *data;
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (auto& t : r.threads) {
+            if (!t->inUse) {
+                data = t.get();
+                break;
+            }
+        }
+        if (!data) {
+            r.threads.push_back(std::make_unique<ThreadData>());
+            data = r.threads.back().get();
+            data->tid = static_cast<uint32_t>(r.threads.size() - 1);
+        }
+        data->inUse = true;
+        return *data;
+    }
+
+    ~ThreadHandle() {
+        if (!data) return;
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        data->inUse = false;
+    }
+};
+
+inline ThreadData& local() {
+    thread_local ThreadHandle handle;
+    return handle.get();
+}
+
+inline uint64_t sinceOrigin(Clock::time_point t) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t - registry().origin).count());
+}
+
+// Строка JSON: имена метрик задаются в коде, но кавычки всё же экранируются
+inline void writeString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+} // namespace detail
+
+inline bool enabled() { return detail::registry().enabled.load(std::memory_order_relaxed); }
+
+// Номер метрики по имени; повторный вызов с тем же именем возвращает тот же номер
+inline uint32_t metric(const char* name, Kind kind) {
+    detail::Registry& r = detail::registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (size_t i = 0; i < r.names.size(); ++i) {
+        if (r.names[i] != name) continue;
+        if (r.kinds[i] != kind) throw std::logic_error(std::string("Метрика другого вида: ") + name);
+        return static_cast<uint32_t>(i);
+    }
+    if (r.names.size() == MAX_METRICS) throw std::logic_error("Слишком много метрик профилировщика");
+    r.names.emplace_back(name);
+    r.kinds.push_back(kind);
+    return static_cast<uint32_t>(r.names.size() - 1);
+}
+
+inline void add(uint32_t id, uint64_t n) {
+    if (!enabled()) return;
+    detail::Slot& s = detail::local().slots[id];
+    s.count.store(s.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s.sum.store(s.sum.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void record(uint32_t id, uint64_t value) {
+    if (enabled()) detail::local().slots[id].add(value);
+}
+
+// Время области видимости в наносекундах; при трассировке ещё и событие
+class Scope {
+    uint32_t id;
+    bool active;
+    detail::Clock::time_point start;
+
+public:
+    explicit Scope(uint32_t metricId) : id(metricId), active(enabled()) {
+        if (active) start = detail::Clock::now();
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    ~Scope() {
+        if (!active) return;
+        auto end = detail::Clock::now();
+        uint64_t ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        detail::ThreadData& t = detail::local();
+        t.slots[id].add(ns);
+        if (!detail::registry().tracing.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> lock(t.traceMutex);
+        if (t.trace.size() < MAX_TRACE_EVENTS) t.trace.push_back({id, detail::sinceOrigin(start), ns});
+        else ++t.droppedEvents;
+    }
+};
+
+// Итоги и события всех потоков в одном JSON: traceEvents читают
+// просмотрщики трассировок, остальные поля — скрипты сравнения прогонов
+inline void writeJson(std::ostream& out) {
+    using namespace detail;
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    const size_t n = r.names.size();
+
+    struct Total {
+        uint64_t count = 0, sum = 0, min = UINT64_MAX, max = 0;
+        uint64_t buckets[BUCKETS] = {};
+    };
+    std::vector<Total> totals(n);
+    uint64_t dropped = 0;
+    for (const auto& t : r.threads) {
+        for (size_t i = 0; i < n; ++i) {
+            const Slot& s = t->slots[i];
+            Total& tot = totals[i];
+            tot.count += s.count.load(std::memory_order_relaxed);
+            tot.sum += s.sum.load(std::memory_order_relaxed);
+            tot.min = std::min(tot.min, s.min.load(std::memory_order_relaxed));
+            tot.max = std::max(tot.max, s.max.load(std::memory_order_relaxed));
+            for (int k = 0; k < BUCKETS; ++k) tot.buckets[k] += s.buckets[k].load(std::memory_order_relaxed);
+        }
+    }
+
+    out << std::fixed << std::setprecision(3) << "{\n\"traceEvents\": [";
+    bool first = true;
+    for (const auto& t : r.threads) {
+        std::lock_guard<std::mutex> traceLock(t->traceMutex);
+        dropped += t->droppedEvents;
+        for (const TraceEvent& e : t->trace) {
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            writeString(out, r.names[e.metric]);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->tid
+                << ",\"ts\":" << e.startNs / 1e3 << ",\"dur\":" << e.durNs / 1e3 << "}";
+            first = false;
+        }
+    }
+    out << "\n],\n\"displayTimeUnit\": \"ms\",\n\"droppedEvents\": " << dropped;
+
+    // Гистограмма — пары [верхняя граница корзины, число значений], пустые пропускаются
+    auto writeBuckets = [&](const Total& tot, double scale) {
+        out << "[";
+        bool firstBucket = true;
+        for (int k = 0; k < BUCKETS; ++k) {
+            if (tot.buckets[k] == 0) continue;
+            double upper = k == 0 ? 0.0 : std::ldexp(1.0, k) / scale;
+            out << (firstBucket ? "" : ",") << "[" << upper << "," << tot.buckets[k] << "]";
+            firstBucket = false;
+        }
+        out << "]";
+    };
+
+    const char* sections[] = { "timers", "counters", "histograms" };
+    for (Kind kind : { Kind::Timer, Kind::Counter, Kind::Histogram }) {
+        out << ",\n" << '"' << sections[static_cast<int>(kind)] << "\": {";
+        bool firstMetric = true;
+        for (size_t i = 0; i < n; ++i) {
+            if (r.kinds[i] != kind) continue;
+            const Total& tot = totals[i];
+            out << (firstMetric ? "\n  " : ",\n  ");
+            writeString(out, r.names[i]);
+            out << ": ";
+            firstMetric = false;
+            if (kind == Kind::Counter) {
+                out << tot.sum;
+                continue;
+            }
+            // Таймеры — в микросекундах, гистограммы — в исходных единицах
+            double scale = kind == Kind::Timer ? 1e3 : 1.0;
+            out << "{\"count\":" << tot.count << ",\"total\":" << tot.sum / scale
+                << ",\"mean\":" << (tot.count ? tot.sum / scale / tot.count : 0.0)
+                << ",\"min\":" << (tot.count ? tot.min / scale : 0.0)
+                << ",\"max\":" << tot.max / scale << ",\"buckets\":";
+            writeBuckets(tot, scale);
+            out << "}";
+        }
+        out << (firstMetric ? "}" : "\n}");
+    }
+    out << ",\n\"units\": {\"timers\": \"us\"}\n}\n";
+}
+
+// Прогон с профилированием: пустой путь — взять из PROFILE, нет и его —
+// профилировщик остаётся выключенным. Файл пишется в деструкторе.
+class Session {
+    std::string path;
+
+public:
+    explicit Session(std::string file = {}) : path(std::move(file)) {
+        if (path.empty()) {
+            const char* env = std::getenv("PROFILE");
+            if (env) path = env;
+        }
+        if (path.empty()) return;
+        detail::Registry& r = detail::registry();
+        r.origin = detail::Clock::now();
+        r.tracing.store(true);
+        r.enabled.store(true);
+    }
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    bool active() const { return !path.empty(); }
+
+    ~Session() {
+        if (path.empty()) return;
+        detail::registry().enabled.store(false);
+        try {
+            std::ofstream out(path);
+            if (out) writeJson(out);
+            if (!out) std::cerr << "Не удалось записать профиль в " << path << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Не удалось записать профиль: " << e.what() << "\n";
+        }
+    }
+};
+
+} // namespace profiler
+
+#define PROFILER_CONCAT2(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT2(a, b)
+
+#ifdef PROFILER_DISABLED
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(name, n) ((void)sizeof(n))
+#define PROFILE_VALUE(name, v) ((void)sizeof(v))
+#else
+#define PROFILE_SCOPE(name)                                                                     \
+    static const uint32_t PROFILER_CONCAT(profileId_, __LINE__) =                               \
+        ::profiler::metric(name, ::profiler::Kind::Timer);                                      \
+    ::profiler::Scope PROFILER_CONCAT(profileScope_, __LINE__)(PROFILER_CONCAT(profileId_, __LINE__))
+#define PROFILE_COUNT(name, n)                                                                  \
+    do {                                                                                        \
+        static const uint32_t profileId = ::profiler::metric(name, ::profiler::Kind::Counter); \
+        ::profiler::add(profileId, static_cast<uint64_t>(n));                                   \
+    } while (0)
+#define PROFILE_VALUE(name, v)                                                                  \
+    do {                                                                                        \
+        static const uint32_t profileId = ::profiler::metric(name, ::profiler::Kind::Histogram); \
+        ::profiler::record(profileId, static_cast<uint64_t>(v));                                \
+    } while (0)
+#endif
@@ -1,5 +1,8 @@
 #include <iostream>
+#include <string>
+#include <stdexcept>
 #include <vector>
+#include <array>
 #include <cmath>
 #include <random>
 #include <memory>
@@ -7,101 +10,577 @@
 #include <chrono>
 #include <thread>
 #include <iomanip>
+#include <sstream>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cstddef>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "profiler.hpp"
+
+// Векторные ядра выбираются при компиляции: -mavx2 -mfma (или -march=native)
+// включает AVX2, на x86-64 по умолчанию доступен SSE2, иначе — скалярный код
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // Вектор 2D для физических вычислений
 struct Vec2 {
     double x, y;
-    
+
     Vec2(double x = 0, double y = 0) : x(x), y(y) {}
-    
+
     Vec2 operator+(const Vec2& v) const { return Vec2(x + v.x, y + v.y); }
     Vec2 operator-(const Vec2& v) const { return Vec2(x - v.x, y - v.y); }
     Vec2 operator*(double s) const { return Vec2(x * s, y * s); }
     Vec2 operator/(double s) const { return Vec2(x / s, y / s); }
-    
+
     double length() const { return std::sqrt(x * x + y * y); }
-    Vec2 normalize() const { 
+    Vec2 normalize() const {
         double len = length();
         return len > 0 ? Vec2(x / len, y / len) : Vec2(0, 0);
     }
     double dot(const Vec2& v) const { return x * v.x + y * v.y; }
 };
 
-// Базовый класс для частиц
+// Тип частицы — метка вместо виртуальной иерархии
+enum class ParticleKind : uint8_t {
+    Plain,
+    Heavy,
+    Charged
+};
+
+inline char particleSymbol(ParticleKind kind, double charge) {
+    switch (kind) {
+        case ParticleKind::Heavy: return 'O';
+        case ParticleKind::Charged: return charge > 0 ? '+' : '-';
+        default: return 'o';
+    }
+}
+
+// Частица — фасад для добавления и чтения отдельных частиц.
+// Сам симулятор хранит данные в ParticleStore.
 class Particle {
 protected:
     Vec2 pos, vel, acc;
     double mass, radius;
     int charge;
-    
+    ParticleKind kind;
+
+    Particle(Vec2 p, Vec2 v, double m, double r, int c, ParticleKind k)
+        : pos(p), vel(v), acc(0, 0), mass(m), radius(r), charge(c), kind(k) {}
+
 public:
-    Particle(Vec2 p, Vec2 v, double m, double r, int c = 0) 
-        : pos(p), vel(v), acc(0, 0), mass(m), radius(r), charge(c) {}
-    
+    Particle(Vec2 p, Vec2 v, double m, double r, int c = 0)
+        : Particle(p, v, m, r, c, ParticleKind::Plain) {}
+
     virtual ~Particle() = default;
-    
-    virtual void update(double dt) {
+
+    void update(double dt) {
         vel = vel + acc * dt;
         pos = pos + vel * dt;
         acc = Vec2(0, 0);
     }
-    
+
     void applyForce(const Vec2& force) {
         acc = acc + force / mass;
     }
-    
+
     Vec2 getPos() const { return pos; }
     Vec2 getVel() const { return vel; }
+    Vec2 getAcc() const { return acc; }
     double getMass() const { return mass; }
     double getRadius() const { return radius; }
     int getCharge() const { return charge; }
-    
-    virtual char getSymbol() const { return 'o'; }
+    ParticleKind getKind() const { return kind; }
+
+    char getSymbol() const { return particleSymbol(kind, charge); }
 };
 
 // Тяжёлая частица (с гравитацией)
 class HeavyParticle : public Particle {
 public:
-    HeavyParticle(Vec2 p, Vec2 v, double m, double r) 
-        : Particle(p, v, m, r, 0) {}
-    
-    char getSymbol() const override { return 'O'; }
+    HeavyParticle(Vec2 p, Vec2 v, double m, double r)
+        : Particle(p, v, m, r, 0, ParticleKind::Heavy) {}
 };
 
 // Заряженная частица (электромагнетизм)
 class ChargedParticle : public Particle {
 public:
-    ChargedParticle(Vec2 p, Vec2 v, double m, double r, int c) 
-        : Particle(p, v, m, r, c) {}
-    
-    char getSymbol() const override { return charge > 0 ? '+' : '-'; }
+    ChargedParticle(Vec2 p, Vec2 v, double m, double r, int c)
+        : Particle(p, v, m, r, c, ParticleKind::Charged) {}
+};
+
+// Частица нужного вида по сохранённым полям
+inline Particle makeParticle(ParticleKind kind, Vec2 p, Vec2 v, double m, double r, int c) {
+    switch (kind) {
+        case ParticleKind::Heavy: return HeavyParticle(p, v, m, r);
+        case ParticleKind::Charged: return ChargedParticle(p, v, m, r, c);
+        default: return Particle(p, v, m, r, c);
+    }
+}
+
+// Постоянная ссылка на частицу: индекс в хранилище меняется при удалении
+// соседей, а ручка — нет. Поколение отличает ручку удалённой частицы от
+// ручки новой, занявшей тот же слот.
+struct ParticleHandle {
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const ParticleHandle& o) const { return slot == o.slot && generation == o.generation; }
+    bool operator!=(const ParticleHandle& o) const { return !(*this == o); }
+};
+
+// Хранилище частиц в виде структуры массивов: каждое поле — непрерывный массив.
+// Частицы лежат плотно; удаление переносит последнюю частицу на место
+// удалённой, так что ёмкость столбцов и освободившиеся слоты ручек
+// переиспользуются следующими частицами без обращений к аллокатору.
+struct ParticleStore {
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
+    static constexpr size_t DOUBLE_COLUMNS = 9;
+
+    std::vector<double> x, y, vx, vy, ax, ay;
+    std::vector<double> mass, radius, charge;
+    std::vector<ParticleKind> kind;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void reserve(size_t n) {
+        for (auto* v : columns()) v->reserve(n);
+        kind.reserve(n);
+        slotOf.reserve(n);
+        slots.reserve(n);
+    }
+
+    void clear() {
+        for (auto* v : columns()) v->clear();
+        kind.clear();
+        resetHandles(nextGeneration());
+    }
+
+    // Индекс частицы по ручке; NO_INDEX, если частица уже удалена
+    uint32_t indexOf(ParticleHandle h) const {
+        if (h.slot >= slots.size() || slots[h.slot].generation != h.generation) return NO_INDEX;
+        return slots[h.slot].index;
+    }
+
+    ParticleHandle handle(size_t i) const {
+        return { slotOf[i], slots[slotOf[i]].generation };
+    }
+
+    ParticleHandle push(const Particle& p) {
+        x.push_back(p.getPos().x);
+        y.push_back(p.getPos().y);
+        vx.push_back(p.getVel().x);
+        vy.push_back(p.getVel().y);
+        ax.push_back(p.getAcc().x);
+        ay.push_back(p.getAcc().y);
+        mass.push_back(p.getMass());
+        radius.push_back(p.getRadius());
+        charge.push_back(p.getCharge());
+        kind.push_back(p.getKind());
+        return attach(static_cast<uint32_t>(size() - 1));
+    }
+
+    // Удаление за O(1): последняя частица переезжает на место i
+    void swapRemove(size_t i) {
+        const size_t last = size() - 1;
+        const uint32_t removed = slotOf[i];
+        if (i != last) {
+            for (auto* col : columns()) (*col)[i] = (*col)[last];
+            kind[i] = kind[last];
+            slotOf[i] = slotOf[last];
+            slots[slotOf[i]].index = static_cast<uint32_t>(i);
+        }
+        for (auto* col : columns()) col->pop_back();
+        kind.pop_back();
+        slotOf.pop_back();
+        detach(removed);
+    }
+
+    Vec2 pos(size_t i) const { return Vec2(x[i], y[i]); }
+
+    // Столбцы double без выделения памяти: вызывается на каждом удалении
+    std::array<std::vector<double>*, DOUBLE_COLUMNS> columns() {
+        return { &x, &y, &vx, &vy, &ax, &ay, &mass, &radius, &charge };
+    }
+
+    // Поколение, с которым не совпадает ни одна ручка, выданная этим хранилищем
+    uint32_t nextGeneration() const {
+        uint32_t g = baseGeneration;
+        for (const Slot& s : slots) g = std::max(g, s.generation + 1);
+        return g;
+    }
+
+    // Новые ручки 0..size()-1 для уже заполненных столбцов (после загрузки).
+    // Все слоты, в том числе созданные позже, начинают с поколения generation,
+    // так что старые ручки, выданные до сброса, не находят новых частиц
+    void resetHandles(uint32_t generation) {
+        baseGeneration = generation;
+        slots.clear();
+        freeSlots.clear();
+        slotOf.resize(size());
+        for (size_t i = 0; i < size(); ++i) {
+            slotOf[i] = static_cast<uint32_t>(i);
+            slots.push_back({ static_cast<uint32_t>(i), generation });
+        }
+    }
+
+private:
+    struct Slot {
+        uint32_t index;      // место частицы в столбцах
+        uint32_t generation; // растёт при каждом освобождении слота
+    };
+    std::vector<uint32_t> slotOf;    // слот каждой частицы
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots; // список свободных слотов
+    uint32_t baseGeneration = 0;     // поколение новых слотов
+
+    ParticleHandle attach(uint32_t index) {
+        uint32_t slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            slots[slot].index = index;
+        } else {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back({ index, baseGeneration });
+        }
+        slotOf.push_back(slot);
+        return { slot, slots[slot].generation };
+    }
+
+    void detach(uint32_t slot) {
+        slots[slot].index = NO_INDEX;
+        ++slots[slot].generation;
+        freeSlots.push_back(slot);
+    }
 };
 
-// Квадродерево для оптимизации столкновений
+// Векторные ядра сил и интегрирования
+namespace kernels {
+
+#if defined(__AVX2__)
+inline double hsum(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+#elif defined(__SSE2__)
+inline double hsum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+#endif
+
+// Вклад частицы j в суммы для частицы i (скалярный вариант)
+inline void pairTerm(double dx, double dy, double mj, double qj, double minDist2,
+                     double& gx, double& gy, double& cx, double& cy) {
+    double d2 = dx * dx + dy * dy;
+    if (d2 < minDist2) return;
+    double inv = 1.0 / std::sqrt(d2);
+    double inv3 = inv * inv * inv;
+    gx += mj * inv3 * dx;
+    gy += mj * inv3 * dy;
+    cx += qj * inv3 * dx;
+    cy += qj * inv3 * dy;
+}
+
+// Симметричный перебор пар (i, j > i) для строк [rowBegin, rowEnd): одно
+// вычисление расстояния даёт вклад и в i, и в j (третий закон Ньютона).
+// Суммы Σ m·r/|r|³ и Σ q·r/|r|³ копятся в буферы потока gx, gy, cx, cy
+// длины n; поток пишет и в чужие строки j, поэтому буферы у каждого свои.
+inline void pairSums(const ParticleStore& s, size_t rowBegin, size_t rowEnd, double minDist,
+                     double* gx, double* gy, double* cx, double* cy) {
+    const size_t n = s.size();
+    const double* px = s.x.data();
+    const double* py = s.y.data();
+    const double* pm = s.mass.data();
+    const double* pq = s.charge.data();
+    const double minDist2 = minDist * minDist;
+
+    for (size_t i = rowBegin; i < rowEnd; ++i) {
+        double sgx = 0, sgy = 0, scx = 0, scy = 0;
+        size_t j = i + 1;
+
+#if defined(__AVX2__)
+        const __m256d xi = _mm256_set1_pd(px[i]);
+        const __m256d yi = _mm256_set1_pd(py[i]);
+        const __m256d mi = _mm256_set1_pd(pm[i]);
+        const __m256d qi = _mm256_set1_pd(pq[i]);
+        const __m256d lim = _mm256_set1_pd(minDist2);
+        const __m256d one = _mm256_set1_pd(1.0);
+        __m256d vgx = _mm256_setzero_pd(), vgy = _mm256_setzero_pd();
+        __m256d vcx = _mm256_setzero_pd(), vcy = _mm256_setzero_pd();
+        for (; j + 4 <= n; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(px + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(py + j), yi);
+            __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d mask = _mm256_cmp_pd(d2, lim, _CMP_GE_OQ);
+            __m256d inv = _mm256_div_pd(one, _mm256_sqrt_pd(d2));
+            __m256d inv3 = _mm256_and_pd(_mm256_mul_pd(_mm256_mul_pd(inv, inv), inv), mask);
+            __m256d wm = _mm256_mul_pd(_mm256_loadu_pd(pm + j), inv3);
+            __m256d wq = _mm256_mul_pd(_mm256_loadu_pd(pq + j), inv3);
+            vgx = _mm256_add_pd(vgx, _mm256_mul_pd(wm, dx));
+            vgy = _mm256_add_pd(vgy, _mm256_mul_pd(wm, dy));
+            vcx = _mm256_add_pd(vcx, _mm256_mul_pd(wq, dx));
+            vcy = _mm256_add_pd(vcy, _mm256_mul_pd(wq, dy));
+            __m256d rm = _mm256_mul_pd(mi, inv3);
+            __m256d rq = _mm256_mul_pd(qi, inv3);
+            _mm256_storeu_pd(gx + j, _mm256_sub_pd(_mm256_loadu_pd(gx + j), _mm256_mul_pd(rm, dx)));
+            _mm256_storeu_pd(gy + j, _mm256_sub_pd(_mm256_loadu_pd(gy + j), _mm256_mul_pd(rm, dy)));
+            _mm256_storeu_pd(cx + j, _mm256_sub_pd(_mm256_loadu_pd(cx + j), _mm256_mul_pd(rq, dx)));
+            _mm256_storeu_pd(cy + j, _mm256_sub_pd(_mm256_loadu_pd(cy + j), _mm256_mul_pd(rq, dy)));
+        }
+        sgx = hsum(vgx); sgy = hsum(vgy);
+        scx = hsum(vcx); scy = hsum(vcy);
+#elif defined(__SSE2__)
+        const __m128d xi = _mm_set1_pd(px[i]);
+        const __m128d yi = _mm_set1_pd(py[i]);
+        const __m128d mi = _mm_set1_pd(pm[i]);
+        const __m128d qi = _mm_set1_pd(pq[i]);
+        const __m128d lim = _mm_set1_pd(minDist2);
+        const __m128d one = _mm_set1_pd(1.0);
+        __m128d vgx = _mm_setzero_pd(), vgy = _mm_setzero_pd();
+        __m128d vcx = _mm_setzero_pd(), vcy = _mm_setzero_pd();
+        for (; j + 2 <= n; j += 2) {
+            __m128d dx = _mm_sub_pd(_mm_loadu_pd(px + j), xi);
+            __m128d dy = _mm_sub_pd(_mm_loadu_pd(py + j), yi);
+            __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+            __m128d mask = _mm_cmpge_pd(d2, lim);
+            __m128d inv = _mm_div_pd(one, _mm_sqrt_pd(d2));
+            __m128d inv3 = _mm_and_pd(_mm_mul_pd(_mm_mul_pd(inv, inv), inv), mask);
+            __m128d wm = _mm_mul_pd(_mm_loadu_pd(pm + j), inv3);
+            __m128d wq = _mm_mul_pd(_mm_loadu_pd(pq + j), inv3);
+            vgx = _mm_add_pd(vgx, _mm_mul_pd(wm, dx));
+            vgy = _mm_add_pd(vgy, _mm_mul_pd(wm, dy));
+            vcx = _mm_add_pd(vcx, _mm_mul_pd(wq, dx));
+            vcy = _mm_add_pd(vcy, _mm_mul_pd(wq, dy));
+            __m128d rm = _mm_mul_pd(mi, inv3);
+            __m128d rq = _mm_mul_pd(qi, inv3);
+            _mm_storeu_pd(gx + j, _mm_sub_pd(_mm_loadu_pd(gx + j), _mm_mul_pd(rm, dx)));
+            _mm_storeu_pd(gy + j, _mm_sub_pd(_mm_loadu_pd(gy + j), _mm_mul_pd(rm, dy)));
+            _mm_storeu_pd(cx + j, _mm_sub_pd(_mm_loadu_pd(cx + j), _mm_mul_pd(rq, dx)));
+            _mm_storeu_pd(cy + j, _mm_sub_pd(_mm_loadu_pd(cy + j), _mm_mul_pd(rq, dy)));
+        }
+        sgx = hsum(vgx); sgy = hsum(vgy);
+        scx = hsum(vcx); scy = hsum(vcy);
+#endif
+        for (; j < n; ++j) {
+            double dx = px[j] - px[i], dy = py[j] - py[i];
+            double d2 = dx * dx + dy * dy;
+            if (d2 < minDist2) continue;
+            double inv = 1.0 / std::sqrt(d2);
+            double inv3 = inv * inv * inv;
+            sgx += pm[j] * inv3 * dx;
+            sgy += pm[j] * inv3 * dy;
+            scx += pq[j] * inv3 * dx;
+            scy += pq[j] * inv3 * dy;
+            gx[j] -= pm[i] * inv3 * dx;
+            gy[j] -= pm[i] * inv3 * dy;
+            cx[j] -= pq[i] * inv3 * dx;
+            cy[j] -= pq[i] * inv3 * dy;
+        }
+        gx[i] += sgx;
+        gy[i] += sgy;
+        cx[i] += scx;
+        cy[i] += scy;
+    }
+}
+
+// Начало строк каждого потока в треугольнике пар: строка i даёт n−1−i пар,
+// так что первые строки длиннее и делить их надо поровну по парам, а не по
+// строкам. rows[w]..rows[w+1] — строки потока w
+inline void balancePairRows(size_t n, unsigned threads, std::vector<size_t>& rows) {
+    rows.assign(threads + 1, n);
+    rows[0] = 0;
+    const double total = 0.5 * double(n) * double(n > 0 ? n - 1 : 0);
+    size_t i = 0;
+    double before = 0; // пар в строках до i
+    for (unsigned w = 1; w < threads; ++w) {
+        const double target = total * w / threads;
+        while (i < n && before < target) before += double(n - 1 - i++);
+        rows[w] = i;
+    }
+}
+
+// Явный Эйлер для частиц [begin, end) и пружины стен, которые
+// складываются в ускорение следующего шага
+inline void integrateWithWalls(ParticleStore& s, size_t begin, size_t end, double dt,
+                               double width, double height, double stiffness) {
+    double* px = s.x.data();
+    double* py = s.y.data();
+    double* pvx = s.vx.data();
+    double* pvy = s.vy.data();
+    double* pax = s.ax.data();
+    double* pay = s.ay.data();
+    const double* pm = s.mass.data();
+    const double* pr = s.radius.data();
+    size_t i = begin;
+
+#if defined(__AVX2__)
+    const __m256d vdt = _mm256_set1_pd(dt);
+    const __m256d vw = _mm256_set1_pd(width);
+    const __m256d vh = _mm256_set1_pd(height);
+    const __m256d vk = _mm256_set1_pd(stiffness);
+    const __m256d zero = _mm256_setzero_pd();
+    for (; i + 4 <= end; i += 4) {
+        __m256d vx = _mm256_add_pd(_mm256_loadu_pd(pvx + i), _mm256_mul_pd(_mm256_loadu_pd(pax + i), vdt));
+        __m256d vy = _mm256_add_pd(_mm256_loadu_pd(pvy + i), _mm256_mul_pd(_mm256_loadu_pd(pay + i), vdt));
+        __m256d x = _mm256_add_pd(_mm256_loadu_pd(px + i), _mm256_mul_pd(vx, vdt));
+        __m256d y = _mm256_add_pd(_mm256_loadu_pd(py + i), _mm256_mul_pd(vy, vdt));
+        __m256d r = _mm256_loadu_pd(pr + i);
+        __m256d km = _mm256_div_pd(vk, _mm256_loadu_pd(pm + i));
+        __m256d fx = _mm256_add_pd(_mm256_max_pd(_mm256_sub_pd(r, x), zero),
+                                   _mm256_min_pd(_mm256_sub_pd(_mm256_sub_pd(vw, r), x), zero));
+        __m256d fy = _mm256_add_pd(_mm256_max_pd(_mm256_sub_pd(r, y), zero),
+                                   _mm256_min_pd(_mm256_sub_pd(_mm256_sub_pd(vh, r), y), zero));
+        _mm256_storeu_pd(pvx + i, vx);
+        _mm256_storeu_pd(pvy + i, vy);
+        _mm256_storeu_pd(px + i, x);
+        _mm256_storeu_pd(py + i, y);
+        _mm256_storeu_pd(pax + i, _mm256_mul_pd(fx, km));
+        _mm256_storeu_pd(pay + i, _mm256_mul_pd(fy, km));
+    }
+#elif defined(__SSE2__)
+    const __m128d vdt = _mm_set1_pd(dt);
+    const __m128d vw = _mm_set1_pd(width);
+    const __m128d vh = _mm_set1_pd(height);
+    const __m128d vk = _mm_set1_pd(stiffness);
+    const __m128d zero = _mm_setzero_pd();
+    for (; i + 2 <= end; i += 2) {
+        __m128d vx = _mm_add_pd(_mm_loadu_pd(pvx + i), _mm_mul_pd(_mm_loadu_pd(pax + i), vdt));
+        __m128d vy = _mm_add_pd(_mm_loadu_pd(pvy + i), _mm_mul_pd(_mm_loadu_pd(pay + i), vdt));
+        __m128d x = _mm_add_pd(_mm_loadu_pd(px + i), _mm_mul_pd(vx, vdt));
+        __m128d y = _mm_add_pd(_mm_loadu_pd(py + i), _mm_mul_pd(vy, vdt));
+        __m128d r = _mm_loadu_pd(pr + i);
+        __m128d km = _mm_div_pd(vk, _mm_loadu_pd(pm + i));
+        __m128d fx = _mm_add_pd(_mm_max_pd(_mm_sub_pd(r, x), zero),
+                                _mm_min_pd(_mm_sub_pd(_mm_sub_pd(vw, r), x), zero));
+        __m128d fy = _mm_add_pd(_mm_max_pd(_mm_sub_pd(r, y), zero),
+                                _mm_min_pd(_mm_sub_pd(_mm_sub_pd(vh, r), y), zero));
+        _mm_storeu_pd(pvx + i, vx);
+        _mm_storeu_pd(pvy + i, vy);
+        _mm_storeu_pd(px + i, x);
+        _mm_storeu_pd(py + i, y);
+        _mm_storeu_pd(pax + i, _mm_mul_pd(fx, km));
+        _mm_storeu_pd(pay + i, _mm_mul_pd(fy, km));
+    }
+#endif
+    for (; i < end; ++i) {
+        pvx[i] += pax[i] * dt;
+        pvy[i] += pay[i] * dt;
+        px[i] += pvx[i] * dt;
+        py[i] += pvy[i] * dt;
+
+        // Столкновения со стенами
+        double r = pr[i];
+        double fx = std::max(r - px[i], 0.0) + std::min(width - r - px[i], 0.0);
+        double fy = std::max(r - py[i], 0.0) + std::min(height - r - py[i], 0.0);
+        double km = stiffness / pm[i];
+        pax[i] = fx * km;
+        pay[i] = fy * km;
+    }
+}
+
+// y[i] += h·x[i] — общий шаг «толчка» (v += a·h) и «сдвига» (x += v·h)
+inline void axpy(double* y, const double* x, double h, size_t begin, size_t end) {
+    size_t i = begin;
+#if defined(__AVX2__)
+    const __m256d vh = _mm256_set1_pd(h);
+    for (; i + 4 <= end; i += 4) {
+        __m256d r = _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(_mm256_loadu_pd(x + i), vh));
+        _mm256_storeu_pd(y + i, r);
+    }
+#elif defined(__SSE2__)
+    const __m128d vh = _mm_set1_pd(h);
+    for (; i + 2 <= end; i += 2) {
+        __m128d r = _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(_mm_loadu_pd(x + i), vh));
+        _mm_storeu_pd(y + i, r);
+    }
+#endif
+    for (; i < end; ++i) y[i] += x[i] * h;
+}
+
+// Добавляет ускорения от пружин стен для частиц [begin, end)
+inline void wallAccelerations(ParticleStore& s, size_t begin, size_t end,
+                              double width, double height, double stiffness) {
+    for (size_t i = begin; i < end; ++i) {
+        double r = s.radius[i];
+        double fx = std::max(r - s.x[i], 0.0) + std::min(width - r - s.x[i], 0.0);
+        double fy = std::max(r - s.y[i], 0.0) + std::min(height - r - s.y[i], 0.0);
+        double km = stiffness / s.mass[i];
+        s.ax[i] += fx * km;
+        s.ay[i] += fy * km;
+    }
+}
+
+} // namespace kernels
+
+// Квадродерево Барнса–Хата: узел хранит суммарную массу, центр масс и заряд
 struct QuadTreeNode {
+    static constexpr size_t LEAF_CAPACITY = 4;
+    static constexpr double MIN_SIZE = 1.0;
+
     Vec2 center;
-    double size;
-    std::vector<Particle*> particles;
+    double size; // половина стороны квадрата
+    std::vector<uint32_t> particles; // индексы в ParticleStore
     std::unique_ptr<QuadTreeNode> children[4];
-    
+
+    double mass = 0;
+    Vec2 centerOfMass;
+    // Положительный и отрицательный заряды — две точки в своих центрах.
+    // Вместе они дают и суммарный заряд, и дипольный момент узла, поэтому
+    // нейтральная пара зарядов издали не выглядит пустой
+    double positiveCharge = 0;
+    double negativeCharge = 0; // не больше нуля
+    Vec2 centerOfPositive, centerOfNegative;
+
     QuadTreeNode(Vec2 c, double s) : center(c), size(s) {}
-    
+
     bool contains(const Vec2& p) const {
-        return std::abs(p.x - center.x) <= size && 
+        return std::abs(p.x - center.x) <= size &&
                std::abs(p.y - center.y) <= size;
     }
-    
-    void insert(Particle* p) {
-        if (!contains(p->getPos())) return;
-        
-        if (particles.size() < 4 || size < 1.0) {
-            particles.push_back(p);
-        } else {
-            if (!children[0]) subdivide();
-            for (auto& child : children) child->insert(p);
+
+    bool isLeaf() const { return !children[0]; }
+
+    int quadrant(const Vec2& p) const {
+        return (p.x >= center.x ? 1 : 0) + (p.y >= center.y ? 2 : 0);
+    }
+
+    void insert(const ParticleStore& s, uint32_t i) {
+        if (!contains(s.pos(i))) return;
+
+        if (isLeaf()) {
+            if (particles.size() < LEAF_CAPACITY || size < MIN_SIZE) {
+                particles.push_back(i);
+                return;
+            }
+            // Переполненный лист делится, частицы уходят вниз
+            subdivide();
+            for (uint32_t q : particles) children[quadrant(s.pos(q))]->insert(s, q);
+            particles.clear();
         }
+        children[quadrant(s.pos(i))]->insert(s, i);
     }
-    
+
     void subdivide() {
         double hs = size / 2;
         children[0].reset(new QuadTreeNode(Vec2(center.x - hs, center.y - hs), hs));
@@ -109,157 +588,2005 @@ struct QuadTreeNode {
         children[2].reset(new QuadTreeNode(Vec2(center.x - hs, center.y + hs), hs));
         children[3].reset(new QuadTreeNode(Vec2(center.x + hs, center.y + hs), hs));
     }
+
+    // Индексы частиц в порядке обхода листьев: соседи в пространстве идут подряд
+    void collectOrder(std::vector<uint32_t>& out) const {
+        if (isLeaf()) {
+            out.insert(out.end(), particles.begin(), particles.end());
+            return;
+        }
+        for (const auto& child : children) child->collectOrder(out);
+    }
+
+    // Пересчёт агрегированных величин снизу вверх
+    void computeMoments(const ParticleStore& s) {
+        mass = positiveCharge = negativeCharge = 0;
+        Vec2 weightedPos, positivePos, negativePos;
+
+        if (isLeaf()) {
+            for (uint32_t i : particles) {
+                double q = s.charge[i];
+                mass += s.mass[i];
+                weightedPos = weightedPos + s.pos(i) * s.mass[i];
+                if (q > 0) {
+                    positiveCharge += q;
+                    positivePos = positivePos + s.pos(i) * q;
+                } else if (q < 0) {
+                    negativeCharge += q;
+                    negativePos = negativePos + s.pos(i) * q;
+                }
+            }
+        } else {
+            for (auto& child : children) {
+                child->computeMoments(s);
+                mass += child->mass;
+                positiveCharge += child->positiveCharge;
+                negativeCharge += child->negativeCharge;
+                weightedPos = weightedPos + child->centerOfMass * child->mass;
+                positivePos = positivePos + child->centerOfPositive * child->positiveCharge;
+                negativePos = negativePos + child->centerOfNegative * child->negativeCharge;
+            }
+        }
+
+        centerOfMass = mass > 0 ? weightedPos / mass : center;
+        centerOfPositive = positiveCharge > 0 ? positivePos / positiveCharge : center;
+        centerOfNegative = negativeCharge < 0 ? negativePos / negativeCharge : center;
+    }
 };
 
-// Основной симулятор
-class PhysicsSimulator {
-private:
-    std::vector<std::unique_ptr<Particle>> particles;
-    double width, height;
-    double gravity, coulomb, damping;
-    std::mt19937 rng;
-    
+// Равномерная сетка для широкой фазы столкновений.
+// Частица перекладывается в другую ячейку только при её смене,
+// поэтому шаг обходится O(N) без перестройки с нуля.
+class SpatialHashGrid {
+    double cellSize = 1.0;
+    int cols = 1, rows = 1;
+    std::vector<std::vector<uint32_t>> cells;
+    std::vector<int> cellOf;      // ячейка каждой частицы
+    std::vector<uint32_t> slotOf; // позиция частицы внутри ячейки
+    std::vector<int> occupied;    // непустые ячейки
+    std::vector<int> occupiedSlot; // позиция ячейки в occupied или -1
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+
+    int cellIndex(const Vec2& p) const {
+        int cx = 0, cy = 0;
+        if (std::isfinite(p.x)) {
+            cx = static_cast<int>(std::max(0.0, std::min(std::floor(p.x / cellSize), double(cols - 1))));
+        }
+        if (std::isfinite(p.y)) {
+            cy = static_cast<int>(std::max(0.0, std::min(std::floor(p.y / cellSize), double(rows - 1))));
+        }
+        return cy * cols + cx;
+    }
+
+    void unlink(uint32_t i) {
+        auto& cell = cells[cellOf[i]];
+        uint32_t lastParticle = cell.back();
+        cell[slotOf[i]] = lastParticle;
+        slotOf[lastParticle] = slotOf[i];
+        cell.pop_back();
+        if (cell.empty()) {
+            int c = cellOf[i];
+            int lastCell = occupied.back();
+            occupied[occupiedSlot[c]] = lastCell;
+            occupiedSlot[lastCell] = occupiedSlot[c];
+            occupied.pop_back();
+            occupiedSlot[c] = -1;
+        }
+    }
+
+    void link(uint32_t i, int c) {
+        cellOf[i] = c;
+        if (cells[c].empty()) {
+            occupiedSlot[c] = static_cast<int>(occupied.size());
+            occupied.push_back(c);
+        }
+        slotOf[i] = static_cast<uint32_t>(cells[c].size());
+        cells[c].push_back(i);
+    }
+
+    void addCellPairs(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+        for (uint32_t i : a)
+            for (uint32_t j : b) pairs.emplace_back(std::min(i, j), std::max(i, j));
+    }
+
 public:
-    PhysicsSimulator(double w, double h) 
-        : width(w), height(h), gravity(100.0), coulomb(5000.0), damping(0.99) {
-        rng.seed(std::random_device{}());
+    // Ячейка должна быть не меньше максимального диаметра частицы
+    void configure(double width, double height, double cell) {
+        // Ограничиваем число ячеек, чтобы мелкие частицы не раздували таблицу
+        const double MAX_CELLS = 1 << 22;
+        cellSize = std::max({cell, std::sqrt(width * height / MAX_CELLS), 1e-3});
+        cols = std::max(1, static_cast<int>(std::ceil(width / cellSize)));
+        rows = std::max(1, static_cast<int>(std::ceil(height / cellSize)));
+        cells.assign(static_cast<size_t>(cols) * rows, {});
+        occupied.clear();
+        occupiedSlot.assign(cells.size(), -1);
+        cellOf.clear();
+        slotOf.clear();
     }
-    
-    void addParticle(std::unique_ptr<Particle> p) {
-        particles.push_back(std::move(p));
+
+    bool isConfigured() const { return !cells.empty(); }
+    double getCellSize() const { return cellSize; }
+    size_t size() const { return cellOf.size(); }
+
+    // Забывает частицы с индексами от n: после удаления из хранилища их
+    // индексы освобождаются, а на место удалённых move() кладёт перенесённые
+    void truncate(size_t n) {
+        for (size_t i = n; i < cellOf.size(); ++i) {
+            if (cellOf[i] >= 0) unlink(static_cast<uint32_t>(i));
+        }
+        if (n < cellOf.size()) {
+            cellOf.resize(n);
+            slotOf.resize(n);
+        }
     }
-    
-    void update(double dt) {
-        // Гравитация и электростатика
-        for (size_t i = 0; i < particles.size(); ++i) {
-            for (size_t j = i + 1; j < particles.size(); ++j) {
-                Vec2 diff = particles[j]->getPos() - particles[i]->getPos();
-                double dist = diff.length();
-                
-                if (dist < 0.1) continue;
-                
-                Vec2 dir = diff.normalize();
-                
-                // Гравитация (притяжение)
-                double gravForce = gravity * particles[i]->getMass() * 
-                                   particles[j]->getMass() / (dist * dist);
-                particles[i]->applyForce(dir * gravForce);
-                particles[j]->applyForce(dir * (-gravForce));
-                
-                // Кулоновская сила (отталкивание/притяжение)
-                if (particles[i]->getCharge() != 0 && particles[j]->getCharge() != 0) {
-                    double coulombForce = coulomb * particles[i]->getCharge() * 
-                                          particles[j]->getCharge() / (dist * dist);
-                    particles[i]->applyForce(dir * (-coulombForce));
-                    particles[j]->applyForce(dir * coulombForce);
-                }
-            }
+
+    void move(uint32_t i, const Vec2& p) {
+        int c = cellIndex(p);
+        if (i >= cellOf.size()) {
+            cellOf.resize(i + 1, -1);
+            slotOf.resize(i + 1, 0);
         }
-        
-        // Обновление позиций и обработка столкновений
-        for (auto& p : particles) {
-            p->update(dt);
-            
-            Vec2 pos = p->getPos();
-            Vec2 vel = p->getVel();
-            
-            // Столкновения со стенами
-            if (pos.x < p->getRadius()) {
-                p->applyForce(Vec2((p->getRadius() - pos.x) * 1000, 0));
-            }
-            if (pos.x > width - p->getRadius()) {
-                p->applyForce(Vec2((width - p->getRadius() - pos.x) * 1000, 0));
-            }
-            if (pos.y < p->getRadius()) {
-                p->applyForce(Vec2(0, (p->getRadius() - pos.y) * 1000));
-            }
-            if (pos.y > height - p->getRadius()) {
-                p->applyForce(Vec2(0, (height - p->getRadius() - pos.y) * 1000));
+        if (cellOf[i] == c) return;
+        if (cellOf[i] >= 0) unlink(i);
+        link(i, c);
+    }
+
+    // Пары из соседних ячеек; каждая пара выдаётся ровно один раз
+    const std::vector<std::pair<uint32_t, uint32_t>>& candidatePairs() {
+        pairs.clear();
+        // Обходим только непустые ячейки: их не больше, чем частиц
+        for (int c : occupied) {
+            const int cx = c % cols, cy = c / cols;
+            const auto& cell = cells[c];
+
+            for (size_t a = 0; a < cell.size(); ++a)
+                for (size_t b = a + 1; b < cell.size(); ++b)
+                    pairs.emplace_back(std::min(cell[a], cell[b]), std::max(cell[a], cell[b]));
+
+            // Половина окрестности: восток, юго-запад, юг, юго-восток
+            if (cx + 1 < cols) addCellPairs(cell, cells[c + 1]);
+            if (cy + 1 < rows) {
+                if (cx > 0) addCellPairs(cell, cells[c + cols - 1]);
+                addCellPairs(cell, cells[c + cols]);
+                if (cx + 1 < cols) addCellPairs(cell, cells[c + cols + 1]);
             }
         }
-        
-        // Столкновения между частицами
-        for (size_t i = 0; i < particles.size(); ++i) {
-            for (size_t j = i + 1; j < particles.size(); ++j) {
-                Vec2 diff = particles[j]->getPos() - particles[i]->getPos();
-                double dist = diff.length();
-                double minDist = particles[i]->getRadius() + particles[j]->getRadius();
-                
-                if (dist < minDist) {
-                    Vec2 dir = diff.normalize();
-                    double overlap = minDist - dist;
-                    
-                    particles[i]->applyForce(dir * (-overlap * 500));
-                    particles[j]->applyForce(dir * (overlap * 500));
-                }
+        return pairs;
+    }
+};
+
+// Постоянный пул потоков. Вызывающий поток работает как исполнитель 0,
+// диапазоны делятся статически, поэтому разбиение зависит только от числа потоков.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::function<void(unsigned)> job;
+    uint64_t generation = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+    std::exception_ptr failure; // первое исключение исполнителя в текущем задании
+
+    // seen — поколение на момент запуска: задания до него не для этого потока
+    void workerLoop(unsigned index, uint64_t seen) {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                job(index);
+            } catch (...) {
+                error = std::current_exception();
             }
+
+            lock.lock();
+            if (error && !failure) failure = error;
+            if (--pending == 0) done.notify_one();
         }
     }
-    
-    void render() const {
-        // Очистка экрана
-        std::cout << "\033[2J\033[H";
-        
-        // Создание буфера для рендеринга
-        const int w = static_cast<int>(width);
-        const int h = static_cast<int>(height);
-        std::vector<std::vector<char>> buffer(h, std::vector<char>(w, ' '));
-        
-        // Отрисовка границ
-        for (int x = 0; x < w; ++x) {
-            buffer[0][x] = '-';
-            buffer[h-1][x] = '-';
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
-        for (int y = 0; y < h; ++y) {
-            buffer[y][0] = '|';
-            buffer[y][w-1] = '|';
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+        workers.clear();
+        stopping = false;
+        job = nullptr;
+    }
+
+public:
+    explicit ThreadPool(unsigned threads = 1) { resize(threads); }
+    ~ThreadPool() { stop(); }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    void resize(unsigned threads) {
+        threads = std::max(1u, threads);
+        if (threads == size()) return;
+        stop();
+        for (unsigned i = 1; i < threads; ++i) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, i, generation);
         }
-        
-        // Отрисовка частиц
-        for (const auto& p : particles) {
-            Vec2 pos = p->getPos();
-            int x = static_cast<int>(pos.x);
-            int y = static_cast<int>(pos.y);
-            
-            if (x >= 0 && x < w && y >= 0 && y < h) {
-                buffer[y][x] = p->getSymbol();
-            }
+    }
+
+    // Выполняет fn(worker) на каждом исполнителе и ждёт завершения всех.
+    // Исключение, своё или исполнителя, пробрасывается только после того,
+    // как задание закончили все: иначе они работали бы с кадром fn, которого
+    // уже нет
+    void run(const std::function<void(unsigned)>& fn) {
+        if (workers.empty()) {
+            fn(0);
+            return;
         }
-        
-        // Вывод буфера
-        for (const auto& row : buffer) {
-            for (char c : row) std::cout << c;
-            std::cout << '\n';
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = fn;
+            pending = static_cast<unsigned>(workers.size());
+            failure = nullptr;
+            ++generation;
         }
-        
-        std::cout << "\nЧастиц: " << particles.size() 
-                  << " | FPS: ~60 | ESC для выхода\n";
-    }
-    
-    void generateRandomParticles(int count) {
-        std::uniform_real_distribution<> posX(5, width - 5);
-        std::uniform_real_distribution<> posY(5, height - 5);
-        std::uniform_real_distribution<> vel(-20, 20);
-        std::uniform_int_distribution<> type(0, 2);
-        
-        for (int i = 0; i < count; ++i) {
-            Vec2 p(posX(rng), posY(rng));
-            Vec2 v(vel(rng), vel(rng));
-            
-            int t = type(rng);
-            if (t == 0) {
-                addParticle(std::unique_ptr<Particle>(new Particle(p, v, 1.0, 0.5, 0)));
-            } else if (t == 1) {
-                addParticle(std::unique_ptr<Particle>(new HeavyParticle(p, v, 5.0, 1.0)));
-            } else {
-                int charge = (i % 2 == 0) ? 1 : -1;
-                addParticle(std::unique_ptr<Particle>(new ChargedParticle(p, v, 1.0, 0.5, charge)));
-            }
+        wake.notify_all();
+
+        std::exception_ptr error;
+        try {
+            fn(0);
+        } catch (...) {
+            error = std::current_exception();
         }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return pending == 0; });
+        if (!error) error = failure;
+        failure = nullptr;
+        lock.unlock();
+        if (error) std::rethrow_exception(error);
+    }
+
+    // fn(begin, end, worker) для равных смежных кусков [0, count).
+    // Границы кратны grain, чтобы векторные ядра не зависели от разбиения.
+    template <class Fn>
+    void parallelFor(size_t count, Fn fn, size_t grain = 8) {
+        const unsigned n = size();
+        const size_t blocks = (count + grain - 1) / grain;
+        run([&](unsigned worker) {
+            size_t begin = std::min(count, blocks * worker / n * grain);
+            size_t end = std::min(count, blocks * (worker + 1) / n * grain);
+            if (begin < end) fn(begin, end, worker);
+        });
     }
 };
 
-int main() {
+// Двоичная траектория: заголовок, кадры (позиции и скорости), индекс кадров.
+// Кадр хранит столбцы x, y, vx, vy целиком. В режиме квантования значения
+// пишутся как int32 с шагом posStep/velStep, а с дельта-кодированием — как
+// zigzag-varint разности с предыдущим кадром; каждые keyframeInterval кадров
+// (и при смене числа частиц) пишется опорный кадр.
+namespace trajectory {
+
+constexpr char MAGIC[4] = { 'P', 'T', 'R', 'J' };
+constexpr char INDEX_MAGIC[4] = { 'P', 'T', 'R', 'I' };
+constexpr uint32_t VERSION = 1;
+
+enum Flags : uint32_t {
+    QUANTIZED = 1u << 0,
+    DELTA = 1u << 1
+};
+
+enum FrameType : uint8_t {
+    KEY_FRAME = 0,
+    DELTA_FRAME = 1
+};
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t keyframeInterval;
+    double width, height;
+    double posStep, velStep;
+};
+
+struct FrameHeader {
+    double time;
+    uint32_t count;
+    uint8_t type;
+    uint8_t reserved[3];
+};
+
+struct IndexTail {
+    uint64_t indexOffset;
+    uint64_t frameCount;
+    char magic[4];
+    uint32_t reserved;
+};
+
+inline uint32_t zigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1)); }
+
+inline int32_t quantize(double v, double step) {
+    double q = std::round(v / step);
+    return static_cast<int32_t>(std::max(-2147483647.0, std::min(2147483647.0, q)));
+}
+
+} // namespace trajectory
+
+// Кадр траектории в памяти
+struct TrajectoryFrame {
+    double time = 0;
+    std::vector<double> x, y, vx, vy;
+
+    size_t size() const { return x.size(); }
+};
+
+struct TrajectoryOptions {
+    bool quantize = false;
+    bool delta = false;          // требует quantize
+    double posStep = 1e-3;
+    double velStep = 1e-3;
+    uint32_t keyframeInterval = 64;
+    size_t maxPending = 64;      // кадров в очереди, прежде чем push начнёт ждать диск
+};
+
+// Запись траектории из фонового потока: push() только копирует столбцы
+// в переиспользуемый буфер, кодирование и запись идут в отдельном потоке
+class TrajectoryWriter {
+    std::FILE* file;
+    trajectory::Header header;
+    TrajectoryOptions options;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable ready, drained;
+    std::deque<std::unique_ptr<TrajectoryFrame>> queue;
+    std::vector<std::unique_ptr<TrajectoryFrame>> freeFrames;
+    bool closing = false;
+    bool failed = false;
+
+    // Состояние потока записи
+    std::vector<uint64_t> offsets;
+    std::vector<int32_t> previous;
+    std::vector<int32_t> current;
+    std::vector<uint8_t> encoded;
+    uint64_t position = 0;
+
+    void writeBytes(const void* data, size_t size) {
+        if (std::fwrite(data, 1, size, file) != size) {
+            throw std::runtime_error("Ошибка записи траектории");
+        }
+        position += size;
+        PROFILE_COUNT("trajectory_bytes", size);
+    }
+
+    void putVarint(uint32_t v) {
+        while (v >= 0x80) {
+            encoded.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        encoded.push_back(static_cast<uint8_t>(v));
+    }
+
+    void encode(const TrajectoryFrame& f) {
+        using namespace trajectory;
+        const size_t n = f.size();
+        FrameHeader fh{};
+        fh.time = f.time;
+        fh.count = static_cast<uint32_t>(n);
+        encoded.clear();
+
+        if (!options.quantize) {
+            fh.type = KEY_FRAME;
+            encoded.resize(sizeof(fh) + 4 * n * sizeof(double));
+            uint8_t* out = encoded.data() + sizeof(fh);
+            for (const auto* col : { &f.x, &f.y, &f.vx, &f.vy }) {
+                std::memcpy(out, col->data(), n * sizeof(double));
+                out += n * sizeof(double);
+            }
+            std::memcpy(encoded.data(), &fh, sizeof(fh));
+            return;
+        }
+
+        current.resize(4 * n);
+        for (size_t i = 0; i < n; ++i) {
+            current[i] = quantize(f.x[i], options.posStep);
+            current[n + i] = quantize(f.y[i], options.posStep);
+            current[2 * n + i] = quantize(f.vx[i], options.velStep);
+            current[3 * n + i] = quantize(f.vy[i], options.velStep);
+        }
+
+        bool key = !options.delta || previous.size() != current.size() ||
+                   offsets.size() % options.keyframeInterval == 0;
+        fh.type = key ? KEY_FRAME : DELTA_FRAME;
+        encoded.resize(sizeof(fh));
+        std::memcpy(encoded.data(), &fh, sizeof(fh));
+
+        if (key) {
+            size_t at = encoded.size();
+            encoded.resize(at + current.size() * sizeof(int32_t));
+            std::memcpy(encoded.data() + at, current.data(), current.size() * sizeof(int32_t));
+        } else {
+            for (size_t i = 0; i < current.size(); ++i) {
+                putVarint(zigzag(static_cast<int32_t>(static_cast<uint32_t>(current[i]) -
+                                                      static_cast<uint32_t>(previous[i]))));
+            }
+        }
+        previous.swap(current);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            ready.wait(lock, [&] { return closing || !queue.empty(); });
+            if (queue.empty()) break;
+
+            std::unique_ptr<TrajectoryFrame> frame = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            bool ok = true;
+            try {
+                PROFILE_SCOPE("trajectory_write");
+                encode(*frame);
+                offsets.push_back(position);
+                writeBytes(encoded.data(), encoded.size());
+            } catch (const std::exception&) {
+                ok = false;
+            }
+
+            lock.lock();
+            if (!ok) failed = true;
+            freeFrames.push_back(std::move(frame));
+            drained.notify_all();
+        }
+    }
+
+public:
+    TrajectoryWriter(const std::string& path, double width, double height,
+                     const TrajectoryOptions& opt = TrajectoryOptions())
+        : file(std::fopen(path.c_str(), "wb")), header(), options(opt) {
+        if (!file) throw std::runtime_error("Ошибка при открытии файла траектории: " + path);
+        if (options.delta) options.quantize = true;
+        options.keyframeInterval = std::max(1u, options.keyframeInterval);
+        options.maxPending = std::max<size_t>(1, options.maxPending);
+
+        std::memcpy(header.magic, trajectory::MAGIC, 4);
+        header.version = trajectory::VERSION;
+        header.flags = (options.quantize ? uint32_t(trajectory::QUANTIZED) : 0u) |
+                       (options.delta ? uint32_t(trajectory::DELTA) : 0u);
+        header.keyframeInterval = options.keyframeInterval;
+        header.width = width;
+        header.height = height;
+        header.posStep = options.posStep;
+        header.velStep = options.velStep;
+        try {
+            writeBytes(&header, sizeof(header));
+        } catch (const std::exception&) {
+            std::fclose(file);
+            throw;
+        }
+
+        worker = std::thread(&TrajectoryWriter::run, this);
+    }
+
+    ~TrajectoryWriter() {
+        try {
+            close();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+    }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    // Ставит в очередь снимок позиций и скоростей
+    void push(const ParticleStore& s, double time) {
+        std::unique_ptr<TrajectoryFrame> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (failed) throw std::runtime_error("Ошибка записи траектории");
+            drained.wait(lock, [&] { return queue.size() < options.maxPending; });
+            if (!freeFrames.empty()) {
+                frame = std::move(freeFrames.back());
+                freeFrames.pop_back();
+            }
+        }
+        if (!frame) frame.reset(new TrajectoryFrame());
+
+        frame->time = time;
+        frame->x.assign(s.x.begin(), s.x.end());
+        frame->y.assign(s.y.begin(), s.y.end());
+        frame->vx.assign(s.vx.begin(), s.vx.end());
+        frame->vy.assign(s.vy.begin(), s.vy.end());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(frame));
+        }
+        ready.notify_one();
+    }
+
+    // Дописывает очередь, индекс кадров и закрывает файл
+    void close() {
+        if (!file) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_one();
+        worker.join();
+
+        std::FILE* f = file;
+        bool ok = !failed;
+        if (ok) {
+            try {
+                trajectory::IndexTail tail{};
+                tail.indexOffset = position;
+                tail.frameCount = offsets.size();
+                std::memcpy(tail.magic, trajectory::INDEX_MAGIC, 4);
+                writeBytes(offsets.data(), offsets.size() * sizeof(uint64_t));
+                writeBytes(&tail, sizeof(tail));
+            } catch (const std::exception&) {
+                ok = false;
+            }
+        }
+        file = nullptr;
+        if (std::fclose(f) != 0) ok = false;
+        if (!ok) throw std::runtime_error("Ошибка записи траектории");
+    }
+
+    size_t framesWritten() const { return offsets.size(); }
+    uint64_t bytesWritten() const { return position; }
+};
+
+// Чтение траектории через mmap с произвольным доступом к кадрам
+class TrajectoryReader {
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    trajectory::Header header{};
+    size_t indexOffset = 0;
+    size_t frames = 0;
+
+    // Последний декодированный квантованный кадр: последовательное чтение
+    // дельта-кадров не возвращается к опорному
+    std::vector<int32_t> cached;
+    size_t cachedFrame = SIZE_MAX;
+
+    // Кадры не выровнены, поэтому поля читаются через memcpy
+    uint64_t offset(size_t i) const {
+        uint64_t v;
+        std::memcpy(&v, data + indexOffset + i * sizeof(uint64_t), sizeof(v));
+        return v;
+    }
+
+    trajectory::FrameHeader frameHeader(size_t i) const {
+        trajectory::FrameHeader fh;
+        std::memcpy(&fh, data + offset(i), sizeof(fh));
+        return fh;
+    }
+
+    const uint8_t* payload(size_t i) const { return data + offset(i) + sizeof(trajectory::FrameHeader); }
+    const uint8_t* payloadEnd(size_t i) const { return data + (i + 1 < frames ? offset(i + 1) : indexOffset); }
+
+    void corrupted() const { throw std::runtime_error("Повреждённый кадр траектории"); }
+
+    // Декодирует кадр i в cached; дельта-кадр требует, чтобы там был кадр i - 1
+    void decodeQuantized(size_t i) {
+        using namespace trajectory;
+        const FrameHeader fh = frameHeader(i);
+        const size_t values = 4 * static_cast<size_t>(fh.count);
+        const uint8_t* p = payload(i);
+        const uint8_t* end = payloadEnd(i);
+
+        if (fh.type == KEY_FRAME) {
+            if (static_cast<size_t>(end - p) < values * sizeof(int32_t)) corrupted();
+            cached.resize(values);
+            std::memcpy(cached.data(), p, values * sizeof(int32_t));
+        } else {
+            if (i == 0 || cachedFrame != i - 1 || cached.size() != values) corrupted();
+            for (size_t k = 0; k < values; ++k) {
+                uint32_t v = 0;
+                for (int shift = 0;; shift += 7) {
+                    if (p >= end || shift > 28) corrupted();
+                    uint8_t b = *p++;
+                    v |= static_cast<uint32_t>(b & 0x7F) << shift;
+                    if (!(b & 0x80)) break;
+                }
+                cached[k] = static_cast<int32_t>(static_cast<uint32_t>(cached[k]) +
+                                                 static_cast<uint32_t>(unzigzag(v)));
+            }
+        }
+        cachedFrame = i;
+    }
+
+    void fail(const char* message) {
+        ::munmap(const_cast<uint8_t*>(data), length);
+        data = nullptr;
+        throw std::runtime_error(message);
+    }
+
+public:
+    explicit TrajectoryReader(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии файла траектории: " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 ||
+            static_cast<size_t>(st.st_size) < sizeof(trajectory::Header) + sizeof(trajectory::IndexTail)) {
+            ::close(fd);
+            throw std::runtime_error("Файл траектории повреждён");
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* m = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) throw std::runtime_error("Ошибка отображения траектории в память");
+        data = static_cast<const uint8_t*>(m);
+
+        trajectory::IndexTail tail;
+        std::memcpy(&header, data, sizeof(header));
+        std::memcpy(&tail, data + length - sizeof(tail), sizeof(tail));
+        if (std::memcmp(header.magic, trajectory::MAGIC, 4) != 0 ||
+            header.version != trajectory::VERSION ||
+            std::memcmp(tail.magic, trajectory::INDEX_MAGIC, 4) != 0 ||
+            tail.indexOffset < sizeof(header) ||
+            tail.frameCount > (length - sizeof(tail)) / sizeof(uint64_t) ||
+            tail.indexOffset + tail.frameCount * sizeof(uint64_t) + sizeof(tail) != length) {
+            fail("Файл траектории повреждён");
+        }
+        indexOffset = static_cast<size_t>(tail.indexOffset);
+        frames = static_cast<size_t>(tail.frameCount);
+        for (size_t i = 0; i < frames; ++i) {
+            if (offset(i) < sizeof(header) || offset(i) + sizeof(trajectory::FrameHeader) > indexOffset ||
+                (i > 0 && offset(i) < offset(i - 1) + sizeof(trajectory::FrameHeader))) {
+                fail("Файл траектории повреждён");
+            }
+        }
+    }
+
+    ~TrajectoryReader() {
+        if (data) ::munmap(const_cast<uint8_t*>(data), length);
+    }
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    size_t frameCount() const { return frames; }
+    double width() const { return header.width; }
+    double height() const { return header.height; }
+    bool quantized() const { return header.flags & trajectory::QUANTIZED; }
+
+    double frameTime(size_t i) const { return frameHeader(i).time; }
+    size_t particleCount(size_t i) const { return frameHeader(i).count; }
+
+    // Декодирует кадр i; out переиспользуется между вызовами
+    void readFrame(size_t i, TrajectoryFrame& out) {
+        if (i >= frames) throw std::out_of_range("Нет такого кадра траектории");
+        const trajectory::FrameHeader fh = frameHeader(i);
+        const size_t n = fh.count;
+        std::vector<double>* cols[4] = { &out.x, &out.y, &out.vx, &out.vy };
+        out.time = fh.time;
+
+        if (!quantized()) {
+            const uint8_t* p = payload(i);
+            if (static_cast<size_t>(payloadEnd(i) - p) < 4 * n * sizeof(double)) corrupted();
+            for (auto* col : cols) {
+                col->resize(n);
+                std::memcpy(col->data(), p, n * sizeof(double));
+                p += n * sizeof(double);
+            }
+            return;
+        }
+
+        // Дельта-кадр восстанавливается от ближайшего опорного или от кэша
+        size_t key = i;
+        while (key > 0 && frameHeader(key).type != trajectory::KEY_FRAME) --key;
+        size_t start = key;
+        if (cachedFrame != SIZE_MAX && cachedFrame >= key && cachedFrame <= i) start = cachedFrame + 1;
+        for (size_t k = start; k <= i; ++k) decodeQuantized(k);
+
+        for (int c = 0; c < 4; ++c) {
+            double step = c < 2 ? header.posStep : header.velStep;
+            cols[c]->resize(n);
+            for (size_t k = 0; k < n; ++k) (*cols[c])[k] = cached[c * n + k] * step;
+        }
+    }
+};
+
+// Контрольная точка симулятора: заголовок с константами и состоянием
+// интегратора, текстовое состояние mt19937, столбцы ParticleStore подряд,
+// чтобы их можно было прочитать одним readv() прямо в хранилище, и
+// источники со стоками открытой системы
+namespace checkpoint {
+
+constexpr char MAGIC[4] = { 'P', 'S', 'C', 'K' };
+constexpr uint32_t VERSION = 3; // 2: открытая система, 3: maxSubsteps
+constexpr double MAX_EXTENT = 1e6; // сторона области: у сцены на INT_MAX частиц она ~7e5
+
+// Каждая версия дописывает поля в конец заголовка, так что заголовок старой
+// версии — начало нового; недостающие поля остаются значениями по умолчанию
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    double width, height;
+    double gravity, coulomb, damping;
+    double theta;
+    double fixedDt, accumulator;
+    uint32_t solver;
+    uint32_t integrator;
+    uint32_t accelFresh;
+    uint32_t rngStateSize;
+    uint32_t emitterCount;
+    uint32_t sinkCount;
+    double escapeMargin;
+    uint64_t particleLimit;
+    uint32_t maxSubsteps;
+    uint32_t reserved;
+};
+
+inline size_t headerSize(uint32_t version) {
+    switch (version) {
+        case 1: return offsetof(Header, emitterCount);
+        case 2: return offsetof(Header, maxSubsteps);
+        default: return sizeof(Header);
+    }
+}
+
+// Источник: прототип, параметры и накопленная дробная часть рождений
+struct EmitterRecord {
+    double x, y, vx, vy, ax, ay;
+    double mass, radius, charge;
+    double rate, spread, speedSpread, pending;
+    uint32_t kind;
+    uint32_t reserved;
+};
+
+struct SinkRecord {
+    double x, y, radius;
+};
+
+// Полная передача массива iovec с повтором при частичном чтении/записи
+template <class Op>
+bool transferAll(Op op, int fd, std::vector<iovec>& iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        int cnt = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t n = op(fd, &iov[first], cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return false;
+        size_t done = static_cast<size_t>(n);
+        while (first < iov.size() && done >= iov[first].iov_len) {
+            done -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    return true;
+}
+
+// Столбцы хранилища в порядке файла
+inline std::vector<iovec> columns(ParticleStore& s) {
+    std::vector<iovec> iov;
+    for (auto* col : s.columns()) iov.push_back({ col->data(), col->size() * sizeof(double) });
+    iov.push_back({ s.kind.data(), s.kind.size() * sizeof(ParticleKind) });
+    return iov;
+}
+
+} // namespace checkpoint
+
+// Терминальный рендерер с двойной буферизацией: кадр рисуется в задний буфер,
+// сравнивается с передним, и в терминал уходят только изменившиеся ячейки —
+// одной строкой escape-последовательностей и одним write() на кадр
+class TerminalRenderer {
+    int w = 0, h = 0;
+    std::vector<char> front, back;
+    std::string out;
+    char status[128] = {};
+    char shownStatus[128] = {};
+    bool fullRedraw = true;
+
+    void moveCursor(int row, int col) {
+        char buf[32];
+        int len = std::snprintf(buf, sizeof(buf), "\033[%d;%dH", row + 1, col + 1);
+        out.append(buf, static_cast<size_t>(len));
+    }
+
+    void flush() {
+        const char* p = out.data();
+        size_t left = out.size();
+        while (left > 0) {
+            ssize_t n = ::write(STDOUT_FILENO, p, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            p += n;
+            left -= static_cast<size_t>(n);
+            PROFILE_COUNT("render_bytes", n);
+        }
+        out.clear();
+    }
+
+public:
+    void resize(int width, int height) {
+        if (width == w && height == h) return;
+        w = std::max(0, width);
+        h = std::max(0, height);
+        front.assign(static_cast<size_t>(w) * h, ' ');
+        back.assign(static_cast<size_t>(w) * h, ' ');
+        out.reserve(static_cast<size_t>(w + 16) * h + 256);
+        fullRedraw = true;
+    }
+
+    int getWidth() const { return w; }
+    int getHeight() const { return h; }
+
+    // Следующий present() перерисует весь экран
+    void invalidate() { fullRedraw = true; }
+
+    void clear(char c = ' ') { std::fill(back.begin(), back.end(), c); }
+
+    void put(int x, int y, char c) {
+        if (x >= 0 && x < w && y >= 0 && y < h) back[static_cast<size_t>(y) * w + x] = c;
+    }
+
+    void setStatus(const char* text) {
+        std::snprintf(status, sizeof(status), "%s", text);
+    }
+
+    void present() {
+        if (fullRedraw) {
+            // Всё, что уже лежит в буфере std::cout, должно выйти раньше кадра
+            std::cout.flush();
+            out.append("\033[2J\033[H");
+            for (int y = 0; y < h; ++y) {
+                out.append(&back[static_cast<size_t>(y) * w], static_cast<size_t>(w));
+                out.push_back('\n');
+            }
+            shownStatus[0] = '\0';
+            // Копия, а не обмен: задний буфер остаётся кадром, как и после
+            // частичной перерисовки, и его можно дорисовывать
+            front = back;
+            fullRedraw = false;
+        } else {
+            // Подряд идущие изменённые ячейки печатаются без лишних перемещений курсора
+            for (int y = 0; y < h; ++y) {
+                int cursor = -1;
+                const size_t row = static_cast<size_t>(y) * w;
+                for (int x = 0; x < w; ++x) {
+                    char c = back[row + x];
+                    if (c == front[row + x]) continue;
+                    if (cursor != x) moveCursor(y, x);
+                    out.push_back(c);
+                    front[row + x] = c;
+                    cursor = x + 1;
+                }
+            }
+        }
+
+        if (std::strcmp(status, shownStatus) != 0) {
+            moveCursor(h + 1, 0);
+            out.append(status);
+            out.append("\033[K");
+            std::memcpy(shownStatus, status, sizeof(status));
+        }
+        if (!out.empty()) {
+            moveCursor(h + 2, 0);
+            flush();
+        }
+    }
+};
+
+// Способ расчёта гравитации и электростатики
+enum class ForceSolver {
+    AllPairs,  // точный перебор всех пар, O(N^2); по умолчанию
+    BarnesHut  // приближение Барнса–Хата, O(N log N); включается явно
+};
+
+// Время и счётчики по фазам шага, накапливаются до resetStats().
+// У Эйлера стены считаются в том же проходе, что и интегрирование.
+struct StepStats {
+    uint64_t steps = 0;
+    double forcesSec = 0;
+    double integrationSec = 0;
+    double wallsSec = 0;
+    double collisionsSec = 0;
+    uint64_t pairInteractions = 0; // парные взаимодействия (для Барнса–Хата — и с узлами)
+    uint64_t collisionChecks = 0;  // пары-кандидаты узкой фазы
+    uint64_t contacts = 0;         // найденные перекрытия
+    double lifecycleSec = 0;
+    uint64_t spawned = 0;          // частиц от источников
+    uint64_t removed = 0;          // частиц, ушедших в стоки или за границу
+
+    double totalSec() const { return forcesSec + integrationSec + wallsSec + collisionsSec + lifecycleSec; }
+};
+
+// Добавляет длительность своей области видимости к счётчику секунд
+class ScopedPhase {
+    double& target;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedPhase(double& t) : target(t), start(std::chrono::steady_clock::now()) {}
+    ~ScopedPhase() {
+        target += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Схема интегрирования по времени
+enum class Integrator {
+    Euler,          // явный Эйлер, силы стен и столкновений запаздывают на шаг
+    VelocityVerlet, // толчок–сдвиг–толчок, одно вычисление сил на шаг
+    Leapfrog,       // сдвиг–толчок–сдвиг, одно вычисление сил на шаг
+    RK4             // Рунге–Кутта 4-го порядка, четыре вычисления сил
+};
+
+// Источник: рождает копии прототипа с постоянной частотой. Положение и
+// скорость прототипа — центр разброса; дробная часть rate·dt копится
+// между шагами, так что средняя частота точная при любом шаге.
+struct Emitter {
+    Particle prototype;
+    double rate = 0;        // частиц в секунду
+    double spread = 0;      // разброс положения по каждой оси
+    double speedSpread = 0; // разброс скорости по каждой оси
+    double pending = 0;
+
+    Emitter(const Particle& p, double perSecond, double positionSpread = 0, double velocitySpread = 0)
+        : prototype(p), rate(perSecond), spread(positionSpread), speedSpread(velocitySpread) {}
+};
+
+// Сток: удаляет частицы, центр которых попал в круг
+struct Sink {
+    Vec2 center;
+    double radius;
+};
+
+// Основной симулятор
+class PhysicsSimulator {
+private:
+    static constexpr double MIN_DIST = 0.1;
+    static constexpr double WALL_STIFFNESS = 1000.0;
+    static constexpr double COLLISION_STIFFNESS = 500.0;
+
+    ParticleStore store;
+    double width, height;
+    double gravity, coulomb, damping;
+    std::mt19937 rng;
+    ForceSolver solver;
+    double theta;
+    SpatialHashGrid grid;
+    double maxRadius;
+    ThreadPool pool;
+
+    // Контакт, найденный потоком; применяется после прохода в порядке пар
+    struct Contact {
+        uint32_t i, j;
+        double fx, fy;
+    };
+    std::vector<std::vector<Contact>> contacts; // по одному списку на поток
+
+    Integrator integrator;
+    bool accelFresh; // ax/ay содержат полное ускорение в текущих позициях
+    std::vector<double> x0, y0, vx0, vy0, sumX, sumY, sumVX, sumVY; // буферы RK4
+
+    StepStats stats;
+    std::vector<uint64_t> workerCounts; // счётчики взаимодействий по потокам
+    std::vector<std::vector<double>> pairBuffers; // суммы пар по потокам: gx, gy, cx, cy подряд
+    std::vector<size_t> pairRows;                 // строки треугольника пар по потокам
+    std::vector<uint32_t> treeOrder;    // порядок обхода частиц для Барнса–Хата
+
+    // Буферы экрана переживают кадры; render() остаётся const для вызывающих
+    mutable TerminalRenderer renderer;
+
+    // Фиксированный шаг и накопитель непросчитанного времени
+    double fixedDt;
+    double accumulator;
+    int maxSubsteps;
+
+    // Открытая система: источники, стоки и уход за границу области
+    std::vector<Emitter> emitters;
+    std::vector<Sink> sinks;
+    double escapeMargin = -1;                // < 0 — частицы за стенами не удаляются
+    size_t particleLimit = SIZE_MAX;         // источники молчат, пока частиц столько
+
+    bool absorbed(size_t i) const {
+        const double px = store.x[i], py = store.y[i];
+        if (escapeMargin >= 0 && (px < -escapeMargin || px > width + escapeMargin ||
+                                  py < -escapeMargin || py > height + escapeMargin)) {
+            return true;
+        }
+        for (const Sink& s : sinks) {
+            double dx = px - s.center.x, dy = py - s.center.y;
+            if (dx * dx + dy * dy < s.radius * s.radius) return true;
+        }
+        return false;
+    }
+
+    // Сначала стоки, затем источники. Обход с конца: частица, перенесённая
+    // на место удалённой, уже проверена
+    void applyLifecycle(double dt) {
+        if (emitters.empty() && sinks.empty() && escapeMargin < 0) return;
+        ScopedPhase phase(stats.lifecycleSec);
+        PROFILE_SCOPE("lifecycle");
+
+        const size_t before = store.size();
+        for (size_t i = store.size(); i-- > 0;) {
+            if (absorbed(i)) store.swapRemove(i);
+        }
+        const size_t removed = before - store.size();
+
+        size_t spawned = 0;
+        for (Emitter& e : emitters) {
+            e.pending += e.rate * dt;
+            std::uniform_real_distribution<> offset(-e.spread, e.spread);
+            std::uniform_real_distribution<> kick(-e.speedSpread, e.speedSpread);
+            for (; e.pending >= 1; e.pending -= 1) {
+                if (store.size() >= particleLimit) continue; // лишние рождения пропадают
+                addParticle(e.prototype);
+                const size_t i = store.size() - 1;
+                store.x[i] += offset(rng);
+                store.y[i] += offset(rng);
+                store.vx[i] += kick(rng);
+                store.vy[i] += kick(rng);
+                ++spawned;
+            }
+        }
+
+        stats.removed += removed;
+        stats.spawned += spawned;
+        PROFILE_COUNT("removed", removed);
+        PROFILE_COUNT("spawned", spawned);
+        if (removed + spawned > 0) accelFresh = false;
+    }
+
+    void updateCollisionGrid() {
+        if (!grid.isConfigured() || 2 * maxRadius > grid.getCellSize()) {
+            grid.configure(width, height, 2 * maxRadius);
+        }
+        grid.truncate(store.size());
+        for (size_t i = 0; i < store.size(); ++i) {
+            grid.move(static_cast<uint32_t>(i), store.pos(i));
+        }
+    }
+
+    // Каждая пара считается один раз: поток копит суммы своих строк
+    // треугольника в свой буфер, затем буферы складываются по частицам в
+    // порядке потоков, так что результат зависит только от числа потоков
+    void computeForcesAllPairs() {
+        const size_t n = store.size();
+        const uint64_t interactions = n * (n - (n == 0 ? 0 : 1));
+        stats.pairInteractions += interactions;
+        PROFILE_COUNT("pair_interactions", interactions);
+
+        kernels::balancePairRows(n, pool.size(), pairRows);
+        pairBuffers.resize(pool.size());
+        pool.run([&](unsigned worker) {
+            std::vector<double>& buf = pairBuffers[worker];
+            buf.assign(4 * n, 0.0);
+            kernels::pairSums(store, pairRows[worker], pairRows[worker + 1], MIN_DIST,
+                              buf.data(), buf.data() + n, buf.data() + 2 * n, buf.data() + 3 * n);
+        });
+
+        pool.parallelFor(n, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                double gx = 0, gy = 0, cx = 0, cy = 0;
+                for (const std::vector<double>& buf : pairBuffers) {
+                    gx += buf[i];
+                    gy += buf[n + i];
+                    cx += buf[2 * n + i];
+                    cy += buf[3 * n + i];
+                }
+                // a = G·Σ m_j·r/|r|³ − (k·q_i/m_i)·Σ q_j·r/|r|³
+                double qm = store.charge[i] != 0 ? coulomb * store.charge[i] / store.mass[i] : 0.0;
+                store.ax[i] += gravity * gx - qm * cx;
+                store.ay[i] += gravity * gy - qm * cy;
+            }
+        });
+    }
+
+    void computeForcesBarnesHut() {
+        if (store.empty()) return;
+
+        // Корень охватывает все частицы, включая вылетевшие за стены
+        auto [minX, maxX] = std::minmax_element(store.x.begin(), store.x.end());
+        auto [minY, maxY] = std::minmax_element(store.y.begin(), store.y.end());
+        double half = std::max(*maxX - *minX, *maxY - *minY) / 2 + 1.0;
+        QuadTreeNode root(Vec2((*minX + *maxX) / 2, (*minY + *maxY) / 2), half);
+
+        for (size_t i = 0; i < store.size(); ++i) root.insert(store, static_cast<uint32_t>(i));
+        root.computeMoments(store);
+
+        // Частицы обходятся в порядке листьев: соседние обходы проходят
+        // по одним и тем же узлам, и те остаются в кэше
+        treeOrder.clear();
+        root.collectOrder(treeOrder);
+
+        // Обход дерева только читает его, каждая частица пишет своё ускорение
+        workerCounts.assign(pool.size(), 0);
+        pool.parallelFor(treeOrder.size(), [&](size_t begin, size_t end, unsigned worker) {
+            uint64_t interactions = 0;
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = treeOrder[k];
+                double gx = 0, gy = 0, cx = 0, cy = 0;
+                accumulateForce(root, i, gx, gy, cx, cy, interactions);
+                double qm = store.charge[i] != 0 ? coulomb * store.charge[i] / store.mass[i] : 0.0;
+                store.ax[i] += gravity * gx - qm * cx;
+                store.ay[i] += gravity * gy - qm * cy;
+            }
+            workerCounts[worker] = interactions;
+        });
+        uint64_t interactions = 0;
+        for (uint64_t c : workerCounts) interactions += c;
+        stats.pairInteractions += interactions;
+        PROFILE_COUNT("pair_interactions", interactions);
+    }
+
+    void computePairForces() {
+        ScopedPhase phase(stats.forcesSec);
+        PROFILE_SCOPE("forces");
+        if (solver == ForceSolver::BarnesHut) {
+            computeForcesBarnesHut();
+        } else {
+            computeForcesAllPairs();
+        }
+    }
+
+    // Полное ускорение в текущих позициях: пары, стены и столкновения
+    void evaluateAccelerations() {
+        {
+            ScopedPhase phase(stats.integrationSec);
+            pool.parallelFor(store.size(), [&](size_t begin, size_t end, unsigned) {
+            std::fill(store.ax.begin() + begin, store.ax.begin() + end, 0.0);
+            std::fill(store.ay.begin() + begin, store.ay.begin() + end, 0.0);
+            });
+        }
+        computePairForces();
+        {
+            ScopedPhase phase(stats.wallsSec);
+            pool.parallelFor(store.size(), [&](size_t begin, size_t end, unsigned) {
+                kernels::wallAccelerations(store, begin, end, width, height, WALL_STIFFNESS);
+            });
+        }
+        resolveCollisions();
+        accelFresh = true;
+    }
+
+    // v += a·h, затем x += v·h (h = 0 пропускает половину)
+    void kickDrift(double kick, double drift) {
+        ScopedPhase phase(stats.integrationSec);
+        pool.parallelFor(store.size(), [&](size_t begin, size_t end, unsigned) {
+            if (kick != 0) {
+                kernels::axpy(store.vx.data(), store.ax.data(), kick, begin, end);
+                kernels::axpy(store.vy.data(), store.ay.data(), kick, begin, end);
+            }
+            if (drift != 0) {
+                kernels::axpy(store.x.data(), store.vx.data(), drift, begin, end);
+                kernels::axpy(store.y.data(), store.vy.data(), drift, begin, end);
+            }
+        });
+    }
+
+    void stepEuler(double dt) {
+        // Гравитация и электростатика
+        computePairForces();
+
+        // Обновление позиций и столкновения со стенами
+        {
+            ScopedPhase phase(stats.integrationSec);
+            pool.parallelFor(store.size(), [&](size_t begin, size_t end, unsigned) {
+                kernels::integrateWithWalls(store, begin, end, dt, width, height, WALL_STIFFNESS);
+            });
+        }
+
+        // Столкновения между частицами: точная проверка только для пар-кандидатов
+        resolveCollisions();
+        accelFresh = false;
+    }
+
+    void stepVelocityVerlet(double dt) {
+        if (!accelFresh) evaluateAccelerations();
+        kickDrift(dt / 2, dt);
+        evaluateAccelerations();
+        kickDrift(dt / 2, 0);
+    }
+
+    void stepLeapfrog(double dt) {
+        kickDrift(0, dt / 2);
+        evaluateAccelerations();
+        kickDrift(dt, dt / 2);
+        accelFresh = false; // ускорение осталось от середины шага
+    }
+
+    void stepRK4(double dt) {
+        const size_t n = store.size();
+        x0 = store.x; y0 = store.y;
+        vx0 = store.vx; vy0 = store.vy;
+        sumX.assign(n, 0.0); sumY.assign(n, 0.0);
+        sumVX.assign(n, 0.0); sumVY.assign(n, 0.0);
+
+        const double offset[4] = { 0, dt / 2, dt / 2, dt };
+        const double weight[4] = { 1, 2, 2, 1 };
+
+        for (int stage = 0; stage < 4; ++stage) {
+            // Состояние стадии строится из производных предыдущей
+            if (stage > 0) {
+                ScopedPhase phase(stats.integrationSec);
+                const double c = offset[stage];
+                pool.parallelFor(n, [&](size_t begin, size_t end, unsigned) {
+                    for (size_t i = begin; i < end; ++i) {
+                        store.x[i] = x0[i] + store.vx[i] * c;
+                        store.y[i] = y0[i] + store.vy[i] * c;
+                        store.vx[i] = vx0[i] + store.ax[i] * c;
+                        store.vy[i] = vy0[i] + store.ay[i] * c;
+                    }
+                });
+            }
+            evaluateAccelerations();
+
+            ScopedPhase phase(stats.integrationSec);
+            const double w = weight[stage];
+            pool.parallelFor(n, [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = begin; i < end; ++i) {
+                    sumX[i] += store.vx[i] * w;
+                    sumY[i] += store.vy[i] * w;
+                    sumVX[i] += store.ax[i] * w;
+                    sumVY[i] += store.ay[i] * w;
+                }
+            });
+        }
+
+        ScopedPhase phase(stats.integrationSec);
+        const double h = dt / 6;
+        pool.parallelFor(n, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                store.x[i] = x0[i] + sumX[i] * h;
+                store.y[i] = y0[i] + sumY[i] * h;
+                store.vx[i] = vx0[i] + sumVX[i] * h;
+                store.vy[i] = vy0[i] + sumVY[i] * h;
+            }
+        });
+        accelFresh = false;
+    }
+
+    void resolveCollisions() {
+        ScopedPhase phase(stats.collisionsSec);
+        PROFILE_SCOPE("collisions");
+        updateCollisionGrid();
+        const auto& pairs = grid.candidatePairs();
+        stats.collisionChecks += pairs.size();
+        PROFILE_COUNT("pair_checks", pairs.size());
+
+        // Узкая фаза параллельно: каждый поток копит контакты своего куска пар
+        contacts.resize(pool.size());
+        pool.parallelFor(pairs.size(), [&](size_t begin, size_t end, unsigned worker) {
+            auto& out = contacts[worker];
+            out.clear();
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = pairs[k].first, j = pairs[k].second;
+                double dx = store.x[j] - store.x[i];
+                double dy = store.y[j] - store.y[i];
+                double dist = std::sqrt(dx * dx + dy * dy);
+                double minDist = store.radius[i] + store.radius[j];
+
+                if (dist < minDist) {
+                    Vec2 dir = Vec2(dx, dy).normalize();
+                    double f = (minDist - dist) * COLLISION_STIFFNESS;
+                    out.push_back({ i, j, dir.x * f, dir.y * f });
+                }
+            }
+        });
+
+        // Контакты применяются в порядке (i, j): порядок пар в сетке зависит
+        // от истории перемещений, а результат не должен — иначе шаг после
+        // восстановления из контрольной точки разошёлся бы с непрерывным счётом
+        auto& all = contacts[0];
+        for (size_t w = 1; w < pool.size(); ++w) {
+            all.insert(all.end(), contacts[w].begin(), contacts[w].end());
+            contacts[w].clear();
+        }
+        std::sort(all.begin(), all.end(), [](const Contact& a, const Contact& b) {
+            return a.i != b.i ? a.i < b.i : a.j < b.j;
+        });
+
+        stats.contacts += all.size();
+        PROFILE_COUNT("contacts", all.size());
+        PROFILE_VALUE("contacts_per_pass", all.size());
+        for (const Contact& c : all) {
+            store.ax[c.i] -= c.fx / store.mass[c.i];
+            store.ay[c.i] -= c.fy / store.mass[c.i];
+            store.ax[c.j] += c.fx / store.mass[c.j];
+            store.ay[c.j] += c.fy / store.mass[c.j];
+        }
+        all.clear();
+    }
+
+    // Суммы Σ m·r/|r|³ и Σ q·r/|r|³ для частицы i со стороны поддерева node
+    void accumulateForce(const QuadTreeNode& node, uint32_t i,
+                         double& gx, double& gy, double& cx, double& cy,
+                         uint64_t& interactions) const {
+        if (node.mass <= 0 && node.positiveCharge <= 0 && node.negativeCharge >= 0) return;
+
+        const double xi = store.x[i], yi = store.y[i];
+        if (node.isLeaf()) {
+            interactions += node.particles.size();
+            for (uint32_t j : node.particles) {
+                if (j == i) continue;
+                kernels::pairTerm(store.x[j] - xi, store.y[j] - yi, store.mass[j], store.charge[j],
+                                  MIN_DIST * MIN_DIST, gx, gy, cx, cy);
+            }
+            return;
+        }
+
+        Vec2 toMass(node.centerOfMass.x - xi, node.centerOfMass.y - yi);
+        Vec2 toPositive(node.centerOfPositive.x - xi, node.centerOfPositive.y - yi);
+        Vec2 toNegative(node.centerOfNegative.x - xi, node.centerOfNegative.y - yi);
+        double distMass = toMass.length();
+        double distPositive = node.positiveCharge > 0 ? toPositive.length() : distMass;
+        double distNegative = node.negativeCharge < 0 ? toNegative.length() : distMass;
+        double dist = std::min(distMass, std::min(distPositive, distNegative));
+
+        // Узел виден под углом меньше θ — заменяем его точкой массы и двумя
+        // точками заряда
+        if (2 * node.size < theta * dist) {
+            ++interactions;
+            double invM = node.mass / (distMass * distMass * distMass);
+            gx += toMass.x * invM;
+            gy += toMass.y * invM;
+            if (node.positiveCharge > 0) {
+                double invQ = node.positiveCharge / (distPositive * distPositive * distPositive);
+                cx += toPositive.x * invQ;
+                cy += toPositive.y * invQ;
+            }
+            if (node.negativeCharge < 0) {
+                double invQ = node.negativeCharge / (distNegative * distNegative * distNegative);
+                cx += toNegative.x * invQ;
+                cy += toNegative.y * invQ;
+            }
+            return;
+        }
+
+        for (const auto& child : node.children) accumulateForce(*child, i, gx, gy, cx, cy, interactions);
+    }
+
+public:
+    PhysicsSimulator(double w, double h)
+        : width(w), height(h), gravity(100.0), coulomb(5000.0), damping(0.99),
+          solver(ForceSolver::AllPairs), theta(0.5), maxRadius(0),
+          integrator(Integrator::Euler), accelFresh(false),
+          fixedDt(0.016), accumulator(0), maxSubsteps(8) {
+        rng.seed(std::random_device{}());
+    }
+
+    ParticleHandle addParticle(const Particle& p) {
+        maxRadius = std::max(maxRadius, p.getRadius());
+        accelFresh = false;
+        return store.push(p);
+    }
+
+    ParticleHandle addParticle(std::unique_ptr<Particle> p) {
+        return addParticle(*p);
+    }
+
+    // Удаление за O(1); false, если частица уже удалена. Индексы других
+    // частиц могут измениться, ручки — нет
+    bool removeParticle(ParticleHandle h) {
+        uint32_t i = store.indexOf(h);
+        if (i == ParticleStore::NO_INDEX) return false;
+        store.swapRemove(i);
+        accelFresh = false;
+        return true;
+    }
+
+    bool isAlive(ParticleHandle h) const { return store.indexOf(h) != ParticleStore::NO_INDEX; }
+
+    // Текущий индекс частицы для particles() и getParticle(size_t)
+    uint32_t indexOf(ParticleHandle h) const { return store.indexOf(h); }
+
+    void addEmitter(const Emitter& e) { emitters.push_back(e); }
+    void addSink(const Sink& s) { sinks.push_back(s); }
+    bool isOpenSystem() const { return !emitters.empty() || !sinks.empty() || escapeMargin >= 0; }
+    void clearEmittersAndSinks() {
+        emitters.clear();
+        sinks.clear();
+    }
+
+    // Частицы, ушедшие за стены дальше margin, удаляются; отрицательное — не удалять
+    void setEscapeMargin(double margin) { escapeMargin = margin; }
+
+    // Верхняя граница числа частиц для источников
+    void setParticleLimit(size_t limit) { particleLimit = limit; }
+
+    size_t particleCount() const { return store.size(); }
+
+    // Снимок частицы в виде фасада Particle
+    Particle getParticle(size_t i) const {
+        Particle p = makeParticle(store.kind[i], store.pos(i), Vec2(store.vx[i], store.vy[i]), store.mass[i],
+                                  store.radius[i], static_cast<int>(store.charge[i]));
+        p.applyForce(Vec2(store.ax[i], store.ay[i]) * store.mass[i]);
+        return p;
+    }
+
+    const ParticleStore& particles() const { return store; }
+    double getWidth() const { return width; }
+    double getHeight() const { return height; }
+
+    // Число потоков для расчёта сил, интегрирования и узкой фазы столкновений.
+    // При фиксированном числе потоков результат детерминирован.
+    void setThreadCount(unsigned n) { pool.resize(n); }
+    unsigned getThreadCount() const { return pool.size(); }
+
+    // По умолчанию силы точные; Барнс–Хат нужно выбрать явно
+    void setSolver(ForceSolver s) { solver = s; }
+    ForceSolver getSolver() const { return solver; }
+
+    // Угол раскрытия θ: 0 — точный расчёт, больше — быстрее и грубее
+    void setTheta(double t) { theta = std::max(0.0, t); }
+    double getTheta() const { return theta; }
+
+    // Сохраняет частицы, константы, открытую систему, состояние интегратора
+    // и генератора
+    void saveCheckpoint(const std::string& filename) {
+        PROFILE_SCOPE("save_checkpoint");
+        std::ostringstream rngState;
+        rngState << rng;
+        const std::string rngText = rngState.str();
+
+        checkpoint::Header h{};
+        std::memcpy(h.magic, checkpoint::MAGIC, 4);
+        h.version = checkpoint::VERSION;
+        h.count = store.size();
+        h.width = width;
+        h.height = height;
+        h.gravity = gravity;
+        h.coulomb = coulomb;
+        h.damping = damping;
+        h.theta = theta;
+        h.fixedDt = fixedDt;
+        h.accumulator = accumulator;
+        h.solver = static_cast<uint32_t>(solver);
+        h.integrator = static_cast<uint32_t>(integrator);
+        h.accelFresh = accelFresh ? 1 : 0;
+        h.rngStateSize = static_cast<uint32_t>(rngText.size());
+        h.emitterCount = static_cast<uint32_t>(emitters.size());
+        h.sinkCount = static_cast<uint32_t>(sinks.size());
+        h.escapeMargin = escapeMargin;
+        h.particleLimit = particleLimit;
+        h.maxSubsteps = static_cast<uint32_t>(maxSubsteps);
+
+        std::vector<checkpoint::EmitterRecord> emitterRecords;
+        for (const Emitter& e : emitters) {
+            const Particle& p = e.prototype;
+            checkpoint::EmitterRecord r{};
+            r.x = p.getPos().x;
+            r.y = p.getPos().y;
+            r.vx = p.getVel().x;
+            r.vy = p.getVel().y;
+            r.ax = p.getAcc().x;
+            r.ay = p.getAcc().y;
+            r.mass = p.getMass();
+            r.radius = p.getRadius();
+            r.charge = p.getCharge();
+            r.rate = e.rate;
+            r.spread = e.spread;
+            r.speedSpread = e.speedSpread;
+            r.pending = e.pending;
+            r.kind = static_cast<uint32_t>(p.getKind());
+            emitterRecords.push_back(r);
+        }
+        std::vector<checkpoint::SinkRecord> sinkRecords;
+        for (const Sink& sink : sinks) sinkRecords.push_back({ sink.center.x, sink.center.y, sink.radius });
+
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии файла для записи: " + filename);
+
+        std::vector<iovec> iov = { { &h, sizeof(h) },
+                                   { const_cast<char*>(rngText.data()), rngText.size() } };
+        std::vector<iovec> cols = checkpoint::columns(store);
+        iov.insert(iov.end(), cols.begin(), cols.end());
+        iov.push_back({ emitterRecords.data(), emitterRecords.size() * sizeof(checkpoint::EmitterRecord) });
+        iov.push_back({ sinkRecords.data(), sinkRecords.size() * sizeof(checkpoint::SinkRecord) });
+
+        // transferAll сдвигает iov при частичной записи: размер считается заранее
+        size_t bytes = 0;
+        for (const iovec& v : iov) bytes += v.iov_len;
+        bool ok = checkpoint::transferAll(::writev, fd, iov);
+        if (::close(fd) != 0) ok = false;
+        if (!ok) throw std::runtime_error("Ошибка записи контрольной точки");
+        PROFILE_COUNT("checkpoint_bytes", bytes);
+    }
+
+    // Восстанавливает состояние вместе с источниками и стоками; при ошибке
+    // текущее состояние не меняется. Файлы прежних версий читаются: в версии 1
+    // нет открытой системы, до версии 3 — предела догоняющих шагов
+    void loadCheckpoint(const std::string& filename) {
+        PROFILE_SCOPE("load_checkpoint");
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Ошибка при открытии файла для чтения: " + filename);
+
+        struct stat st;
+        checkpoint::Header h{};
+        h.escapeMargin = -1;
+        h.particleLimit = SIZE_MAX;
+        h.maxSubsteps = static_cast<uint32_t>(maxSubsteps);
+        const size_t v1Size = checkpoint::headerSize(1);
+        bool ok = ::fstat(fd, &st) == 0 && ::read(fd, &h, v1Size) == static_cast<ssize_t>(v1Size) &&
+                  std::memcmp(h.magic, checkpoint::MAGIC, 4) == 0 && h.version >= 1 &&
+                  h.version <= checkpoint::VERSION;
+        const size_t headerSize = ok ? checkpoint::headerSize(h.version) : sizeof(h);
+        ok = ok && ::read(fd, reinterpret_cast<char*>(&h) + v1Size, headerSize - v1Size) ==
+                       static_cast<ssize_t>(headerSize - v1Size);
+        ok = ok && h.solver <= static_cast<uint32_t>(ForceSolver::BarnesHut) &&
+             h.integrator <= static_cast<uint32_t>(Integrator::RK4) && h.width > 0 &&
+             h.width <= checkpoint::MAX_EXTENT && h.height > 0 && h.height <= checkpoint::MAX_EXTENT &&
+             h.fixedDt > 0 && h.maxSubsteps >= 1 && h.maxSubsteps <= INT_MAX;
+        const uint64_t perParticle = ParticleStore::DOUBLE_COLUMNS * sizeof(double) + sizeof(ParticleKind);
+        const uint64_t openSystemSize = uint64_t(h.emitterCount) * sizeof(checkpoint::EmitterRecord) +
+                                        uint64_t(h.sinkCount) * sizeof(checkpoint::SinkRecord);
+        ok = ok && h.count <= static_cast<uint64_t>(st.st_size) / perParticle &&
+             static_cast<uint64_t>(st.st_size) == headerSize + h.rngStateSize + h.count * perParticle + openSystemSize;
+        if (!ok) {
+            ::close(fd);
+            throw std::runtime_error("Файл контрольной точки повреждён: " + filename);
+        }
+
+        ParticleStore loaded;
+        std::string rngText(h.rngStateSize, '\0');
+        for (auto* col : loaded.columns()) col->resize(h.count);
+        loaded.kind.resize(h.count);
+        std::vector<checkpoint::EmitterRecord> emitterRecords(h.emitterCount);
+        std::vector<checkpoint::SinkRecord> sinkRecords(h.sinkCount);
+
+        // Одно чтение: состояние генератора и все столбцы сразу в хранилище
+        std::vector<iovec> iov = { { &rngText[0], rngText.size() } };
+        std::vector<iovec> cols = checkpoint::columns(loaded);
+        iov.insert(iov.end(), cols.begin(), cols.end());
+        iov.push_back({ emitterRecords.data(), emitterRecords.size() * sizeof(checkpoint::EmitterRecord) });
+        iov.push_back({ sinkRecords.data(), sinkRecords.size() * sizeof(checkpoint::SinkRecord) });
+        ok = checkpoint::transferAll(::readv, fd, iov);
+        ::close(fd);
+
+        std::mt19937 restoredRng;
+        std::istringstream rngState(rngText);
+        ok = ok && static_cast<bool>(rngState >> restoredRng);
+
+        std::vector<Emitter> restoredEmitters;
+        for (const checkpoint::EmitterRecord& r : emitterRecords) {
+            if (r.kind > static_cast<uint32_t>(ParticleKind::Charged)) ok = false;
+            if (!ok) break;
+            Particle p = makeParticle(static_cast<ParticleKind>(r.kind), Vec2(r.x, r.y), Vec2(r.vx, r.vy), r.mass,
+                                      r.radius, static_cast<int>(r.charge));
+            p.applyForce(Vec2(r.ax, r.ay) * r.mass);
+            restoredEmitters.emplace_back(p, r.rate, r.spread, r.speedSpread);
+            restoredEmitters.back().pending = r.pending;
+        }
+        if (!ok) throw std::runtime_error("Файл контрольной точки повреждён: " + filename);
+
+        std::vector<Sink> restoredSinks;
+        for (const checkpoint::SinkRecord& r : sinkRecords) restoredSinks.push_back({ Vec2(r.x, r.y), r.radius });
+
+        // Ручки не сохраняются: после загрузки они выдаются заново по индексам,
+        // с поколением новее всех прежних, чтобы старые ручки стали недействительны
+        loaded.resetHandles(store.nextGeneration());
+        store = std::move(loaded);
+        rng = restoredRng;
+        width = h.width;
+        height = h.height;
+        gravity = h.gravity;
+        coulomb = h.coulomb;
+        damping = h.damping;
+        theta = h.theta;
+        fixedDt = h.fixedDt;
+        accumulator = h.accumulator;
+        maxSubsteps = static_cast<int>(h.maxSubsteps);
+        solver = static_cast<ForceSolver>(h.solver);
+        integrator = static_cast<Integrator>(h.integrator);
+        accelFresh = h.accelFresh != 0;
+        emitters = std::move(restoredEmitters);
+        sinks = std::move(restoredSinks);
+        escapeMargin = h.escapeMargin;
+        particleLimit = static_cast<size_t>(std::min<uint64_t>(h.particleLimit, SIZE_MAX));
+
+        maxRadius = store.empty() ? 0.0 : *std::max_element(store.radius.begin(), store.radius.end());
+        grid = SpatialHashGrid();
+    }
+
+    const StepStats& getStats() const { return stats; }
+    void resetStats() { stats = StepStats(); }
+
+    void seed(uint32_t value) { rng.seed(value); }
+
+    // Смена схемы сбрасывает накопленные ускорения: у схем разный их смысл
+    void setIntegrator(Integrator i) {
+        if (i == integrator) return;
+        integrator = i;
+        std::fill(store.ax.begin(), store.ax.end(), 0.0);
+        std::fill(store.ay.begin(), store.ay.end(), 0.0);
+        accelFresh = false;
+    }
+    Integrator getIntegrator() const { return integrator; }
+
+    void update(double dt) {
+        PROFILE_SCOPE("update");
+        ++stats.steps;
+        switch (integrator) {
+            case Integrator::VelocityVerlet: stepVelocityVerlet(dt); break;
+            case Integrator::Leapfrog: stepLeapfrog(dt); break;
+            case Integrator::RK4: stepRK4(dt); break;
+            default: stepEuler(dt); break;
+        }
+        applyLifecycle(dt);
+    }
+
+    // Фиксированный шаг физики; maxSubsteps ограничивает догоняющие шаги за кадр
+    void setFixedTimestep(double dt, int maxSteps = 8) {
+        fixedDt = dt;
+        maxSubsteps = std::max(1, maxSteps);
+    }
+    double getFixedTimestep() const { return fixedDt; }
+    int getMaxSubsteps() const { return maxSubsteps; }
+
+    // Продвигает симуляцию на frameTime реального времени шагами fixedDt.
+    // Возвращает число выполненных шагов.
+    int advance(double frameTime) {
+        accumulator += std::max(0.0, frameTime);
+        int steps = 0;
+        while (accumulator >= fixedDt && steps < maxSubsteps) {
+            update(fixedDt);
+            accumulator -= fixedDt;
+            ++steps;
+        }
+        // Отставание сверх лимита отбрасывается, чтобы не уйти в спираль
+        if (steps == maxSubsteps) accumulator = std::min(accumulator, fixedDt);
+        return steps;
+    }
+
+    // Доля шага в накопителе — для интерполяции при отрисовке
+    double interpolationAlpha() const { return fixedDt > 0 ? accumulator / fixedDt : 0.0; }
+
+    void render() const {
+        PROFILE_SCOPE("render");
+        const int w = static_cast<int>(width);
+        const int h = static_cast<int>(height);
+        renderer.resize(w, h);
+        renderer.clear();
+
+        // Отрисовка границ
+        for (int x = 0; x < w; ++x) {
+            renderer.put(x, 0, '-');
+            renderer.put(x, h - 1, '-');
+        }
+        for (int y = 0; y < h; ++y) {
+            renderer.put(0, y, '|');
+            renderer.put(w - 1, y, '|');
+        }
+
+        // Отрисовка частиц
+        for (size_t i = 0; i < store.size(); ++i) {
+            int x = static_cast<int>(store.x[i]);
+            int y = static_cast<int>(store.y[i]);
+            renderer.put(x, y, particleSymbol(store.kind[i], store.charge[i]));
+        }
+
+        char status[128];
+        std::snprintf(status, sizeof(status), "Частиц: %zu | FPS: ~60 | ESC для выхода", store.size());
+        renderer.setStatus(status);
+        renderer.present();
+    }
+
+    void generateRandomParticles(int count) {
+        std::uniform_real_distribution<> posX(5, width - 5);
+        std::uniform_real_distribution<> posY(5, height - 5);
+        std::uniform_real_distribution<> vel(-20, 20);
+        std::uniform_int_distribution<> type(0, 2);
+
+        store.reserve(store.size() + count);
+        for (int i = 0; i < count; ++i) {
+            Vec2 p(posX(rng), posY(rng));
+            Vec2 v(vel(rng), vel(rng));
+
+            int t = type(rng);
+            if (t == 0) {
+                addParticle(Particle(p, v, 1.0, 0.5, 0));
+            } else if (t == 1) {
+                addParticle(HeavyParticle(p, v, 5.0, 1.0));
+            } else {
+                int charge = (i % 2 == 0) ? 1 : -1;
+                addParticle(ChargedParticle(p, v, 1.0, 0.5, charge));
+            }
+        }
+    }
+};
+
+// Параметры пакетного (безэкранного) запуска
+struct RunOptions {
+    bool headless = false;
+    bool benchmark = false;
+    size_t particles = 1000;
+    int steps = 100;
+    uint32_t seed = 1;
+    ForceSolver solver = ForceSolver::AllPairs;
+    Integrator integrator = Integrator::Euler;
+    double theta = 0.5;
+    unsigned threads = 1;
+    double dt = 0.016;
+    std::string trajectoryPath;  // запись траектории, пусто — без записи
+    int recordEvery = 1;
+    TrajectoryOptions trajectory;
+    std::string inspectPath;     // разбор готовой траектории
+    std::string loadCheckpoint;  // начать с сохранённого состояния
+    std::string saveCheckpoint;  // сохранить состояние после прогона
+    std::string profilePath;     // профиль в JSON, пусто — из переменной PROFILE
+    double emitRate = 0;         // открытая система: частиц в секунду сверху, сток внизу
+    size_t maxParticles = SIZE_MAX;
+};
+
+void printUsage() {
+    std::cout << "Использование: simulator [--headless | --bench] [параметры]\n"
+                 "  --particles N     число частиц (1000)\n"
+                 "  --steps N         число шагов (100)\n"
+                 "  --seed N          зерно генератора (1)\n"
+                 "  --solver S        direct | bh (direct)\n"
+                 "  --theta T         угол раскрытия Барнса–Хата (0.5)\n"
+                 "  --integrator I    euler | verlet | leapfrog | rk4 (euler)\n"
+                 "  --threads N       число потоков (1)\n"
+                 "  --dt T            шаг по времени (0.016)\n"
+                 "  --trajectory F    записать траекторию в файл F\n"
+                 "  --record-every N  писать каждый N-й шаг (1)\n"
+                 "  --quantize        квантовать позиции и скорости в int32\n"
+                 "  --delta           квантование + дельта-кодирование кадров\n"
+                 "  --inspect F       показать сводку по файлу траектории\n"
+                 "  --load-checkpoint F  начать с контрольной точки вместо случайных частиц\n"
+                 "  --save-checkpoint F  сохранить контрольную точку после прогона\n"
+                 "  --profile F       записать профиль (Chrome trace JSON) в файл F\n"
+                 "  --emit R          источник R частиц/с у верхней стены и сток у нижней\n"
+                 "  --max-particles N не рождать частиц сверх N\n";
+}
+
+bool parseOptions(int argc, char** argv, RunOptions& opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("нет значения для " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--headless") opt.headless = true;
+        else if (arg == "--bench") opt.benchmark = true;
+        else if (arg == "--particles") {
+            // stoul молча заворачивает "-5" в огромное число, а сцена
+            // строится по int, поэтому диапазон проверяется явно
+            long long n = std::stoll(value());
+            if (n < 1 || n > INT_MAX) {
+                throw std::invalid_argument("число частиц должно быть от 1 до " + std::to_string(INT_MAX));
+            }
+            opt.particles = static_cast<size_t>(n);
+        }
+        else if (arg == "--steps") {
+            opt.steps = std::stoi(value());
+            if (opt.steps < 1) throw std::invalid_argument("число шагов должно быть не меньше 1");
+        }
+        else if (arg == "--seed") opt.seed = static_cast<uint32_t>(std::stoul(value()));
+        else if (arg == "--theta") opt.theta = std::stod(value());
+        else if (arg == "--threads") opt.threads = static_cast<unsigned>(std::stoul(value()));
+        else if (arg == "--dt") opt.dt = std::stod(value());
+        else if (arg == "--trajectory") opt.trajectoryPath = value();
+        else if (arg == "--record-every") opt.recordEvery = std::max(1, std::stoi(value()));
+        else if (arg == "--quantize") opt.trajectory.quantize = true;
+        else if (arg == "--delta") opt.trajectory.delta = true;
+        else if (arg == "--inspect") opt.inspectPath = value();
+        else if (arg == "--load-checkpoint") opt.loadCheckpoint = value();
+        else if (arg == "--save-checkpoint") opt.saveCheckpoint = value();
+        else if (arg == "--profile") opt.profilePath = value();
+        else if (arg == "--emit") opt.emitRate = std::stod(value());
+        else if (arg == "--max-particles") opt.maxParticles = std::stoul(value());
+        else if (arg == "--solver") {
+            std::string s = value();
+            if (s == "bh") opt.solver = ForceSolver::BarnesHut;
+            else if (s == "direct") opt.solver = ForceSolver::AllPairs;
+            else throw std::invalid_argument("неизвестный метод: " + s);
+        } else if (arg == "--integrator") {
+            std::string s = value();
+            if (s == "euler") opt.integrator = Integrator::Euler;
+            else if (s == "verlet") opt.integrator = Integrator::VelocityVerlet;
+            else if (s == "leapfrog") opt.integrator = Integrator::Leapfrog;
+            else if (s == "rk4") opt.integrator = Integrator::RK4;
+            else throw std::invalid_argument("неизвестная схема: " + s);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Источник у верхней стены и сток той же ширины у нижней: частицы падают
+// сквозь область, и их число выходит на постоянный уровень
+void addOpenSystem(PhysicsSimulator& sim, const RunOptions& opt) {
+    if (opt.emitRate <= 0) return;
+    const double w = sim.getWidth(), h = sim.getHeight();
+    sim.addEmitter(Emitter(Particle(Vec2(w / 2, 2), Vec2(0, 10), 1.0, 0.5), opt.emitRate, w / 4, 5));
+    sim.addSink({ Vec2(w / 2, h), w / 4 });
+    sim.setEscapeMargin(1);
+    sim.setParticleLimit(opt.maxParticles);
+}
+
+// Область растёт с числом частиц, чтобы плотность оставалась как в окне 80x30 на 30 частиц
+std::unique_ptr<PhysicsSimulator> makeScene(const RunOptions& opt) {
+    double scale = std::sqrt(std::max(1.0, opt.particles / 30.0));
+    std::unique_ptr<PhysicsSimulator> sim(new PhysicsSimulator(80 * scale, 30 * scale));
+    if (!opt.loadCheckpoint.empty()) {
+        // Состояние и константы берутся из файла, потоки — из параметров запуска.
+        // Сохранённая открытая система продолжает работу вместо --emit
+        sim->loadCheckpoint(opt.loadCheckpoint);
+        sim->setThreadCount(opt.threads);
+        if (!sim->isOpenSystem()) addOpenSystem(*sim, opt);
+        return sim;
+    }
+    sim->seed(opt.seed);
+    sim->setSolver(opt.solver);
+    sim->setTheta(opt.theta);
+    sim->setIntegrator(opt.integrator);
+    sim->setThreadCount(opt.threads);
+    sim->generateRandomParticles(static_cast<int>(opt.particles));
+    addOpenSystem(*sim, opt);
+    return sim;
+}
+
+StepStats runScene(RunOptions& opt) {
+    std::unique_ptr<PhysicsSimulator> sim = makeScene(opt);
+    opt.particles = sim->particleCount();
+    std::unique_ptr<TrajectoryWriter> writer;
+    if (!opt.trajectoryPath.empty()) {
+        writer.reset(new TrajectoryWriter(opt.trajectoryPath, sim->getWidth(), sim->getHeight(),
+                                          opt.trajectory));
+        writer->push(sim->particles(), 0.0);
+    }
+
+    for (int s = 0; s < opt.steps; ++s) {
+        sim->update(opt.dt);
+        if (writer && (s + 1) % opt.recordEvery == 0) writer->push(sim->particles(), (s + 1) * opt.dt);
+    }
+
+    if (!opt.saveCheckpoint.empty()) sim->saveCheckpoint(opt.saveCheckpoint);
+    if (sim->isOpenSystem()) {
+        const StepStats& st = sim->getStats();
+        std::cout << "открытая система: рождено " << st.spawned << ", удалено " << st.removed
+                  << ", частиц в конце " << sim->particleCount() << "\n";
+    }
+    if (writer) {
+        writer->close();
+        std::cout << "траектория: " << writer->framesWritten() << " кадров, "
+                  << writer->bytesWritten() << " байт\n";
+    }
+    return sim->getStats();
+}
+
+// Сводка по файлу траектории и время произвольного доступа к кадрам
+void inspectTrajectory(const std::string& path) {
+    TrajectoryReader reader(path);
+    std::cout << "кадров: " << reader.frameCount() << ", область " << reader.width() << "x"
+              << reader.height() << (reader.quantized() ? ", квантованная\n" : "\n");
+    if (reader.frameCount() == 0) return;
+
+    TrajectoryFrame frame;
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> pick(0, reader.frameCount() - 1);
+    const int seeks = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < seeks; ++k) reader.readFrame(pick(rng), frame);
+    double seekMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t last = reader.frameCount() - 1;
+    reader.readFrame(last, frame);
+    std::cout << "последний кадр: t = " << frame.time << ", частиц " << frame.size() << "\n"
+              << "случайный доступ: " << seekMs / seeks << " мс/кадр\n";
+}
+
+void printReport(const RunOptions& opt, const StepStats& st) {
+    uint64_t steps = std::max<uint64_t>(1, st.steps);
+    double particleSteps = double(opt.particles) * steps;
+    double total = st.totalSec();
+    std::cout << std::fixed << std::setprecision(1)
+              << "частиц: " << opt.particles << ", шагов: " << st.steps
+              << ", потоков: " << opt.threads << "\n"
+              << "  нс/частицу-шаг:       " << total * 1e9 / particleSteps << "\n"
+              << "  взаимодействий/с:     " << std::scientific << std::setprecision(3)
+              << (st.forcesSec > 0 ? st.pairInteractions / st.forcesSec : 0) << std::fixed << "\n"
+              << "  силы, мс/шаг:         " << st.forcesSec * 1e3 / steps << "\n"
+              << "  интегрирование, мс/шаг: " << st.integrationSec * 1e3 / steps << "\n"
+              << "  стены, мс/шаг:        " << st.wallsSec * 1e3 / steps << "\n"
+              << "  столкновения, мс/шаг: " << st.collisionsSec * 1e3 / steps
+              << " (проверок " << st.collisionChecks / steps
+              << ", контактов " << st.contacts / steps << " за шаг)\n";
+}
+
+// Прогон N = 100 … 1 000 000; прямой перебор слишком дорог после 20 000 частиц
+void runBenchmark(RunOptions opt) {
+    // setw считает байты, поэтому заголовок с кириллицей выровнен вручную
+    std::cout << "        N   метод   шагов   нс/част·шаг       взаим/с"
+                 "      силы    интегр     стены    столкн  (мс/шаг)\n";
+
+    for (size_t n : { 100, 1000, 10000, 100000, 1000000 }) {
+        for (ForceSolver solver : { ForceSolver::AllPairs, ForceSolver::BarnesHut }) {
+            if (solver == ForceSolver::AllPairs && n > 20000) continue;
+
+            opt.particles = n;
+            opt.solver = solver;
+            opt.steps = static_cast<int>(std::max<size_t>(2, std::min<size_t>(200, 200000 / n)));
+            StepStats st = runScene(opt);
+
+            double perStep = 1e3 / st.steps;
+            std::cout << std::setw(9) << n
+                      << std::setw(8) << (solver == ForceSolver::AllPairs ? "direct" : "bh")
+                      << std::setw(8) << st.steps << std::fixed
+                      << std::setw(14) << std::setprecision(1) << st.totalSec() * 1e9 / (double(n) * st.steps)
+                      << std::setw(14) << std::setprecision(3) << std::scientific
+                      << (st.forcesSec > 0 ? st.pairInteractions / st.forcesSec : 0) << std::fixed
+                      << std::setw(10) << st.forcesSec * perStep
+                      << std::setw(10) << st.integrationSec * perStep
+                      << std::setw(10) << st.wallsSec * perStep
+                      << std::setw(10) << st.collisionsSec * perStep << "\n";
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    RunOptions opt;
+    try {
+        if (!parseOptions(argc, argv, opt)) {
+            printUsage();
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        printUsage();
+        return 1;
+    }
+
+    profiler::Session profile(opt.profilePath);
+
+    if (!opt.inspectPath.empty()) {
+        try {
+            inspectTrajectory(opt.inspectPath);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (opt.benchmark) {
+        try {
+            runBenchmark(opt);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (opt.headless) {
+        try {
+            printReport(opt, runScene(opt));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
     const double WIDTH = 80;
     const double HEIGHT = 30;
     const double DT = 0.016; // ~60 FPS
@@ -272,15 +2599,20 @@ int main() {
     
     sim.generateRandomParticles(30);
     
-    // Основной игровой цикл
+    // Основной игровой цикл: физика идёт фиксированным шагом DT
+    // независимо от того, сколько длится кадр
+    sim.setFixedTimestep(DT);
+    auto previous = std::chrono::high_resolution_clock::now();
     for (int frame = 0; frame < 600; ++frame) {
         auto start = std::chrono::high_resolution_clock::now();
         
-        sim.update(DT);
+        sim.advance(std::chrono::duration<double>(start - previous).count());
+        previous = start;
         sim.render();
         
         auto end = std::chrono::high_resolution_clock::now();
         auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        PROFILE_VALUE("frame_us", std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
         
         // Ограничение FPS
         int sleep_time = 16 - elapsed.count();
@@ -0,0 +1,227 @@
+// Регрессионные тесты gravity.cpp: программа подключается целиком без SFML,
+// её main переименовывается, чтобы не конфликтовать с тестовым.
+// Сборка и запуск: tests/run.sh
+#define GRAVITY_HEADLESS
+#define main gravity_main
+#include "../gravity.cpp"
+#undef main
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond << "\n";   \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (0)
+
+// Неподвижная куча: n шаров рядами от земли вверх, без перекрытий
+void stackBalls(World& world, size_t n, float radius)
+{
+    const float gap = 2 * radius + 0.1f;
+    const size_t cols = static_cast<size_t>((WIDTH - 2 * radius) / gap);
+    for (size_t i = 0; i < n; i++)
+        world.balls.add(radius + gap / 2 + (i % cols) * gap, 470 - (i / cols) * gap, radius);
+}
+
+// Широкая фаза почти линейна: в куче, которая растёт в высоту, число
+// проверяемых пар на шар за проход не растёт вместе с высотой столбцов
+void testBroadPhaseStaysLinear()
+{
+    for (size_t n : { 1000, 4000, 16000, 64000 })
+    {
+        World world;
+        stackBalls(world, n, 1.5f);
+        world.step(1.f / 60);
+        CHECK(world.lastStep().pairChecks < 6 * n * World::CONTACT_PASSES);
+    }
+}
+
+// Нормаль рельефа между узлами таблицы единичная и смотрит из земли, даже
+// когда соседние узлы заметно расходятся по наклону
+void testTerrainNormals()
+{
+    Terrain terrain(groundHeight, 0, WIDTH, 40);
+    float worst = 0;
+    for (float x = 0; x < WIDTH; x += 0.37f)
+    {
+        Terrain::Sample s = terrain.at(x);
+        worst = std::max(worst, std::abs(std::hypot(s.nx, s.ny) - 1));
+        CHECK(s.ny < 0);
+    }
+    CHECK(worst < 1e-5f);
+}
+
+// Расстояние от центра шара до земли по нормали: меньше радиуса — шар в земле
+float groundDistance(const World& world, size_t i)
+{
+    Terrain::Sample g = world.terrain.at(world.balls.x[i]);
+    return (world.balls.y[i] - g.height) * g.ny;
+}
+
+// Решатель контактов: встречные шары быстрее своего диаметра за кадр
+// не проходят друг сквозь друга и сохраняют импульс (масса ~ r²), быстрый
+// шар не проваливается в землю
+void testContactSolver()
+{
+    {
+        World world;
+        world.balls.add(560, 100, 4, 4000, 0);
+        world.balls.add(640, 100, 8, -2000, 0);
+        const BallStore& b = world.balls;
+        const float momentum = 16 * 4000.f - 64 * 2000.f;
+        float closest = 1e9f;
+        for (int s = 0; s < 4; s++)
+        {
+            world.step(1.f / 60);
+            CHECK(b.x[0] < b.x[1]);
+            closest = std::min(closest, b.x[1] - b.x[0]);
+            CHECK(std::abs(16 * b.vx[0] + 64 * b.vx[1] - momentum) < 0.01f * std::abs(momentum));
+        }
+        CHECK(closest > 0.95f * 12);
+        CHECK(b.vx[0] < 0 && b.vx[1] > -2000);
+    }
+    {
+        World world;
+        world.balls.add(300, 100, 3, 0, 5000);
+        float impact = 1e9f, lowest = 1e9f;
+        for (int s = 0; s < 60; s++)
+        {
+            world.step(1.f / 60);
+            if (impact == 1e9f && world.balls.vy[0] < 5000)
+                impact = groundDistance(world, 0);
+            lowest = std::min(lowest, groundDistance(world, 0));
+        }
+        CHECK(impact > 0.9f * 3);
+        CHECK(lowest > 0);
+    }
+}
+
+// В куче, которая скатывается в ложбины рельефа, шары толкают друг друга
+// внутри шага; соседи всё равно не меняются местами, а слой в один-два шара
+// не проседает глубже радиуса
+void testPileNoPassThrough()
+{
+    for (size_t n : { 200, 600 })
+    {
+        World world;
+        const float radius = 3;
+        stackBalls(world, n, radius);
+        const BallStore& b = world.balls;
+        size_t crossed = 0;
+        float deepest = 0, lowest = 1e9f;
+        for (int s = 0; s < 600; s++)
+        {
+            const std::vector<float> x0 = b.x, y0 = b.y;
+            world.step(1.f / 60);
+            for (size_t i = 0; i < n; i++)
+            {
+                lowest = std::min(lowest, groundDistance(world, i));
+                for (size_t j = i + 1; j < n; j++)
+                {
+                    float dx0 = x0[j] - x0[i], dy0 = y0[j] - y0[i];
+                    float dx = b.x[j] - b.x[i], dy = b.y[j] - b.y[i];
+                    if (dx0 * dx0 + dy0 * dy0 < 9 * radius * radius && dx0 * dx + dy0 * dy < 0)
+                        crossed++;
+                    deepest = std::max(deepest, 2 * radius - std::hypot(dx, dy));
+                }
+            }
+        }
+        CHECK(crossed == 0);
+        CHECK(lowest > 0.5f * radius);
+        if (n == 200)
+            CHECK(deepest < radius);
+    }
+}
+
+// Пакет вершин: по два треугольника на шар, квадрат ровно вокруг круга,
+// текстурные координаты в тех же углах; при росте старые вершины
+// сохраняются, при уменьшении числа шаров буфер не сжимается
+void testBallBatch()
+{
+    const int per = BallBatch::VERTICES_PER_BALL;
+    const float t = BallBatch::TEXTURE_SIZE;
+    BallBatch batch;
+    BallStore balls;
+    auto matches = [&] {
+        if (batch.vertexCount() != balls.size() * per)
+            return false;
+        for (size_t i = 0; i < balls.size(); i++)
+        {
+            const float x = balls.x[i], y = balls.y[i], r = balls.radius[i];
+            bool corners[2][2] = {};
+            for (int k = 0; k < per; k++)
+            {
+                const BatchVertex& v = batch.data()[i * per + k];
+                const int cx = v.position.x > x, cy = v.position.y > y;
+                if (std::abs(v.position.x - (cx ? x + r : x - r)) > 1e-4f ||
+                    std::abs(v.position.y - (cy ? y + r : y - r)) > 1e-4f ||
+                    v.texCoords.x != cx * t || v.texCoords.y != cy * t)
+                    return false;
+                corners[cx][cy] = true;
+            }
+            if (!(corners[0][0] && corners[0][1] && corners[1][0] && corners[1][1]))
+                return false;
+        }
+        return true;
+    };
+
+    for (size_t n : { 3, 100, 40, 0, 250 })
+    {
+        balls = BallStore();
+        for (size_t i = 0; i < n; i++)
+            balls.add(10.f + i * 3.5f, 500.f - i, 1.f + i % 7);
+        batch.update(balls);
+        CHECK(matches());
+    }
+    const BatchVertex* before = batch.data();
+    for (auto* v : { &balls.x, &balls.y, &balls.vx, &balls.vy, &balls.radius })
+        v->resize(120);
+    batch.update(balls);
+    CHECK(batch.data() == before && matches());
+}
+
+// Ошибки в аргументах замера отклоняются до прогона: нулевое число шагов,
+// мусор вместо чисел и незнакомые параметры вроде --help
+void testBenchmarkArguments()
+{
+    const std::vector<std::vector<std::string>> bad = {
+        { "--steps", "0" }, { "--steps", "-2" }, { "--steps", "x" }, { "--steps" },
+        { "--help" },       { "12abc" },         { "-5" },           { " 12" },
+        { "99999999999999999999" },
+    };
+    for (const std::vector<std::string>& args : bad)
+    {
+        std::vector<char*> argv = { const_cast<char*>("gravity") };
+        for (const std::string& a : args)
+            argv.push_back(const_cast<char*>(a.c_str()));
+        bool rejected = false;
+        try
+        {
+            benchmarkMain(static_cast<int>(argv.size()), argv.data());
+        }
+        catch (const std::invalid_argument&)
+        {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+}
+
+int main()
+{
+    testBroadPhaseStaysLinear();
+    testBenchmarkArguments();
+    testTerrainNormals();
+    testContactSolver();
+    testPileNoPassThrough();
+    testBallBatch();
+    if (failures)
+    {
+        std::cerr << failures << " проверок не прошло\n";
+        return 1;
+    }
+    std::cout << "gravity_test: OK\n";
+    return 0;
+}
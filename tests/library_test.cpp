@@ -0,0 +1,555 @@
+// Регрессионные тесты library.cpp: программа подключается целиком,
+// её main переименовывается, чтобы не конфликтовать с тестовым.
+// Сборка и запуск: tests/run.sh
+#define main library_main
+#include "../library.cpp"
+#undef main
+
+#include <sstream>
+#include <random>
+#include <set>
+#include <fstream>
+#include <atomic>
+#include <numeric>
+#include <thread>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond << "\n";   \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (0)
+
+// Файл в старом текстовом формате: число книг и записи "вид;поля;...;выдана"
+static void writeLegacyFile(const std::string& path, const std::vector<std::string>& records) {
+    std::ofstream out(path, std::ios::binary);
+    size_t count = records.size();
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const std::string& r : records) {
+        size_t len = r.size();
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.write(r.data(), len);
+    }
+}
+
+// Старый файл без пользователей при активных выдачах: id выданных книг
+// не должны указывать в новый каталог
+void testLegacyLoadWithActiveLoans() {
+    const std::string path = "/tmp/library_test_legacy.dat";
+    writeLegacyFile(path, { "FictionBook;Новая книга;Автор;2001;Роман;0" });
+
+    Library lib;
+    lib.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
+    lib.addBook(std::make_shared<ScienceBook>("Химия и жизнь", "Сидоров", 2012, "Химия"));
+    lib.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.addUser(std::make_shared<User>("Мария", 2));
+    lib.borrowBook(1, "Физика для всех"); // id 0 есть и в новом каталоге
+    lib.borrowBook(2, "Мир фантазий");    // id 2 за пределами нового каталога
+
+    lib.loadFromBinaryFile(path);
+
+    std::ostringstream captured;
+    std::streambuf* saved = std::cout.rdbuf(captured.rdbuf());
+    lib.showAllUsers();
+    std::cout.rdbuf(saved);
+    CHECK(captured.str().find("Алексей") != std::string::npos);
+    CHECK(captured.str().find("Мария") != std::string::npos);
+    CHECK(captured.str().find("Новая книга") == std::string::npos);
+
+    // Возврат старой книги не освобождает чужую книгу нового каталога
+    bool threw = false;
+    try {
+        lib.returnBookById(1, 0);
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // Пользователи сохранились и могут брать книги нового каталога
+    lib.borrowBook(1, "Новая книга");
+    int holder = -1;
+    CHECK(lib.findHolder(0, holder) && holder == 1);
+    std::remove(path.c_str());
+}
+
+// Испорченная запись в середине старого файла: загрузка отклоняется, а
+// прежний каталог, индексы и выдачи остаются как были
+void testLegacyLoadIsAtomic() {
+    const std::string path = "/tmp/library_test_legacy_bad.dat";
+    writeLegacyFile(path, { "FictionBook;Новая книга;Автор;2001;Роман;0",
+                            "ScienceBook;Сломанная;Автор;две тысячи;Физика;0" });
+
+    Library lib;
+    lib.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
+    lib.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.borrowBook(1, "Мир фантазий");
+
+    bool threw = false;
+    try {
+        lib.loadFromBinaryFile(path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(lib.bookCount() == 2);
+    CHECK(lib.findBook("Физика для всех"));
+    CHECK(!lib.findBook("Новая книга"));
+    CHECK(lib.findBooksByAuthor("Иванов").size() == 2);
+    int holder = -1;
+    CHECK(lib.findHolder(1, holder) && holder == 1);
+    std::remove(path.c_str());
+}
+
+// Сортировка вывода не меняет каталог: после сохранения и загрузки у книг
+// те же id, порядок добавления прежний, выдачи указывают на те же книги
+void testSortedSaveKeepsIds() {
+    const std::string path = "/tmp/library_test_sorted.cat";
+    Library lib;
+    lib.addBook(std::make_shared<FictionBook>("Вторая", "Петров", 2001, "Роман"));
+    lib.addBook(std::make_shared<FictionBook>("Альфа", "Иванов", 2002, "Роман"));
+    lib.addBook(std::make_shared<ScienceBook>("Бета", "Сидоров", 2003, "Физика"));
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.borrowBookById(1, 0);
+    lib.sortBooksByTitle();
+    lib.saveToBinaryFile(path);
+
+    CatalogView view(path);
+    for (size_t i = 0; i < view.size(); ++i) CHECK(view[i].id == i);
+
+    Library loaded;
+    loaded.loadFromBinaryFile(path);
+    const char* titles[] = { "Вторая", "Альфа", "Бета" };
+    std::vector<BookView> inserted = loaded.booksInOrder(BookOrder::Insertion);
+    CHECK(inserted.size() == 3);
+    for (uint32_t id = 0; id < std::min<size_t>(inserted.size(), 3); ++id) {
+        CHECK(inserted[id].getTitle() == titles[id]);
+        CHECK(loaded.findBook(titles[id]).getId() == id);
+    }
+    int holder = -1;
+    CHECK(loaded.findHolder(0, holder) && holder == 1);
+    CHECK(loaded.booksInOrder(BookOrder::Title).front().getTitle() == "Альфа");
+    std::remove(path.c_str());
+}
+
+// Книги случайного каталога: заголовки повторяются, авторы и годы общие
+struct CatalogEntry {
+    std::string title, author;
+    int year;
+};
+
+static std::vector<CatalogEntry> randomCatalog(Library& lib, size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<> titleNo(0, static_cast<int>(count / 2)), authorNo(0, 29), year(1950, 2020);
+    std::vector<CatalogEntry> entries;
+    for (size_t i = 0; i < count; ++i) {
+        CatalogEntry e{ "Книга " + std::to_string(titleNo(rng)), "Автор " + std::to_string(authorNo(rng)), year(rng) };
+        if (i % 2) lib.addBook(std::make_shared<ScienceBook>(e.title, e.author, e.year, "Физика"));
+        else lib.addBook(std::make_shared<FictionBook>(e.title, e.author, e.year, "Роман"));
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+// Поиск по индексам совпадает с перебором каталога: по названию находится
+// первая добавленная книга, по автору — все его книги в порядке добавления,
+// по годам — все книги диапазона по возрастанию года
+void testIndexesMatchScan() {
+    Library lib;
+    const std::vector<CatalogEntry> entries = randomCatalog(lib, 2000, 13);
+
+    for (int t = 0; t <= 1000; t += 7) {
+        const std::string title = "Книга " + std::to_string(t);
+        auto it = std::find_if(entries.begin(), entries.end(), [&](const CatalogEntry& e) { return e.title == title; });
+        BookView found = lib.findBook(title);
+        CHECK(static_cast<bool>(found) == (it != entries.end()));
+        if (found && it != entries.end()) CHECK(found.getId() == static_cast<uint32_t>(it - entries.begin()));
+    }
+    CHECK(!lib.findBook("Книга"));
+
+    for (int a = 0; a < 31; ++a) {
+        const std::string author = "Автор " + std::to_string(a);
+        std::vector<uint32_t> expected, actual;
+        for (uint32_t id = 0; id < entries.size(); ++id) {
+            if (entries[id].author == author) expected.push_back(id);
+        }
+        for (const BookView& b : lib.findBooksByAuthor(author)) actual.push_back(b.getId());
+        CHECK(actual == expected);
+    }
+
+    for (auto [from, to] : { std::pair<int, int>{ 1960, 1965 }, { 2020, 2020 }, { 1900, 1949 }, { 2000, 1990 } }) {
+        std::vector<std::pair<int, uint32_t>> expected, actual;
+        for (uint32_t id = 0; id < entries.size(); ++id) {
+            if (entries[id].year >= from && entries[id].year <= to) expected.push_back({ entries[id].year, id });
+        }
+        for (const BookView& b : lib.findBooksByYear(from, to)) actual.push_back({ b.getYear(), b.getId() });
+        CHECK(std::is_sorted(actual.begin(), actual.end(),
+                             [](const auto& a, const auto& b) { return a.first < b.first; }));
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        CHECK(actual == expected);
+    }
+}
+
+// Полное видимое состояние: книги с признаками выдачи и пользователи с выдачами
+static std::string catalogState(const Library& lib) {
+    std::ostringstream out;
+    lib.exportBooks(streamSink(out), ReportFormat::JsonLines);
+    lib.exportUsers(streamSink(out), ReportFormat::JsonLines);
+    return out.str();
+}
+
+static size_t fileSize(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<size_t>(in.tellg()) : 0;
+}
+
+// Журнал воспроизводится в то же состояние: и сам по себе, и поверх снимка
+// после уплотнения, в том числе с операциями, пришедшими во время него.
+// Оборванная запись в конце отрезается, остальное применяется
+void testJournalReplayAndCompaction() {
+    const std::string base = "/tmp/library_test_journal";
+    std::remove((base + ".snap").c_str());
+    std::remove((base + ".wal").c_str());
+    JournalOptions options;
+    options.syncCommit = false;
+
+    std::string expected;
+    size_t walBeforeCompaction = 0;
+    {
+        Library lib;
+        lib.openJournal(base, options);
+        randomCatalog(lib, 300, 14);
+        for (int u = 1; u <= 4; ++u) lib.addUser(std::make_shared<User>("Читатель " + std::to_string(u), u));
+        for (uint32_t id = 0; id < 40; ++id) lib.borrowBookById(1 + id % 4, id);
+        for (uint32_t id = 0; id < 40; id += 3) lib.returnBookById(1 + id % 4, id);
+        lib.flushJournal();
+        walBeforeCompaction = fileSize(base + ".wal");
+
+        lib.compact();
+        lib.addBook(std::make_shared<FictionBook>("Во время уплотнения", "Автор", 2024, "Роман"));
+        lib.borrowBookById(2, 41);
+        lib.waitCompaction();
+        lib.returnBookById(2, 41);
+        lib.borrowBookById(3, 300);
+        lib.flushJournal();
+        expected = catalogState(lib);
+        CHECK(fileSize(base + ".wal") < walBeforeCompaction / 4);
+    }
+
+    {
+        Library lib;
+        lib.openJournal(base, options);
+        CHECK(catalogState(lib) == expected);
+        CHECK(lib.bookCount() == 301);
+    }
+
+    const size_t walSize = fileSize(base + ".wal");
+    std::ofstream(base + ".wal", std::ios::binary | std::ios::app) << std::string("\x05\x00\x00oops", 7);
+    {
+        Library lib;
+        lib.openJournal(base, options);
+        CHECK(catalogState(lib) == expected);
+    }
+    CHECK(fileSize(base + ".wal") == walSize);
+
+    std::remove((base + ".snap").c_str());
+    std::remove((base + ".wal").c_str());
+}
+
+// Гонка за одни и те же книги: у каждой ровно один победитель, и его выдача
+// видна и в книге, и у пользователя. Параллельно идут добавления и поиск
+void testConcurrentBorrow() {
+    Library lib;
+    const uint32_t books = 64;
+    const int threads = 4;
+    for (uint32_t id = 0; id < books; ++id) {
+        lib.addBook(std::make_shared<FictionBook>("Спорная " + std::to_string(id), "Автор", 2000, "Роман"));
+    }
+    for (int u = 1; u <= threads; ++u) lib.addUser(std::make_shared<User>("Читатель", u));
+
+    std::vector<int> wins(threads + 1, 0);
+    std::atomic<int> failedLookups(0);
+    std::vector<std::thread> pool;
+    for (int u = 1; u <= threads; ++u) {
+        pool.emplace_back([&, u] {
+            for (uint32_t k = 0; k < books; ++k) {
+                const uint32_t id = (k + static_cast<uint32_t>(u) * 7) % books;
+                try {
+                    lib.borrowBook(u, "Спорная " + std::to_string(id));
+                    ++wins[u];
+                } catch (const std::runtime_error&) {
+                }
+                if (!lib.findBook("Спорная 0")) ++failedLookups;
+            }
+        });
+    }
+    pool.emplace_back([&] {
+        for (int k = 0; k < 200; ++k) {
+            lib.addBook(std::make_shared<ScienceBook>("Новая " + std::to_string(k), "Другой", 2010, "Физика"));
+        }
+    });
+    for (std::thread& t : pool) t.join();
+
+    CHECK(failedLookups == 0);
+    CHECK(std::accumulate(wins.begin(), wins.end(), 0) == static_cast<int>(books));
+    std::vector<int> held(threads + 1, 0);
+    for (uint32_t id = 0; id < books; ++id) {
+        int holder = -1;
+        CHECK(lib.findHolder(id, holder) && holder >= 1 && holder <= threads);
+        if (holder >= 1 && holder <= threads) ++held[holder];
+    }
+    CHECK(held == wins);
+    CHECK(lib.bookCount() == books + 200);
+    CHECK(lib.findBooksByAuthor("Другой").size() == 200);
+}
+
+// Пользователи и их выдачи переживают сохранение и загрузку: загрузка
+// заменяет прежних пользователей, а выдачи снова связаны с книгами
+void testUsersPersist() {
+    const std::string path = "/tmp/library_test_users.cat";
+    Library lib;
+    randomCatalog(lib, 50, 15);
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.addUser(std::make_shared<User>("Мария; \"Мэри\"", 7));
+    lib.addUser(std::make_shared<User>("Без книг", 3));
+    for (uint32_t id : { 4u, 9u, 2u }) lib.borrowBookById(7, id);
+    lib.borrowBookById(1, 30);
+    lib.returnBookById(7, 9);
+    lib.saveToBinaryFile(path);
+    const std::string expected = catalogState(lib);
+
+    Library loaded;
+    loaded.addUser(std::make_shared<User>("Лишний", 99));
+    loaded.loadFromBinaryFile(path);
+    CHECK(catalogState(loaded) == expected);
+    CHECK(expected.find("Лишний") == std::string::npos && catalogState(loaded).find("Лишний") == std::string::npos);
+
+    // Связи восстановлены: книгу можно вернуть и отдать другому
+    int holder = -1;
+    CHECK(loaded.findHolder(2, holder) && holder == 7);
+    loaded.returnBookById(7, 2);
+    loaded.borrowBookById(3, 2);
+    CHECK(loaded.findHolder(2, holder) && holder == 3);
+    bool threw = false;
+    try {
+        loaded.borrowBookById(99, 5);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    std::remove(path.c_str());
+}
+
+static std::vector<std::string> tokens(std::string_view s) {
+    std::vector<std::string> out;
+    text::tokenize(s, [&](const std::string& t) { out.push_back(t); });
+    return out;
+}
+
+// Разбор на слова: регистр, ё, ударения, пунктуация и битый UTF-8; ключи
+// сортировки согласованы с посимвольным сравнением
+void testTokenizer() {
+    CHECK((tokens("Мир фантазий — ЁЛКИ, палки! «Привет»") ==
+           std::vector<std::string>{ "мир", "фантазий", "елки", "палки", "привет" }));
+    CHECK((tokens("за\u0301мок") == std::vector<std::string>{ "замок" }));
+    CHECK((tokens("C++ and 2nd-edition") == std::vector<std::string>{ "c", "and", "2nd", "edition" }));
+    CHECK((tokens("Café Über") == std::vector<std::string>{ "café", "über" }));
+    CHECK((tokens("ab\xFF\xFE" "cd") == std::vector<std::string>{ "ab", "cd" }));
+    CHECK(tokens(" ...  ").empty());
+
+    CHECK(text::collate("Ёжик", "ежик") == 0);
+    CHECK(text::collate("абв", "АБГ") < 0);
+    CHECK(text::collate("б", "аааа") > 0);
+    CHECK(text::collate("Книга", "Книга 2") < 0);
+
+    const std::vector<std::string> words = { "ель", "Ёлка", "елка", "apple", "Zebra", "яблоко", "Яблоко 2",
+                                             "abc", "ABD", "Über", "ubel", "ёжик в тумане", "ежик в тумане!" };
+    for (const std::string& a : words) {
+        for (const std::string& b : words) {
+            uint64_t ka = text::collationPrefix(a), kb = text::collationPrefix(b);
+            int c = text::collate(a, b);
+            if (ka < kb) CHECK(c < 0);
+            if (ka > kb) CHECK(c > 0);
+            if (c == 0) CHECK(ka == kb);
+        }
+    }
+}
+
+// Поиск находит ровно те книги, где есть все слова запроса (последнее — как
+// начало слова), название весит больше жанра, автодополнение — из словаря
+void testSearchIndex() {
+    Library lib;
+    lib.addBook(std::make_shared<ScienceBook>("Физика для всех", "Иванов", 2010, "Физика"));
+    lib.addBook(std::make_shared<FictionBook>("Мир фантазий", "Иванов", 2020, "Фэнтези"));
+    lib.addBook(std::make_shared<ScienceBook>("Химия и жизнь", "Сидоров", 2012, "Химия"));
+    lib.addBook(std::make_shared<ScienceBook>("Занимательная механика", "Перельман", 1959, "Физика"));
+    lib.addBook(std::make_shared<FictionBook>("Ёлка для Иванова", "Петров", 2001, "Сказка"));
+    lib.addBook(std::make_shared<FictionBook>("Сказка о рыбаке", "Пушкин", 1835, "Поэма"));
+    randomCatalog(lib, 300, 16);
+
+    auto ids = [](const std::vector<BookView>& books) {
+        std::vector<uint32_t> out;
+        for (const BookView& b : books) out.push_back(b.getId());
+        return out;
+    };
+    auto brute = [&](const std::vector<std::string>& words, bool prefixLast) {
+        std::vector<uint32_t> out;
+        for (uint32_t id = 0; id < lib.bookCount(); ++id) {
+            BookView b = lib.getBook(id);
+            std::vector<std::string> t = tokens(std::string(b.getTitle()) + " " + std::string(b.getAuthor()) + " " +
+                                                std::string(b.getDetail()));
+            bool all = true;
+            for (size_t k = 0; k < words.size(); ++k) {
+                const bool prefix = prefixLast && k + 1 == words.size();
+                all = all && std::any_of(t.begin(), t.end(), [&](const std::string& w) {
+                          return prefix ? w.compare(0, words[k].size(), words[k]) == 0 : w == words[k];
+                      });
+            }
+            if (all) out.push_back(id);
+        }
+        return out;
+    };
+
+    std::vector<BookView> physics = lib.searchBooks("ФИЗИКА", 1000);
+    CHECK(physics.size() == 152); // две свои и 150 научных из случайного каталога
+    CHECK(!physics.empty() && physics.front().getId() == 0); // в названии и в области
+    CHECK(ids(lib.searchBooks("сказка", 10)) == (std::vector<uint32_t>{ 5, 4 })); // название выше жанра
+    CHECK(ids(lib.searchBooks("елка", 100)) == std::vector<uint32_t>{ 4 });
+    CHECK(lib.searchBooks("иванов мир", 100).size() == 1);
+    CHECK(lib.searchBooks("химия перельман", 100).empty());
+
+    for (const std::vector<std::string>& q : std::vector<std::vector<std::string>>{
+             { "книга" }, { "книга", "1" }, { "автор", "2" }, { "физ" }, { "иван" }, { "роман", "книга", "12" } }) {
+        std::string query;
+        for (const std::string& w : q) query += w + " ";
+        query.pop_back();
+        std::vector<uint32_t> found = ids(lib.searchBooks(query, 1000));
+        std::sort(found.begin(), found.end());
+        CHECK(found == brute(q, true));
+    }
+    CHECK(lib.searchBooks("книга", 5).size() == 5);
+
+    std::vector<std::string> completions = lib.completeWord("Мир фан");
+    CHECK(std::find(completions.begin(), completions.end(), "фантазий") != completions.end());
+    completions = lib.completeWord("зан");
+    CHECK(completions == std::vector<std::string>{ "занимательная" });
+    CHECK(lib.completeWord("щщщ").empty());
+}
+
+// Возврат в любом порядке оставляет у пользователя ровно невозвращённые
+// книги: сверка со множеством после каждой операции, повторы отклоняются
+void testLoansAnyOrder() {
+    std::mt19937 rng(17);
+    User user("Читатель", 1);
+    std::set<uint32_t> model;
+    auto matches = [&] {
+        std::vector<uint32_t> held = user.getBorrowed();
+        std::sort(held.begin(), held.end());
+        return held == std::vector<uint32_t>(model.begin(), model.end());
+    };
+    for (int step = 0; step < 20000; ++step) {
+        uint32_t book = rng() % 64;
+        bool threw = false;
+        try {
+            if (rng() % 2) user.borrowBook(book);
+            else user.returnBook(book);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        if (!threw && !model.insert(book).second) model.erase(book);
+        if (user.holds(book) != (model.count(book) != 0) || !matches()) {
+            CHECK(!"список книг пользователя разошёлся с моделью");
+            break;
+        }
+    }
+    user.clearLoans();
+    CHECK(user.getBorrowed().empty() && !user.holds(0));
+
+    // То же через Library: пачка выдаётся, возвращается вразнобой, держатели
+    // книг и отказы пакетных операций согласованы
+    Library lib;
+    randomCatalog(lib, 40, 17);
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.addUser(std::make_shared<User>("Мария", 2));
+    std::vector<uint32_t> batch(20);
+    std::iota(batch.begin(), batch.end(), 0u);
+    CHECK(lib.borrowBooksById(1, batch) == std::vector<bool>(20, true));
+    CHECK(lib.borrowBooksById(2, { 5, 25 }) == (std::vector<bool>{ false, true }));
+    std::shuffle(batch.begin(), batch.end(), rng);
+    batch.resize(12);
+    CHECK(lib.returnBooksById(1, batch) == std::vector<bool>(12, true));
+    CHECK(lib.returnBooksById(1, { batch[0], 25 }) == (std::vector<bool>{ false, false }));
+    bool threw = false;
+    try {
+        lib.returnBookById(2, batch[0]);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    for (uint32_t id = 0; id < 40; ++id) {
+        int holder = 0;
+        bool held = lib.findHolder(id, holder);
+        const bool returned = std::find(batch.begin(), batch.end(), id) != batch.end();
+        if (id < 20) CHECK(held == !returned && (!held || holder == 1));
+        else CHECK(held == (id == 25) && (!held || holder == 2));
+    }
+}
+
+// Параллельная выгрузка совпадает с последовательной байт в байт во всех
+// форматах и порядках вывода; поля с разделителями экранируются
+void testParallelExport() {
+    Library lib;
+    const size_t count = 3 * 16384 + 123; // три полных блока выгрузки и хвост
+    randomCatalog(lib, count, 18);
+    lib.addUser(std::make_shared<User>("Алексей", 1));
+    lib.borrowBooksById(1, { 0, 7, static_cast<uint32_t>(count - 1) });
+
+    for (BookOrder order : { BookOrder::Insertion, BookOrder::Title }) {
+        lib.setDisplayOrder(order);
+        for (ReportFormat format : { ReportFormat::Text, ReportFormat::Csv, ReportFormat::JsonLines }) {
+            std::ostringstream serial;
+            lib.exportBooks(streamSink(serial), format, 1);
+            for (unsigned threads : { 2u, 3u, 8u }) {
+                std::ostringstream parallel;
+                lib.exportBooks(streamSink(parallel), format, threads);
+                CHECK(parallel.str() == serial.str());
+            }
+        }
+    }
+
+    Library tricky;
+    tricky.addBook(std::make_shared<FictionBook>("Он сказал: \"да, нет\"", "Back\\slash", 2000, "Строка\nвторая\tтаб\x01"));
+    std::ostringstream csv, json;
+    tricky.exportBooks(streamSink(csv), ReportFormat::Csv);
+    tricky.exportBooks(streamSink(json), ReportFormat::JsonLines);
+    CHECK(csv.str() == "id,kind,title,author,year,detail,borrowed,holder\n"
+                       "0,fiction,\"Он сказал: \"\"да, нет\"\"\",Back\\slash,2000,\"Строка\nвторая\tтаб\x01\",0,\n");
+    CHECK(json.str() == "{\"id\":0,\"kind\":\"fiction\",\"title\":\"Он сказал: \\\"да, нет\\\"\","
+                        "\"author\":\"Back\\\\slash\",\"year\":2000,"
+                        "\"detail\":\"Строка\\nвторая\\tтаб\\u0001\",\"borrowed\":false,\"holder\":null}\n");
+}
+
+int main() {
+    testLegacyLoadWithActiveLoans();
+    testLegacyLoadIsAtomic();
+    testSortedSaveKeepsIds();
+    testIndexesMatchScan();
+    testJournalReplayAndCompaction();
+    testConcurrentBorrow();
+    testUsersPersist();
+    testTokenizer();
+    testSearchIndex();
+    testLoansAnyOrder();
+    testParallelExport();
+    if (failures) {
+        std::cerr << failures << " проверок не прошло\n";
+        return 1;
+    }
+    std::cout << "library_test: OK\n";
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Сборка и запуск регрессионных тестов: tests/run.sh [каталог сборки]
+# Гонки ловятся так: EXTRA_FLAGS=-fsanitize=thread tests/run.sh
+set -e
+# lockAllStripes() держит больше 64 мьютексов сразу — предел детектора
+# взаимоблокировок TSan; сами гонки он по-прежнему ищет
+export TSAN_OPTIONS=${TSAN_OPTIONS:-detect_deadlocks=0}
+cd "$(dirname "$0")/.."
+out=${1:-/tmp/repo-tests}
+mkdir -p "$out"
+CXX=${CXX:-g++}
+FLAGS="-std=c++17 -O1 -g -Wall -Wextra -pthread $EXTRA_FLAGS"
+
+$CXX $FLAGS tests/simulator_test.cpp -o "$out/simulator_test"
+"$out/simulator_test"
+
+$CXX $FLAGS tests/library_test.cpp -o "$out/library_test"
+"$out/library_test"
+
+$CXX $FLAGS tests/gravity_test.cpp -o "$out/gravity_test"
+"$out/gravity_test"
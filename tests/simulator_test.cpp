@@ -0,0 +1,769 @@
+// Регрессионные тесты simulator.cpp: программа подключается целиком,
+// её main переименовывается, чтобы не конфликтовать с тестовым.
+// Сборка и запуск: tests/run.sh
+#define main simulator_main
+#include "../simulator.cpp"
+#undef main
+
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond << "\n";   \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (0)
+
+// Смена числа потоков между шагами: новые исполнители не должны
+// подхватить задание прошлого parallelFor
+void testPoolResize() {
+    PhysicsSimulator sim(80, 30);
+    sim.seed(1);
+    sim.generateRandomParticles(500);
+    for (unsigned threads : { 2u, 4u, 1u, 3u, 3u, 2u }) {
+        sim.setThreadCount(threads);
+        sim.update(0.016);
+        CHECK(sim.getThreadCount() == threads);
+    }
+
+    ThreadPool pool(2);
+    for (unsigned threads : { 3u, 1u, 4u }) {
+        pool.run([](unsigned) {});
+        pool.resize(threads);
+        std::vector<int> hits(pool.size(), 0);
+        pool.run([&](unsigned worker) { hits[worker]++; });
+        for (int h : hits) CHECK(h == 1);
+    }
+}
+
+// Исключение задания пробрасывается только после того, как задание
+// закончили все исполнители, и не роняет пул
+void testPoolExceptions() {
+    ThreadPool pool(3);
+    std::atomic<int> finished(0);
+    bool caught = false;
+    try {
+        pool.run([&](unsigned worker) {
+            if (worker == 0) throw std::runtime_error("caller");
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            ++finished;
+        });
+    } catch (const std::runtime_error&) {
+        caught = true;
+        CHECK(finished == 2);
+    }
+    CHECK(caught);
+
+    caught = false;
+    try {
+        pool.run([](unsigned worker) {
+            if (worker == 2) throw std::runtime_error("worker");
+        });
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "worker";
+    }
+    CHECK(caught);
+
+    std::vector<int> hits(pool.size(), 0);
+    pool.run([&](unsigned worker) { hits[worker]++; });
+    for (int h : hits) CHECK(h == 1);
+}
+
+// Симметричный перебор пар при любом делении строк между потоками даёт те же
+// суммы, что прямой перебор всех j ≠ i, включая совпадающие частицы
+void testPairSumsSymmetric() {
+    const double minDist = 0.1;
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<> pos(0, 50), mass(0.5, 2);
+    std::uniform_int_distribution<> charge(-2, 2);
+    ParticleStore store;
+    for (int k = 0; k < 301; ++k) {
+        store.push(ChargedParticle(Vec2(pos(rng), pos(rng)), Vec2(0, 0), mass(rng), 0.1, charge(rng)));
+    }
+    store.push(ChargedParticle(Vec2(store.x[0], store.y[0]), Vec2(0, 0), 1.0, 0.1, 1));
+    const size_t n = store.size();
+
+    std::vector<double> ref(4 * n, 0.0);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            if (j == i) continue;
+            kernels::pairTerm(store.x[j] - store.x[i], store.y[j] - store.y[i], store.mass[j], store.charge[j],
+                              minDist * minDist, ref[i], ref[n + i], ref[2 * n + i], ref[3 * n + i]);
+        }
+    }
+
+    for (unsigned threads : { 1u, 2u, 3u, 7u }) {
+        std::vector<size_t> rows;
+        kernels::balancePairRows(n, threads, rows);
+        CHECK(rows.front() == 0 && rows.back() == n);
+        std::vector<double> sum(4 * n, 0.0);
+        for (unsigned w = 0; w < threads; ++w) {
+            CHECK(rows[w] <= rows[w + 1]);
+            std::vector<double> buf(4 * n, 0.0);
+            kernels::pairSums(store, rows[w], rows[w + 1], minDist, buf.data(), buf.data() + n,
+                              buf.data() + 2 * n, buf.data() + 3 * n);
+            for (size_t k = 0; k < sum.size(); ++k) sum[k] += buf[k];
+        }
+        double worst = 0;
+        for (size_t k = 0; k < sum.size(); ++k) {
+            worst = std::max(worst, std::abs(sum[k] - ref[k]) / (std::abs(ref[k]) + 1e-3));
+        }
+        CHECK(worst < 1e-9);
+    }
+}
+
+// Векторные ядра над столбцами дают то же, что шаг Particle::update со
+// скалярными пружинами стен, в том числе на хвосте короче вектора и при
+// диапазоне, начатом не с нуля
+void testVectorKernelsMatchScalar() {
+    const double width = 20, height = 10, stiffness = 500, dt = 0.01;
+    std::mt19937 rng(10);
+    std::uniform_real_distribution<> px(-1, width + 1), py(-1, height + 1), v(-5, 5), a(-50, 50), m(0.5, 3);
+    std::vector<Particle> ref;
+    ParticleStore store;
+    for (int k = 0; k < 37; ++k) {
+        Particle p(Vec2(px(rng), py(rng)), Vec2(v(rng), v(rng)), m(rng), 0.5);
+        p.applyForce(Vec2(a(rng), a(rng)) * p.getMass());
+        ref.push_back(p);
+        store.push(p);
+    }
+
+    const size_t begin = 3;
+    kernels::integrateWithWalls(store, begin, store.size(), dt, width, height, stiffness);
+    std::vector<double> shifted = store.x;
+    kernels::axpy(shifted.data(), store.vx.data(), 0.25, begin, store.size());
+
+    auto close = [](double a, double b) { return std::abs(a - b) <= 1e-12 * (std::abs(b) + 1); };
+    for (size_t i = 0; i < ref.size(); ++i) {
+        Particle p = ref[i];
+        if (i < begin) {
+            CHECK(store.x[i] == p.getPos().x && store.vx[i] == p.getVel().x && store.ax[i] == p.getAcc().x);
+            continue;
+        }
+        p.update(dt);
+        const double r = p.getRadius(), x = p.getPos().x, y = p.getPos().y;
+        const double fx = std::max(r - x, 0.0) + std::min(width - r - x, 0.0);
+        const double fy = std::max(r - y, 0.0) + std::min(height - r - y, 0.0);
+        CHECK(close(store.x[i], x) && close(store.y[i], y));
+        CHECK(close(store.vx[i], p.getVel().x) && close(store.vy[i], p.getVel().y));
+        CHECK(close(store.ax[i], fx * stiffness / p.getMass()) && close(store.ay[i], fy * stiffness / p.getMass()));
+        CHECK(close(shifted[i], x + 0.25 * p.getVel().x));
+    }
+
+    // Удаление переносит последнюю частицу во все столбцы сразу
+    const ParticleHandle last = store.handle(store.size() - 1);
+    const double lastX = store.x.back(), lastCharge = store.charge.back(), lastMass = store.mass.back();
+    store.swapRemove(5);
+    CHECK(store.size() == ref.size() - 1);
+    CHECK(store.indexOf(last) == 5);
+    CHECK(store.x[5] == lastX && store.charge[5] == lastCharge && store.mass[5] == lastMass);
+    for (auto* col : store.columns()) CHECK(col->size() == store.size());
+    CHECK(store.kind.size() == store.size());
+}
+
+// Траектория читается обратно такой, какой записана: без квантования
+// побитово, с квантованием и дельтами — с точностью до полшага, при любом
+// порядке чтения кадров и при смене числа частиц посреди записи
+void testTrajectoryRoundTrip() {
+    const std::string path = "/tmp/simulator_test_trajectory.bin";
+    for (int mode = 0; mode < 3; ++mode) {
+        TrajectoryOptions options;
+        options.quantize = mode > 0;
+        options.delta = mode == 2;
+        options.keyframeInterval = 4;
+        options.maxPending = 2;
+
+        PhysicsSimulator sim(80, 30);
+        sim.seed(11);
+        sim.generateRandomParticles(50);
+        std::vector<TrajectoryFrame> written;
+        {
+            TrajectoryWriter writer(path, sim.getWidth(), sim.getHeight(), options);
+            for (int s = 0; s < 23; ++s) {
+                sim.update(0.016);
+                if (s == 9) sim.removeParticle(sim.particles().handle(7));
+                if (s == 15) sim.addParticle(Particle(Vec2(40, 15), Vec2(1, 2), 1, 0.5));
+                const ParticleStore& st = sim.particles();
+                TrajectoryFrame f;
+                f.time = 0.016 * (s + 1);
+                f.x = st.x; f.y = st.y; f.vx = st.vx; f.vy = st.vy;
+                written.push_back(f);
+                writer.push(st, f.time);
+            }
+            writer.close();
+            CHECK(writer.framesWritten() == written.size());
+        }
+
+        TrajectoryReader reader(path);
+        CHECK(reader.frameCount() == written.size());
+        CHECK(reader.quantized() == options.quantize);
+        CHECK(reader.width() == 80 && reader.height() == 30);
+        std::vector<size_t> order;
+        for (size_t i = written.size(); i-- > 0;) order.push_back(i);
+        for (size_t i : { 5, 6, 7, 12, 3, 22 }) order.push_back(i);
+        for (size_t i = 0; i < written.size(); ++i) order.push_back(i);
+
+        TrajectoryFrame f;
+        for (size_t i : order) {
+            if (i >= reader.frameCount()) continue;
+            reader.readFrame(i, f);
+            const TrajectoryFrame& w = written[i];
+            CHECK(f.time == w.time);
+            CHECK(f.size() == w.size());
+            if (f.size() != w.size()) continue;
+            const double tol = options.quantize ? options.posStep / 2 + 1e-12 : 0;
+            const double vtol = options.quantize ? options.velStep / 2 + 1e-12 : 0;
+            for (size_t k = 0; k < w.size(); ++k) {
+                CHECK(std::abs(f.x[k] - w.x[k]) <= tol && std::abs(f.y[k] - w.y[k]) <= tol);
+                CHECK(std::abs(f.vx[k] - w.vx[k]) <= vtol && std::abs(f.vy[k] - w.vy[k]) <= vtol);
+            }
+        }
+    }
+
+    // Обрезанный файл отклоняется при открытии
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 5);
+    bool rejected = false;
+    try {
+        TrajectoryReader broken(path);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    std::remove(path.c_str());
+}
+
+// Экран терминала, на который проигрывается вывод TerminalRenderer: понимает
+// только те escape-последовательности, которые рендерер выводит
+struct ScreenEmulator {
+    int w, h;
+    std::vector<std::string> rows;
+    int row = 0, col = 0;
+
+    ScreenEmulator(int width, int height) : w(width), h(height), rows(height, std::string(width, ' ')) {}
+
+    void play(const std::string& out) {
+        for (size_t i = 0; i < out.size(); ++i) {
+            char c = out[i];
+            if (c == '\033') {
+                size_t end = out.find_first_of("JHK", i);
+                std::string code = out.substr(i + 2, end - i - 2);
+                if (out[end] == 'J') {
+                    for (std::string& r : rows) r.assign(w, ' ');
+                } else if (out[end] == 'H') {
+                    int r = 1, c2 = 1;
+                    std::sscanf(code.c_str(), "%d;%d", &r, &c2);
+                    row = r - 1;
+                    col = c2 - 1;
+                } else if (row < h) {
+                    for (int x = col; x < w; ++x) rows[row][x] = ' ';
+                }
+                i = end;
+            } else if (c == '\n') {
+                ++row;
+                col = 0;
+            } else {
+                if (row < h && col < w) rows[row][col] = c;
+                ++col;
+            }
+        }
+    }
+};
+
+// Перерисовка только изменившихся ячеек даёт на экране тот же кадр, что и
+// задний буфер; неизменный кадр не выводит ни байта
+void testRendererDiff() {
+    const int w = 17, h = 6;
+    char path[] = "/tmp/simulator_test_renderXXXXXX";
+    int fd = ::mkstemp(path);
+    std::cout.flush();
+    int saved = ::dup(STDOUT_FILENO);
+    ::dup2(fd, STDOUT_FILENO);
+
+    ScreenEmulator screen(w + 8, h + 3);
+    off_t played = 0;
+    auto drain = [&] {
+        off_t end = ::lseek(fd, 0, SEEK_END);
+        std::string out(static_cast<size_t>(end - played), '\0');
+        if (::pread(fd, &out[0], out.size(), played) != static_cast<ssize_t>(out.size())) out.clear();
+        played = end;
+        screen.play(out);
+        return out.size();
+    };
+
+    TerminalRenderer renderer;
+    renderer.resize(w, h);
+    std::mt19937 rng(12);
+    std::uniform_int_distribution<> px(0, w - 1), py(0, h - 1), sym(0, 3);
+    const char symbols[] = "o+-O";
+    std::vector<std::string> expected(h, std::string(w, ' '));
+    for (int frame = 0; frame < 30; ++frame) {
+        renderer.clear();
+        for (std::string& r : expected) r.assign(w, ' ');
+        for (int k = 0; k < 8; ++k) {
+            int x = px(rng), y = py(rng);
+            char c = symbols[sym(rng)];
+            renderer.put(x, y, c);
+            expected[y][x] = c;
+        }
+        renderer.put(-1, 0, 'X');
+        renderer.put(0, h, 'X');
+        std::string status = "кадр " + std::to_string(frame / 3);
+        renderer.setStatus(status.c_str());
+        renderer.present();
+        drain();
+        for (int y = 0; y < h; ++y) CHECK(screen.rows[y].substr(0, w) == expected[y]);
+        CHECK(screen.rows[h + 1].compare(0, status.size(), status) == 0);
+
+        renderer.present(); // тот же кадр
+        CHECK(drain() == 0);
+    }
+
+    std::cout.flush();
+    ::dup2(saved, STDOUT_FILENO);
+    ::close(saved);
+    ::close(fd);
+    ::unlink(path);
+}
+
+// Сетка широкой фазы не теряет ни одной перекрывающейся пары по сравнению
+// с полным перебором и не выдаёт пару дважды: и после переноса частиц между
+// ячейками, и после усечения, и для частиц за пределами области
+void testSpatialHashMatchesBruteForce() {
+    const double width = 60, height = 40, maxRadius = 1.0;
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<> px(-2, width + 2), py(-2, height + 2), radius(0.1, maxRadius), step(-3, 3);
+    std::vector<Vec2> pos(800);
+    std::vector<double> r(pos.size());
+    for (size_t i = 0; i < pos.size(); ++i) {
+        pos[i] = Vec2(px(rng), py(rng));
+        r[i] = radius(rng);
+    }
+
+    SpatialHashGrid grid;
+    grid.configure(width, height, 2 * maxRadius);
+    for (int round = 0; round < 4; ++round) {
+        if (round == 3) {
+            pos.resize(500);
+            grid.truncate(pos.size());
+        }
+        for (size_t i = 0; i < pos.size(); ++i) grid.move(static_cast<uint32_t>(i), pos[i]);
+
+        std::set<std::pair<uint32_t, uint32_t>> candidates;
+        for (const auto& pair : grid.candidatePairs()) {
+            CHECK(pair.first < pair.second && pair.second < pos.size());
+            CHECK(candidates.insert(pair).second);
+        }
+        for (uint32_t i = 0; i < pos.size(); ++i) {
+            for (uint32_t j = i + 1; j < pos.size(); ++j) {
+                if ((pos[j] - pos[i]).length() < r[i] + r[j]) CHECK(candidates.count({ i, j }) == 1);
+            }
+        }
+        for (Vec2& p : pos) p = p + Vec2(step(rng), step(rng));
+    }
+}
+
+// Ручки, выданные до загрузки контрольной точки или очистки хранилища,
+// не должны находить частицы, занявшие те же слоты после
+void testHandlesAfterReload() {
+    const std::string path = "/tmp/simulator_test_handles.chk";
+    PhysicsSimulator sim(80, 30);
+    sim.seed(2);
+    sim.generateRandomParticles(10);
+    sim.saveCheckpoint(path);
+
+    std::vector<ParticleHandle> old;
+    for (size_t i = 0; i < sim.particleCount(); ++i) old.push_back(sim.particles().handle(i));
+    sim.removeParticle(old[3]); // поколение слота 3 уже выросло
+    for (int i = 0; i < 5; ++i) old.push_back(sim.addParticle(sim.getParticle(0)));
+
+    sim.loadCheckpoint(path);
+    for (int i = 0; i < 8; ++i) sim.addParticle(sim.getParticle(0)); // слоты сверх прежних
+    for (const ParticleHandle& h : old) CHECK(!sim.isAlive(h));
+    for (size_t i = 0; i < sim.particleCount(); ++i) {
+        CHECK(sim.indexOf(sim.particles().handle(i)) == i);
+    }
+    std::remove(path.c_str());
+
+    ParticleStore store;
+    std::vector<ParticleHandle> before;
+    for (int i = 0; i < 4; ++i) before.push_back(store.push(Particle(Vec2(i, i), Vec2(0, 0), 1, 1, 0)));
+    store.clear();
+    for (int i = 0; i < 6; ++i) store.push(Particle(Vec2(i, i), Vec2(0, 0), 1, 1, 0));
+    for (const ParticleHandle& h : before) CHECK(store.indexOf(h) == ParticleStore::NO_INDEX);
+}
+
+// Продолжение с контрольной точки побитово совпадает с прогоном без
+// остановки: для каждого интегратора и решателя, с остатком в накопителе
+// фиксированного шага
+void testCheckpointResume() {
+    const std::string path = "/tmp/simulator_test_resume.chk";
+    for (Integrator integrator : { Integrator::Euler, Integrator::VelocityVerlet, Integrator::Leapfrog,
+                                   Integrator::RK4 }) {
+        for (ForceSolver solver : { ForceSolver::AllPairs, ForceSolver::BarnesHut }) {
+            PhysicsSimulator straight(80, 30);
+            straight.seed(4);
+            straight.setSolver(solver);
+            straight.setIntegrator(integrator);
+            straight.setThreadCount(2);
+            straight.generateRandomParticles(60);
+            for (int s = 0; s < 15; ++s) straight.advance(0.023);
+            straight.saveCheckpoint(path);
+            for (int s = 0; s < 20; ++s) straight.advance(0.023);
+
+            PhysicsSimulator resumed(10, 10);
+            resumed.setThreadCount(2);
+            resumed.loadCheckpoint(path);
+            CHECK(resumed.getSolver() == solver);
+            for (int s = 0; s < 20; ++s) resumed.advance(0.023);
+
+            const ParticleStore& a = straight.particles();
+            const ParticleStore& b = resumed.particles();
+            CHECK(a.size() == b.size());
+            for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+                CHECK(a.x[i] == b.x[i] && a.y[i] == b.y[i] && a.vx[i] == b.vx[i] && a.vy[i] == b.vy[i]);
+            }
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// Продолжение открытой системы с контрольной точки совпадает с прогоном
+// без остановки: дробные накопители источников и стоки тоже сохраняются
+void testOpenSystemResume() {
+    const std::string path = "/tmp/simulator_test_open.chk";
+    auto makeOpen = [] {
+        std::unique_ptr<PhysicsSimulator> sim(new PhysicsSimulator(80, 30));
+        sim->seed(3);
+        sim->generateRandomParticles(40);
+        sim->addEmitter(Emitter(Particle(Vec2(40, 2), Vec2(0, 10), 1.0, 0.5), 37.3, 20, 5));
+        sim->addSink({ Vec2(40, 30), 20 });
+        sim->setEscapeMargin(1);
+        sim->setParticleLimit(70);
+        return sim;
+    };
+
+    std::unique_ptr<PhysicsSimulator> straight = makeOpen();
+    for (int s = 0; s < 25; ++s) straight->update(0.016);
+    straight->saveCheckpoint(path);
+    for (int s = 0; s < 40; ++s) straight->update(0.016);
+
+    PhysicsSimulator resumed(10, 10);
+    resumed.loadCheckpoint(path);
+    CHECK(resumed.isOpenSystem());
+    for (int s = 0; s < 40; ++s) resumed.update(0.016);
+
+    const ParticleStore& a = straight->particles();
+    const ParticleStore& b = resumed.particles();
+    CHECK(a.size() == b.size());
+    for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+        CHECK(a.x[i] == b.x[i] && a.y[i] == b.y[i] && a.vx[i] == b.vx[i] && a.vy[i] == b.vy[i]);
+    }
+    std::remove(path.c_str());
+}
+
+// Файлы версий 1 и 2 загружаются: поля, которых в них нет, остаются по
+// умолчанию. Заголовок с нелепыми размерами области отклоняется
+void testCheckpointVersions() {
+    const std::string path = "/tmp/simulator_test_versions.chk";
+    PhysicsSimulator sim(80, 30);
+    sim.seed(8);
+    sim.generateRandomParticles(25);
+    sim.setFixedTimestep(0.01, 3);
+    sim.saveCheckpoint(path);
+
+    std::ifstream in(path, std::ios::binary);
+    const std::string current((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    auto write = [&](const std::string& bytes) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << bytes;
+    };
+
+    PhysicsSimulator reloaded(10, 10);
+    reloaded.loadCheckpoint(path);
+    CHECK(reloaded.getMaxSubsteps() == 3);
+    CHECK(reloaded.getFixedTimestep() == 0.01);
+
+    for (uint32_t version : { 1u, 2u }) {
+        checkpoint::Header h;
+        std::memcpy(&h, current.data(), sizeof(h));
+        h.version = version;
+        write(std::string(reinterpret_cast<const char*>(&h), checkpoint::headerSize(version)) +
+              current.substr(sizeof(h)));
+
+        PhysicsSimulator old(10, 10);
+        bool loaded = true;
+        try {
+            old.loadCheckpoint(path);
+        } catch (const std::exception&) {
+            loaded = false;
+        }
+        CHECK(loaded);
+        CHECK(old.getWidth() == 80 && old.getHeight() == 30);
+        CHECK(old.getMaxSubsteps() == 8);
+        CHECK(!old.isOpenSystem());
+        CHECK(old.particleCount() == sim.particleCount());
+        for (size_t i = 0; i < std::min(old.particleCount(), sim.particleCount()); ++i) {
+            CHECK(old.particles().x[i] == sim.particles().x[i] && old.particles().vy[i] == sim.particles().vy[i]);
+        }
+    }
+
+    for (double extent : { 0.0, -5.0, 1e300, std::nan("") }) {
+        checkpoint::Header h;
+        std::memcpy(&h, current.data(), sizeof(h));
+        h.height = extent;
+        write(std::string(reinterpret_cast<const char*>(&h), sizeof(h)) + current.substr(sizeof(h)));
+        bool rejected = false;
+        try {
+            reloaded.loadCheckpoint(path);
+        } catch (const std::runtime_error&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+        CHECK(reloaded.getHeight() == 30);
+    }
+    std::remove(path.c_str());
+}
+
+// Ускорения после шага длиной почти ноль: VelocityVerlet пересчитывает их в
+// конце шага, так что это силы в исходных позициях
+std::vector<Vec2> accelerations(PhysicsSimulator& sim) {
+    sim.setIntegrator(Integrator::VelocityVerlet);
+    sim.update(1e-9);
+    std::vector<Vec2> a;
+    for (size_t i = 0; i < sim.particleCount(); ++i) a.push_back(sim.getParticle(i).getAcc());
+    return a;
+}
+
+// Точный перебор не зависит от числа потоков, кроме порядка сложения
+void testAllPairsThreads() {
+    std::vector<Vec2> base;
+    for (unsigned threads : { 1u, 3u, 4u }) {
+        PhysicsSimulator sim(80, 30);
+        sim.seed(7);
+        sim.generateRandomParticles(250);
+        sim.setSolver(ForceSolver::AllPairs);
+        sim.setThreadCount(threads);
+        std::vector<Vec2> a = accelerations(sim);
+        if (base.empty()) base = a;
+        CHECK(a.size() == base.size());
+        for (size_t i = 0; i < std::min(a.size(), base.size()); ++i) {
+            CHECK((a[i] - base[i]).length() <= 1e-9 * (base[i].length() + 1));
+        }
+    }
+}
+
+// Отклонение от начальной точки после одного оборота пары равных масс
+// по круговой орбите за steps шагов
+double orbitError(Integrator integrator, int steps) {
+    const double d = 20, m = 1, G = 100; // G — постоянная симулятора по умолчанию
+    const double v = std::sqrt(G * m / (2 * d));
+    const double period = 2 * M_PI * (d / 2) / v;
+    PhysicsSimulator sim(1000, 1000);
+    sim.setIntegrator(integrator);
+    sim.addParticle(Particle(Vec2(490, 500), Vec2(0, -v), m, 0.1));
+    sim.addParticle(Particle(Vec2(510, 500), Vec2(0, v), m, 0.1));
+    for (int s = 0; s < steps; ++s) sim.update(period / steps);
+    return (sim.getParticle(0).getPos() - Vec2(490, 500)).length();
+}
+
+// Порядок схем: вдвое меньший шаг уменьшает ошибку Верле и чехарды вчетверо,
+// RK4 — не меньше чем в 12 раз, и RK4 точнее их на порядки. Догоняющих
+// шагов за кадр не больше maxSubsteps, лишнее отставание отбрасывается
+void testIntegratorOrder() {
+    for (Integrator integrator : { Integrator::VelocityVerlet, Integrator::Leapfrog }) {
+        double ratio = orbitError(integrator, 200) / orbitError(integrator, 400);
+        CHECK(ratio > 3.5 && ratio < 4.5);
+    }
+    CHECK(orbitError(Integrator::RK4, 200) / orbitError(Integrator::RK4, 400) > 12);
+    CHECK(orbitError(Integrator::RK4, 200) * 100 < orbitError(Integrator::VelocityVerlet, 200));
+
+    PhysicsSimulator sim(80, 30);
+    sim.generateRandomParticles(5);
+    sim.setFixedTimestep(0.01, 3);
+    CHECK(sim.advance(0.025) == 2);
+    CHECK(sim.advance(1.0) == 3);
+    CHECK(sim.advance(0.0) == 1); // отставание урезано до одного шага
+    CHECK(sim.advance(0.0) == 0);
+}
+
+// Барнс–Хат на смеси зарядов: облако нейтральных диполей в целом без
+// заряда, но поле у него есть. Пробные заряды вдали должны чувствовать его
+// так же, как при точном переборе
+void testBarnesHutMixedCharges() {
+    auto fill = [](PhysicsSimulator& sim) {
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<> cloud(5, 25), probe(60, 90), height(10, 50);
+        for (int k = 0; k < 200; ++k) {
+            double x = cloud(rng), y = height(rng);
+            sim.addParticle(ChargedParticle(Vec2(x, y), Vec2(0, 0), 1.0, 0.1, 1));
+            sim.addParticle(ChargedParticle(Vec2(x + 1, y), Vec2(0, 0), 1.0, 0.1, -1));
+        }
+        for (int k = 0; k < 20; ++k) {
+            sim.addParticle(ChargedParticle(Vec2(probe(rng), height(rng)), Vec2(0, 0), 1.0, 0.1, 1));
+        }
+    };
+
+    PhysicsSimulator exact(100, 60), tree(100, 60);
+    fill(exact);
+    fill(tree);
+    exact.setSolver(ForceSolver::AllPairs);
+    tree.setSolver(ForceSolver::BarnesHut);
+    tree.setTheta(0.5);
+    std::vector<Vec2> a = accelerations(exact), b = accelerations(tree);
+
+    double worst = 0;
+    for (size_t i = 400; i < a.size(); ++i) {
+        worst = std::max(worst, (b[i] - a[i]).length() / a[i].length());
+    }
+    CHECK(worst < 0.01);
+}
+
+// --steps 0 приводил к делению на ноль в отчёте, а --particles -5
+// заворачивался в огромное число: такие значения должны отклоняться ещё
+// при разборе аргументов
+void testRejectZeroSteps() {
+    const std::pair<const char*, const char*> bad[] = {
+        { "--steps", "0" },       { "--steps", "-3" },       { "--particles", "0" },
+        { "--particles", "-5" }, { "--particles", "2147483648" },
+    };
+    for (const auto& b : bad) {
+        const char* args[] = { "simulator", "--headless", b.first, b.second };
+        RunOptions opt;
+        bool rejected = false;
+        try {
+            parseOptions(4, const_cast<char**>(args), opt);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+
+    const char* args[] = { "simulator", "--headless", "--steps", "1", "--particles", "1" };
+    RunOptions opt;
+    CHECK(parseOptions(6, const_cast<char**>(args), opt));
+    CHECK(opt.steps == 1);
+    CHECK(opt.particles == 1);
+}
+
+// Силы по умолчанию точные: Барнс–Хат включается только явно
+void testDefaultSolver() {
+    PhysicsSimulator sim(80, 30);
+    CHECK(sim.getSolver() == ForceSolver::AllPairs);
+
+    const char* args[] = { "simulator", "--headless" };
+    RunOptions opt;
+    CHECK(parseOptions(2, const_cast<char**>(args), opt));
+    CHECK(opt.solver == ForceSolver::AllPairs);
+}
+
+// Скобки JSON сбалансированы вне строк, строки закрыты, после корня пусто
+static bool balancedJson(const std::string& s) {
+    std::vector<char> open;
+    bool inString = false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (inString) {
+            if (c == '\\') ++i;
+            else if (c == '"') inString = false;
+            else if (static_cast<unsigned char>(c) < 0x20) return false;
+            continue;
+        }
+        if (c == '"') inString = true;
+        else if (c == '{' || c == '[') open.push_back(c);
+        else if (c == '}' || c == ']') {
+            if (open.empty() || open.back() != (c == '}' ? '{' : '[')) return false;
+            open.pop_back();
+            if (open.empty() && s.find_first_not_of(" \n", i + 1) != std::string::npos) return false;
+        }
+    }
+    return open.empty() && !inString;
+}
+
+static size_t occurrences(const std::string& s, const std::string& what) {
+    size_t n = 0;
+    for (size_t at = s.find(what); at != std::string::npos; at = s.find(what, at + 1)) ++n;
+    return n;
+}
+
+// Профиль: замеры до сессии не считаются, счётчики из нескольких потоков
+// складываются, гистограмма раскладывает значения по степеням двойки,
+// каждый таймер даёт событие трассировки; имя с кавычкой экранируется
+void testProfilerSession() {
+    const std::string path = "/tmp/simulator_test_profile.json";
+    PROFILE_COUNT("test_items", 1000);
+    {
+        profiler::Session session(path);
+        CHECK(session.active() && profiler::enabled());
+        ThreadPool pool(4);
+        pool.run([](unsigned) {
+            for (int i = 0; i < 1000; ++i) PROFILE_COUNT("test_items", 5);
+        });
+        for (uint64_t v : { 0, 1, 3, 1000 }) PROFILE_VALUE("test_sizes", v);
+        for (int i = 0; i < 10; ++i) {
+            PROFILE_SCOPE("test_scope");
+        }
+        PROFILE_COUNT("test \"quoted\"", 2);
+        bool threw = false;
+        try {
+            profiler::metric("test_items", profiler::Kind::Timer);
+        } catch (const std::logic_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+
+        PhysicsSimulator sim(80, 30);
+        sim.seed(24);
+        sim.generateRandomParticles(200);
+        for (int i = 0; i < 3; ++i) sim.update(0.016);
+    }
+    CHECK(!profiler::enabled());
+
+    std::ifstream in(path);
+    const std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    CHECK(balancedJson(json));
+    CHECK(json.find("\"test_items\": 20000") != std::string::npos);
+    CHECK(json.find("\"test \\\"quoted\\\"\": 2") != std::string::npos);
+    CHECK(json.find("\"test_sizes\": {\"count\":4,\"total\":1004.000,\"mean\":251.000,\"min\":0.000,"
+                    "\"max\":1000.000,\"buckets\":[[0.000,1],[2.000,1],[4.000,1],[1024.000,1]]}") != std::string::npos);
+    CHECK(json.find("\"test_scope\": {\"count\":10,") != std::string::npos);
+    CHECK(occurrences(json, "{\"name\":\"test_scope\",\"ph\":\"X\"") == 10);
+    CHECK(occurrences(json, "{\"name\":\"update\",\"ph\":\"X\"") == 3);
+    CHECK(json.find("\"droppedEvents\": 0") != std::string::npos);
+    std::remove(path.c_str());
+}
+
+int main() {
+    testPoolResize();
+    testPoolExceptions();
+    testPairSumsSymmetric();
+    testSpatialHashMatchesBruteForce();
+    testTrajectoryRoundTrip();
+    testRendererDiff();
+    testVectorKernelsMatchScalar();
+    testRejectZeroSteps();
+    testCheckpointResume();
+    testHandlesAfterReload();
+    testOpenSystemResume();
+    testCheckpointVersions();
+    testDefaultSolver();
+    testBarnesHutMixedCharges();
+    testAllPairsThreads();
+    testIntegratorOrder();
+    testProfilerSession();
+    if (failures) {
+        std::cerr << failures << " проверок не прошло\n";
+        return 1;
+    }
+    std::cout << "simulator_test: OK\n";
+    return 0;
+}